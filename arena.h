@@ -0,0 +1,44 @@
+#pragma once
+#include <stdlib.h>
+#include <stdint.h>
+
+// Alignment of objects carved from an arena, one cache line
+#define ARENA_ALIGN 64
+
+/**
+ * Carves objects one after another out of a single block of memory. An arena
+ * without a base only measures the block, so sizes can be computed by the
+ * same steps that lay it out later.
+ */
+struct arena {
+	char * base;
+	size_t used;
+};
+
+static inline size_t arena_round(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+/**
+ * Reserves the next cache-aligned piece of the block.
+ *
+ * @param a Arena
+ * @param size Size of the piece, in bytes
+ * @returns Piece, or NULL if only measuring
+ */
+static inline void * arena_alloc(struct arena * a, size_t size) {
+	size_t offset = arena_round(a->used);
+	a->used = offset + size;
+
+	return a->base ? a->base + offset : NULL;
+}
+
+/**
+ * Allocates a cache-aligned block for an arena, to be released with free.
+ *
+ * @param size Size of the block, in bytes
+ * @returns Block, or NULL on error
+ */
+static inline void * arena_malloc(size_t size) {
+	return aligned_alloc(ARENA_ALIGN, arena_round(size ? size : 1));
+}
@@ -0,0 +1,985 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bfsk.h"
+#include "goertzel.h"
+#include "resample.h"
+#include "telegram.h"
+#include "uicdemod.h"
+#include "uicmod.h"
+
+#define DEFAULT_SECONDS 0.25
+#define DEFAULT_NOISE 0.05
+#define SIGNAL_CYCLES 8
+#define DECIMATED_RATE 12000
+#define DECIMATED_PASSBAND 3000
+#define BER_RATE 16000
+#define BER_WORDS 256
+#define DRIFT_TELEGRAMS 64
+#define DRIFT_NOISE 0.1
+#define SAMPLER_TELEGRAMS 64
+#define CLEAN_TELEGRAMS 64
+#define SKIP_EVENTS 16
+#define SKIP_SLACK 2
+
+static const char * me;
+
+static const float sample_rates[] = { 12000, 16000, 22050, 44100, 48000 };
+static const int buffer_millis[] = { 10, 50, 200 };
+
+static const struct bfsk_params fskparams = {
+	.bps = 600,
+	.mark_hz = 1300,
+	.space_hz = 1700
+};
+
+static const float freqs[] = { 1520, 1960, 2280, 2800 };
+
+static const float ber_noise[] = { 0.1, 0.2, 0.3, 0.4, 0.5 };
+
+static const float drift_ppm[] = { -30000, -20000, -5000, 0, 5000, 20000, 30000 };
+
+static const float sampler_noise[] = { 0.1, 0.15, 0.2 };
+
+static const int sampler_counts[] = { 1, 3, 5 };
+
+static const float clean_rates[] = { 12000, 22050, 48000 };
+
+static const struct {
+	uicdemod_status_t tone;
+	const char * name;
+} skip_tones[] = {
+	{ UICDEMOD_PILOT, "pilot" },
+	{ UICDEMOD_WARNING, "warning" },
+	{ UICDEMOD_LISTENING, "listening" },
+	{ UICDEMOD_CHFREE, "chfree" },
+};
+
+static const struct {
+	const char * name;
+	bfsk_timing_t timing;
+} bfsk_timings[] = {
+	{ "reset", BFSK_TIMING_RESET },
+	{ "pll", BFSK_TIMING_PLL }
+};
+
+static const struct {
+	const char * name;
+	bfsk_engine_t engine;
+} bfsk_engines[] = {
+	{ "correlator", BFSK_ENGINE_PACKED },
+	{ "quadrature", BFSK_ENGINE_QUADRATURE }
+};
+
+struct signal {
+	float * samples;
+	int16_t * samples_s16;
+	size_t sample_count;
+	int telegram_count;
+};
+
+struct context {
+	double min_seconds;
+	float noise;
+	const char * write_path;
+};
+
+struct measure {
+	const struct signal * sig;
+	size_t buffer_size;
+
+	goertzel_t * goertzel;
+	bfsk_t * demod;
+	uicdemod_t * uic;
+	int packets;
+
+	// Decimating front-end followed by a demodulator at the lower rate
+	resample_t * resample;
+	float * decimated;
+	uicdemod_t * uic_decimated;
+};
+
+void show_usage() {
+	fprintf(stderr,
+			"UIC-751-3 demodulator benchmark\n"
+			"Usage: %s [OPTION]\n"
+			"Synthesizes UIC-751-3 signals and measures the decoding speed of each stage,\n"
+			"and the bit error rate of each BFSK demodulator against noise, and fails if\n"
+			"any demodulator misses a telegram of a noiseless signal, or reports other\n"
+			"events when a buffer is lost in the middle of a tone\n"
+			"\n"
+			"Options:\n"
+			"  -s[SECONDS] minimum measuring time per stage (default: %g)\n"
+			"  -n[LEVEL]   noise standard deviation, signal peak is 0.5 (default: %g)\n"
+			"  -w[FILE]    write the 16kHz test signal as raw floats to a file and exit\n"
+			"  -h, -?      shows this help text\n",
+			me, DEFAULT_SECONDS, DEFAULT_NOISE
+	);
+}
+
+bool parse_config(struct context * ctx, int argc, char ** argv) {
+	me = argv[0];
+
+	ctx->min_seconds = DEFAULT_SECONDS;
+	ctx->noise = DEFAULT_NOISE;
+
+	int c;
+	while ((c = getopt(argc, argv, "hs:n:w:")) != -1) {
+		switch (c) {
+			case 'h':
+			case '?':
+				show_usage();
+				return false;
+
+			case 's':
+				ctx->min_seconds = atof(optarg);
+				break;
+
+			case 'n':
+				ctx->noise = atof(optarg);
+				break;
+
+			case 'w':
+				ctx->write_path = optarg;
+				break;
+
+			default:
+				fprintf(stderr, "Error: unknown option \"%c\"", c);
+				return false;
+		}
+	}
+
+	if (ctx->min_seconds <= 0) {
+		fprintf(stderr, "Error: invalid measuring time\n");
+		return false;
+	}
+
+	if (ctx->noise < 0) {
+		fprintf(stderr, "Error: invalid noise level\n");
+		return false;
+	}
+
+	return true;
+}
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Builds a test signal cycling through every tone and a couple of telegrams.
+ */
+bool build_signal(struct signal * sig, float sample_rate, float noise) {
+	uicmod_t * m = uicmod_init(sample_rate);
+	if (m == NULL) {
+		return false;
+	}
+	uicmod_set_noise(m, noise, 1);
+
+	// Each cycle is a bit under four seconds long
+	sig->samples = malloc(uicmod_max_samples(m, 4) * SIGNAL_CYCLES * sizeof(float));
+	if (sig->samples == NULL) {
+		uicmod_free(m);
+		return false;
+	}
+
+	static const uicdemod_status_t tones[] = {
+		UICDEMOD_PILOT, UICDEMOD_WARNING, UICDEMOD_LISTENING, UICDEMOD_CHFREE
+	};
+
+	float * out = sig->samples;
+	sig->telegram_count = 0;
+	for (int cycle = 0; cycle < SIGNAL_CYCLES; cycle++) {
+		out += uicmod_tone(m, tones[cycle % 4], 0.6, out);
+		out += uicmod_tone(m, UICDEMOD_NONE, 0.3, out);
+
+		for (int i = 0; i < 2; i++) {
+			out += uicmod_bits(m, 0x5555, 16, out);
+			out += uicmod_telegram(m, 0x123456 + cycle * 0x10 + i, 0x40 + cycle, out);
+			out += uicmod_bits(m, 0x55, 8, out);
+			out += uicmod_tone(m, UICDEMOD_NONE, 0.3, out);
+			sig->telegram_count++;
+		}
+	}
+	sig->sample_count = out - sig->samples;
+	uicmod_free(m);
+
+	sig->samples_s16 = malloc(sig->sample_count * sizeof(int16_t));
+	if (sig->samples_s16 == NULL) {
+		free(sig->samples);
+		return false;
+	}
+
+	for (size_t i = 0; i < sig->sample_count; i++) {
+		float sample = sig->samples[i] * 32768;
+		sig->samples_s16[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : lrintf(sample);
+	}
+
+	return true;
+}
+
+/**
+ * Stage to be measured, run on a buffer starting at sample {@code pos}
+ */
+typedef void (*stage_t)(struct measure * ms, size_t pos, size_t count);
+
+void run_goertzel(struct measure * ms, size_t pos, size_t count) {
+	float fmag[4];
+	goertzel_magnitude(ms->goertzel, ms->sig->samples + pos, count, fmag);
+}
+
+void run_goertzel_s16(struct measure * ms, size_t pos, size_t count) {
+	float fmag[4];
+	goertzel_magnitude_s16(ms->goertzel, ms->sig->samples_s16 + pos, count, fmag);
+}
+
+void run_bfsk(struct measure * ms, size_t pos, size_t count) {
+	const float * samples = ms->sig->samples + pos;
+	struct bfsk_symbol symbols[64];
+	while (count > 0) {
+		bfsk_analyze_block(ms->demod, &samples, &count, symbols, 64);
+	}
+}
+
+void run_bfsk_s16(struct measure * ms, size_t pos, size_t count) {
+	const int16_t * samples = ms->sig->samples_s16 + pos;
+	struct bfsk_symbol symbols[64];
+	while (count > 0) {
+		bfsk_analyze_block_s16(ms->demod, &samples, &count, symbols, 64);
+	}
+}
+
+void count_packet(void * arg, const struct uicdemod_event * event) {
+	struct measure * ms = arg;
+	if (event->status == UICDEMOD_PACKET && event->telegram.status == TELEGRAM_OK) {
+		ms->packets++;
+	}
+}
+
+void run_pipeline(struct measure * ms, size_t pos, size_t count) {
+	uicdemod_analyze_callback(ms->uic, ms->sig->samples + pos, count, count_packet, ms);
+}
+
+void run_pipeline_s16(struct measure * ms, size_t pos, size_t count) {
+	uicdemod_analyze_s16_callback(ms->uic, ms->sig->samples_s16 + pos, count, count_packet, ms);
+}
+
+/**
+ * Runs a stage once over the whole signal, buffer by buffer.
+ */
+void run_signal(struct measure * ms, stage_t stage) {
+	const struct signal * sig = ms->sig;
+
+	for (size_t pos = 0; pos < sig->sample_count; pos += ms->buffer_size) {
+		size_t count = sig->sample_count - pos;
+		if (count > ms->buffer_size) {
+			count = ms->buffer_size;
+		}
+		stage(ms, pos, count);
+	}
+}
+
+/**
+ * Runs a stage over the whole signal until the minimum measuring time has
+ * elapsed.
+ *
+ * @returns nanoseconds per sample
+ */
+double measure(struct context * ctx, struct measure * ms, stage_t stage) {
+	size_t total = 0;
+	double start = now();
+	double elapsed;
+
+	do {
+		run_signal(ms, stage);
+		total += ms->sig->sample_count;
+		elapsed = now() - start;
+	} while (elapsed < ctx->min_seconds);
+
+	return elapsed * 1e9 / total;
+}
+
+void print_result(float sample_rate, int millis, const char * stage, double ns_per_sample, const char * extra) {
+	printf("%6.0f %6d %-10s %12.2f %10.2f %s\n", sample_rate, millis, stage, 1e3 / ns_per_sample, ns_per_sample, extra);
+}
+
+void run_decimated(struct measure * ms, size_t pos, size_t count) {
+	size_t decimated_count = resample_process(ms->resample, ms->sig->samples + pos, count, ms->decimated);
+	uicdemod_analyze_callback(ms->uic_decimated, ms->decimated, decimated_count, count_packet, ms);
+}
+
+/**
+ * Counts the packets decoded by a pipeline stage in a single pass over the
+ * signal, after measuring its speed.
+ */
+void print_pipeline(struct context * ctx, struct measure * ms, float sample_rate, int millis, const char * stage,
+		stage_t run, uicdemod_t ** uic, float uic_rate) {
+	char extra[64];
+	double ns = measure(ctx, ms, run);
+
+	uicdemod_free(*uic);
+	*uic = uicdemod_init(uic_rate);
+	ms->packets = 0;
+	if (*uic != NULL) {
+		run_signal(ms, run);
+	}
+
+	snprintf(extra, sizeof(extra), "(%d/%d packets)", ms->packets, ms->sig->telegram_count);
+	print_result(sample_rate, millis, stage, ns, extra);
+}
+
+/**
+ * Demodulates a whole buffer, with offsets counted from its first sample.
+ *
+ * @returns number of symbols, at most one per sample
+ */
+size_t demodulate_buffer(bfsk_t * demod, const float * samples, size_t sample_count, struct bfsk_symbol * symbols) {
+	size_t remaining = sample_count;
+	size_t found = 0;
+	while (remaining > 0) {
+		size_t start = sample_count - remaining;
+		size_t count = bfsk_analyze_block(demod, &samples, &remaining, symbols + found, sample_count - found);
+		for (size_t i = found; i < found + count; i++) {
+			symbols[i].offset += start;
+		}
+		found += count;
+	}
+	return found;
+}
+
+/**
+ * Runs the reference and the packed correlators side by side over the signal,
+ * buffer by buffer, and checks that they return the same symbols.
+ *
+ * @returns false if they differ
+ */
+bool check_bfsk(const struct signal * sig, float sample_rate, size_t buffer_size) {
+	bfsk_t * reference = bfsk_init(&fskparams, sample_rate);
+	bfsk_t * packed = bfsk_init(&fskparams, sample_rate);
+	struct bfsk_symbol * reference_symbols = malloc(buffer_size * sizeof(struct bfsk_symbol));
+	struct bfsk_symbol * packed_symbols = malloc(buffer_size * sizeof(struct bfsk_symbol));
+
+	bool ok = reference != NULL && packed != NULL && reference_symbols != NULL && packed_symbols != NULL;
+	if (!ok) {
+		fprintf(stderr, "Error: could not initialize demodulators\n");
+	} else {
+		bfsk_set_engine(reference, BFSK_ENGINE_CORRELATOR);
+		bfsk_set_engine(packed, BFSK_ENGINE_PACKED);
+	}
+
+	for (size_t pos = 0; ok && pos < sig->sample_count; pos += buffer_size) {
+		size_t count = sig->sample_count - pos;
+		if (count > buffer_size) {
+			count = buffer_size;
+		}
+
+		size_t reference_count = demodulate_buffer(reference, sig->samples + pos, count, reference_symbols);
+		size_t packed_count = demodulate_buffer(packed, sig->samples + pos, count, packed_symbols);
+
+		for (size_t i = 0; ok && i < reference_count; i++) {
+			const struct bfsk_symbol * a = &reference_symbols[i], * b = &packed_symbols[i];
+			if (i >= packed_count || a->result != b->result || a->offset != b->offset || a->sampler != b->sampler) {
+				fprintf(stderr, "Error: packed correlator differs from the reference at sample %zu\n", pos + a->offset);
+				ok = false;
+			}
+		}
+
+		if (ok && packed_count != reference_count) {
+			fprintf(stderr, "Error: packed correlator differs from the reference at sample %zu\n", pos + packed_symbols[reference_count].offset);
+			ok = false;
+		}
+	}
+
+	free(packed_symbols);
+	free(reference_symbols);
+	bfsk_free(packed);
+	bfsk_free(reference);
+	return ok;
+}
+
+bool bench_rate(struct context * ctx, float sample_rate) {
+	struct signal sig;
+	if (!build_signal(&sig, sample_rate, ctx->noise)) {
+		fprintf(stderr, "Error: could not build test signal\n");
+		return false;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < sizeof(buffer_millis) / sizeof(buffer_millis[0]); i++) {
+		struct measure ms = {
+			.sig = &sig,
+			.buffer_size = sample_rate * buffer_millis[i] / 1000,
+			.goertzel = goertzel_init(freqs, 4, sample_rate),
+			.demod = bfsk_init(&fskparams, sample_rate),
+			.uic = uicdemod_init(sample_rate)
+		};
+
+		if (ms.goertzel == NULL || ms.demod == NULL || ms.uic == NULL) {
+			fprintf(stderr, "Error: could not initialize demodulators\n");
+			ok = false;
+		} else {
+			char extra[64];
+
+			snprintf(extra, sizeof(extra), "(%s)", goertzel_engine_name(ms.goertzel));
+			print_result(sample_rate, buffer_millis[i], "goertzel", measure(ctx, &ms, run_goertzel), extra);
+
+			// Packed correlator, next to the reference one it must match
+			bfsk_set_engine(ms.demod, BFSK_ENGINE_CORRELATOR);
+			print_result(sample_rate, buffer_millis[i], "bfsk-ref", measure(ctx, &ms, run_bfsk), "(reference)");
+			bfsk_set_engine(ms.demod, BFSK_ENGINE_PACKED);
+			print_result(sample_rate, buffer_millis[i], "bfsk", measure(ctx, &ms, run_bfsk), "(packed)");
+			if (!check_bfsk(&sig, sample_rate, ms.buffer_size)) {
+				ok = false;
+			}
+
+			bfsk_set_engine(ms.demod, BFSK_ENGINE_QUADRATURE);
+			print_result(sample_rate, buffer_millis[i], "bfsk-iq", measure(ctx, &ms, run_bfsk), "(quadrature)");
+
+			print_pipeline(ctx, &ms, sample_rate, buffer_millis[i], "pipeline", run_pipeline, &ms.uic, sample_rate);
+
+			// Fixed-point path, over the same signal rounded to 16 bits
+			print_result(sample_rate, buffer_millis[i], "goertzel16", measure(ctx, &ms, run_goertzel_s16), "(fixed)");
+			bfsk_set_engine(ms.demod, BFSK_ENGINE_PACKED);
+			print_result(sample_rate, buffer_millis[i], "bfsk16", measure(ctx, &ms, run_bfsk_s16), "(packed)");
+
+			uicdemod_free(ms.uic);
+			ms.uic = uicdemod_init(sample_rate);
+			if (ms.uic == NULL) {
+				fprintf(stderr, "Error: could not initialize demodulators\n");
+				ok = false;
+			} else {
+				print_pipeline(ctx, &ms, sample_rate, buffer_millis[i], "pipeline16", run_pipeline_s16, &ms.uic, sample_rate);
+			}
+		}
+
+		if (ok && sample_rate >= 2 * DECIMATED_RATE) {
+			ms.resample = resample_init(sample_rate, DECIMATED_RATE, DECIMATED_PASSBAND);
+			ms.decimated = ms.resample ? malloc(resample_max_output(ms.resample, ms.buffer_size) * sizeof(float)) : NULL;
+			ms.uic_decimated = uicdemod_init(DECIMATED_RATE);
+
+			if (ms.decimated == NULL || ms.uic_decimated == NULL) {
+				fprintf(stderr, "Error: could not initialize decimator\n");
+				ok = false;
+			} else {
+				print_pipeline(ctx, &ms, sample_rate, buffer_millis[i], "decimated", run_decimated, &ms.uic_decimated, DECIMATED_RATE);
+			}
+		}
+
+		uicdemod_free(ms.uic_decimated);
+		free(ms.decimated);
+		resample_free(ms.resample);
+		uicdemod_free(ms.uic);
+		bfsk_free(ms.demod);
+		goertzel_free(ms.goertzel);
+	}
+
+	free(sig.samples_s16);
+	free(sig.samples);
+	return ok;
+}
+
+bool bench_telegram(struct context * ctx) {
+	telegram_t * t = telegram_init();
+	if (t == NULL) {
+		fprintf(stderr, "Error: could not initialize telegram parser\n");
+		return false;
+	}
+
+	uint64_t bits = telegram_encode(0x123456, 0x42);
+	size_t total = 0;
+	int done = 0;
+	double start = now();
+	double elapsed;
+
+	do {
+		for (int i = 0; i < 1000; i++) {
+			for (int bit = 50; bit >= 0; bit--) {
+				telegram_feed(t, (bits >> bit) & 1);
+			}
+			done += telegram_status(t) == TELEGRAM_OK;
+		}
+		total += 1000 * 51;
+		elapsed = now() - start;
+	} while (elapsed < ctx->min_seconds);
+
+	double ns = elapsed * 1e9 / total;
+	printf("%6s %6s %-10s %12.2f %10.2f (%d telegrams, per bit)\n", "-", "-", "telegram", 1e3 / ns, ns, done);
+
+	telegram_free(t);
+	return true;
+}
+
+/**
+ * Counts bit errors in a demodulated bit stream against the sent words. The
+ * stream is realigned at the start of each word, within a couple of bits, so
+ * bit slips only cost the bits around them, while missing words count as
+ * all wrong.
+ *
+ * @returns number of bit errors
+ */
+size_t count_bit_errors(const uint64_t * words, size_t word_count, const uint8_t * bits, size_t bit_count) {
+	size_t errors = 0;
+	size_t pos = 0;
+
+	// Look for the first word anywhere, past the noise before the signal
+	size_t search_from = 0, search_to = bit_count;
+
+	for (size_t word = 0; word < word_count; word++) {
+		size_t best_errors = 64, best_pos = pos;
+
+		for (size_t start = search_from; start < search_to && start + 64 <= bit_count; start++) {
+			size_t word_errors = 0;
+			for (int bit = 0; bit < 64; bit++) {
+				word_errors += bits[start + bit] != ((words[word] >> (63 - bit)) & 1);
+			}
+
+			if (word_errors < best_errors) {
+				best_errors = word_errors;
+				best_pos = start;
+			}
+		}
+
+		errors += best_errors;
+		pos = best_pos + 64;
+		search_from = pos >= 2 ? pos - 2 : 0;
+		search_to = pos + 3;
+	}
+
+	return errors;
+}
+
+/**
+ * Measures the bit error rate of every BFSK engine over random bits at
+ * increasing noise levels.
+ */
+bool bench_ber(struct context * ctx) {
+	uicmod_t * m = uicmod_init(BER_RATE);
+	uint64_t * words = malloc(BER_WORDS * sizeof(uint64_t));
+	float * samples = m ? malloc(uicmod_max_samples(m, 0.1 + BER_WORDS * 64 / fskparams.bps) * 2 * sizeof(float)) : NULL;
+	uint8_t * bits = malloc(BER_WORDS * 64 * 2);
+	bfsk_t * demod = bfsk_init(&fskparams, BER_RATE);
+	if (m == NULL || words == NULL || samples == NULL || bits == NULL || demod == NULL) {
+		fprintf(stderr, "Error: could not initialize bit error rate test\n");
+		bfsk_free(demod);
+		free(bits);
+		free(samples);
+		free(words);
+		uicmod_free(m);
+		return false;
+	}
+
+	// Simple xorshift, so every engine and run sees the same bits
+	uint64_t state = 0x9E3779B97F4A7C15ULL;
+	for (size_t i = 0; i < BER_WORDS; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		words[i] = state;
+	}
+
+	printf("\n%6s %-10s %10s %10s %10s\n", "noise", "engine", "bits", "errors", "BER");
+	for (size_t n = 0; n < sizeof(ber_noise) / sizeof(ber_noise[0]); n++) {
+		uicmod_set_noise(m, ber_noise[n], 1);
+
+		float * out = samples;
+		out += uicmod_tone(m, UICDEMOD_NONE, 0.1, out);
+		out += uicmod_bits(m, 0x5555, 16, out);
+		for (size_t i = 0; i < BER_WORDS; i++) {
+			out += uicmod_bits(m, words[i], 64, out);
+		}
+		out += uicmod_tone(m, UICDEMOD_NONE, 0.1, out);
+
+		for (size_t e = 0; e < sizeof(bfsk_engines) / sizeof(bfsk_engines[0]); e++) {
+			bfsk_set_engine(demod, bfsk_engines[e].engine);
+
+			const float * in = samples;
+			size_t remaining = out - samples;
+			size_t bit_count = 0;
+			while (remaining > 0 && bit_count < BER_WORDS * 64 * 2) {
+				bfsk_result_t result = bfsk_analyze(demod, &in, &remaining);
+				if (result == BFSK_ZERO || result == BFSK_ONE) {
+					bits[bit_count++] = result == BFSK_ONE;
+				}
+			}
+
+			size_t errors = count_bit_errors(words, BER_WORDS, bits, bit_count);
+			printf("%6.2f %-10s %10d %10zu %10.2e\n", ber_noise[n], bfsk_engines[e].name, BER_WORDS * 64, errors, (double) errors / (BER_WORDS * 64));
+		}
+	}
+
+	bfsk_free(demod);
+	free(bits);
+	free(samples);
+	free(words);
+	uicmod_free(m);
+	return true;
+}
+
+struct drift_result {
+	int packets;
+	double clock_error;
+};
+
+void count_drift_packet(void * arg, const struct uicdemod_event * event) {
+	struct drift_result * result = arg;
+	if (event->status == UICDEMOD_PACKET && event->telegram.status == TELEGRAM_OK) {
+		result->packets++;
+		result->clock_error += event->clock_error;
+	}
+}
+
+/**
+ * Counts the telegrams received with each timing recovery mode when the
+ * transmitter clock is off, in a noisy channel.
+ */
+bool bench_drift(struct context * ctx) {
+	printf("\n%8s %-10s %10s %12s\n", "drift", "timing", "packets", "clock error");
+
+	for (size_t i = 0; i < sizeof(drift_ppm) / sizeof(drift_ppm[0]); i++) {
+		// A transmitter running faster than ours sends its samples faster too
+		uicmod_t * m = uicmod_init(BER_RATE / (1 + drift_ppm[i] / 1e6));
+		float * samples = m ? malloc(uicmod_max_samples(m, 0.3) * DRIFT_TELEGRAMS * sizeof(float)) : NULL;
+		if (samples == NULL) {
+			fprintf(stderr, "Error: could not build drift test signal\n");
+			uicmod_free(m);
+			return false;
+		}
+		uicmod_set_noise(m, DRIFT_NOISE, 1);
+
+		float * out = samples;
+		for (int t = 0; t < DRIFT_TELEGRAMS; t++) {
+			out += uicmod_bits(m, 0x5555, 16, out);
+			out += uicmod_telegram(m, 0x123456 + t, 0x40 + t % 16, out);
+			out += uicmod_bits(m, 0x55, 8, out);
+			out += uicmod_tone(m, UICDEMOD_NONE, 0.1, out);
+		}
+
+		for (size_t t = 0; t < sizeof(bfsk_timings) / sizeof(bfsk_timings[0]); t++) {
+			struct drift_result result = { 0 };
+			uicdemod_t * uic = uicdemod_init(BER_RATE);
+			if (uic == NULL) {
+				fprintf(stderr, "Error: could not initialize demodulators\n");
+				free(samples);
+				uicmod_free(m);
+				return false;
+			}
+
+			uicdemod_set_symbol_timing(uic, bfsk_timings[t].timing);
+			uicdemod_analyze_callback(uic, samples, out - samples, count_drift_packet, &result);
+			uicdemod_free(uic);
+
+			char packets[32];
+			snprintf(packets, sizeof(packets), "%d/%d", result.packets, DRIFT_TELEGRAMS);
+			printf("%+7.0fppm %-10s %10s", drift_ppm[i], bfsk_timings[t].name, packets);
+			if (bfsk_timings[t].timing == BFSK_TIMING_PLL && result.packets > 0) {
+				printf(" %+9.0fppm", result.clock_error / result.packets * 1e6);
+			}
+			printf("\n");
+		}
+
+		free(samples);
+		uicmod_free(m);
+	}
+
+	return true;
+}
+
+void count_nothing(void * arg, const struct uicdemod_event * event) {
+}
+
+/**
+ * Counts the telegrams received with several bit samplers at increasing noise
+ * levels, and how long demodulating every sample takes with them.
+ */
+bool bench_samplers(struct context * ctx) {
+	printf("\n%6s %-10s %8s %10s %10s\n", "noise", "timing", "samplers", "packets", "ns/sample");
+
+	for (size_t n = 0; n < sizeof(sampler_noise) / sizeof(sampler_noise[0]); n++) {
+		uicmod_t * m = uicmod_init(BER_RATE);
+		float * samples = m ? malloc(uicmod_max_samples(m, 0.3) * SAMPLER_TELEGRAMS * sizeof(float)) : NULL;
+		if (samples == NULL) {
+			fprintf(stderr, "Error: could not build sampler test signal\n");
+			uicmod_free(m);
+			return false;
+		}
+		uicmod_set_noise(m, sampler_noise[n], 1);
+
+		float * out = samples;
+		for (int t = 0; t < SAMPLER_TELEGRAMS; t++) {
+			out += uicmod_bits(m, 0x5555, 16, out);
+			out += uicmod_telegram(m, 0x123456 + t, 0x40 + t % 16, out);
+			out += uicmod_bits(m, 0x55, 8, out);
+			out += uicmod_tone(m, UICDEMOD_NONE, 0.1, out);
+		}
+
+		for (size_t t = 0; t < sizeof(bfsk_timings) / sizeof(bfsk_timings[0]); t++) {
+			for (size_t c = 0; c < sizeof(sampler_counts) / sizeof(sampler_counts[0]); c++) {
+				struct drift_result result = { 0 };
+				uicdemod_t * uic = uicdemod_init(BER_RATE);
+				if (uic == NULL) {
+					fprintf(stderr, "Error: could not initialize demodulators\n");
+					free(samples);
+					uicmod_free(m);
+					return false;
+				}
+
+				// Demodulate every sample, so the cost of the samplers shows
+				uicdemod_set_gating(uic, false);
+				uicdemod_set_symbol_timing(uic, bfsk_timings[t].timing);
+				uicdemod_set_bit_samplers(uic, sampler_counts[c]);
+
+				// Packets are only counted on the first pass
+				size_t total = 0;
+				double start = now();
+				double elapsed;
+				do {
+					uicdemod_analyze_callback(uic, samples, out - samples, total ? count_nothing : count_drift_packet, &result);
+					total += out - samples;
+					elapsed = now() - start;
+				} while (elapsed < ctx->min_seconds);
+				double ns = elapsed * 1e9 / total;
+				uicdemod_free(uic);
+
+				char packets[32];
+				snprintf(packets, sizeof(packets), "%d/%d", result.packets, SAMPLER_TELEGRAMS);
+				printf("%6.2f %-10s %8d %10s %10.2f\n", sampler_noise[n], bfsk_timings[t].name, sampler_counts[c], packets, ns);
+			}
+		}
+
+		free(samples);
+		uicmod_free(m);
+	}
+
+	return true;
+}
+
+/**
+ * Checks that every engine and timing recovery mode decodes every telegram of
+ * a noiseless signal, separated by silence, at several sample rates.
+ *
+ * @returns false if any telegram was missed
+ */
+bool bench_clean(struct context * ctx) {
+	printf("\n%6s %-10s %-10s %10s\n", "rate", "engine", "timing", "packets");
+
+	bool ok = true;
+	for (size_t r = 0; r < sizeof(clean_rates) / sizeof(clean_rates[0]); r++) {
+		uicmod_t * m = uicmod_init(clean_rates[r]);
+		float * samples = m ? malloc(uicmod_max_samples(m, 0.3) * CLEAN_TELEGRAMS * sizeof(float)) : NULL;
+		if (samples == NULL) {
+			fprintf(stderr, "Error: could not build clean test signal\n");
+			uicmod_free(m);
+			return false;
+		}
+
+		float * out = samples;
+		for (int t = 0; t < CLEAN_TELEGRAMS; t++) {
+			out += uicmod_bits(m, 0x5555, 16, out);
+			out += uicmod_telegram(m, 0x123456 + t, 0x40 + t % 16, out);
+			out += uicmod_bits(m, 0x55, 8, out);
+			out += uicmod_tone(m, UICDEMOD_NONE, 0.1, out);
+		}
+
+		for (size_t e = 0; e < sizeof(bfsk_engines) / sizeof(bfsk_engines[0]); e++) {
+			for (size_t t = 0; t < sizeof(bfsk_timings) / sizeof(bfsk_timings[0]); t++) {
+				struct drift_result result = { 0 };
+				uicdemod_t * uic = uicdemod_init(clean_rates[r]);
+				if (uic == NULL) {
+					fprintf(stderr, "Error: could not initialize demodulators\n");
+					free(samples);
+					uicmod_free(m);
+					return false;
+				}
+
+				uicdemod_set_bfsk_engine(uic, bfsk_engines[e].engine);
+				uicdemod_set_symbol_timing(uic, bfsk_timings[t].timing);
+				uicdemod_analyze_callback(uic, samples, out - samples, count_drift_packet, &result);
+				uicdemod_free(uic);
+
+				char packets[32];
+				snprintf(packets, sizeof(packets), "%d/%d", result.packets, CLEAN_TELEGRAMS);
+				printf("%6.0f %-10s %-10s %10s\n", clean_rates[r], bfsk_engines[e].name, bfsk_timings[t].name, packets);
+				if (result.packets != CLEAN_TELEGRAMS) {
+					fprintf(stderr, "Error: %s engine missed telegrams of a clean signal at %.0fHz\n", bfsk_engines[e].name, clean_rates[r]);
+					ok = false;
+				}
+			}
+		}
+
+		free(samples);
+		uicmod_free(m);
+	}
+
+	return ok;
+}
+
+/**
+ * Decodes a signal buffer by buffer, losing the one starting at a given
+ * sample.
+ *
+ * @returns number of detected events
+ */
+size_t decode_dropping(uicdemod_t * uic, const float * samples, size_t sample_count, size_t buffer_size, size_t dropped, struct uicdemod_event * events) {
+	size_t event_count = 0;
+	for (size_t pos = 0; pos < sample_count; pos += buffer_size) {
+		size_t count = sample_count - pos < buffer_size ? sample_count - pos : buffer_size;
+		if (pos == dropped) {
+			uicdemod_skip(uic, count);
+			continue;
+		}
+
+		size_t room = event_count < SKIP_EVENTS ? SKIP_EVENTS - event_count : 0;
+		event_count += uicdemod_analyze_block(uic, samples + pos, count, room ? events + event_count : NULL, room);
+	}
+
+	return event_count;
+}
+
+/**
+ * Checks that losing a buffer in the middle of a tone neither ends it nor
+ * reports it again, and that the telegram after it is still found at its
+ * sample. Tones and silences may move by up to a hop, as hops start over
+ * after the gap.
+ *
+ * @returns false if the events differ from those without the gap
+ */
+bool bench_skip(struct context * ctx) {
+	printf("\n%6s %6s %-10s %10s\n", "rate", "buf ms", "tone", "events");
+
+	bool ok = true;
+	for (size_t r = 0; r < sizeof(clean_rates) / sizeof(clean_rates[0]); r++) {
+		for (size_t t = 0; t < sizeof(skip_tones) / sizeof(skip_tones[0]); t++) {
+			uicmod_t * m = uicmod_init(clean_rates[r]);
+			float * samples = m ? malloc(uicmod_max_samples(m, 1.5) * sizeof(float)) : NULL;
+			if (samples == NULL) {
+				fprintf(stderr, "Error: could not build skip test signal\n");
+				uicmod_free(m);
+				return false;
+			}
+
+			float * out = samples;
+			out += uicmod_tone(m, skip_tones[t].tone, 0.6, out);
+			out += uicmod_tone(m, UICDEMOD_NONE, 0.3, out);
+			out += uicmod_bits(m, 0x5555, 16, out);
+			out += uicmod_telegram(m, 0x123456, 0x40, out);
+			out += uicmod_bits(m, 0x55, 8, out);
+			out += uicmod_tone(m, UICDEMOD_NONE, 0.3, out);
+			uicmod_free(m);
+
+			for (size_t b = 0; b < sizeof(buffer_millis) / sizeof(buffer_millis[0]); b++) {
+				size_t buffer_size = clean_rates[r] * buffer_millis[b] / 1000;
+				size_t dropped = (size_t) (clean_rates[r] * 0.3) / buffer_size * buffer_size;
+
+				struct uicdemod_event expected[SKIP_EVENTS];
+				struct uicdemod_event events[SKIP_EVENTS];
+				uicdemod_t * whole = uicdemod_init(clean_rates[r]);
+				uicdemod_t * gapped = uicdemod_init(clean_rates[r]);
+				if (whole == NULL || gapped == NULL) {
+					fprintf(stderr, "Error: could not initialize demodulators\n");
+					uicdemod_free(whole);
+					uicdemod_free(gapped);
+					free(samples);
+					return false;
+				}
+
+				size_t expected_count = decode_dropping(whole, samples, out - samples, buffer_size, SIZE_MAX, expected);
+				size_t event_count = decode_dropping(gapped, samples, out - samples, buffer_size, dropped, events);
+				uicdemod_free(whole);
+				uicdemod_free(gapped);
+
+				bool same = event_count == expected_count && event_count <= SKIP_EVENTS;
+				for (size_t e = 0; same && e < event_count; e++) {
+					same = events[e].status == expected[e].status;
+					if (same && events[e].status == UICDEMOD_PACKET) {
+						int64_t error = events[e].sample - expected[e].sample;
+						same = error >= -SKIP_SLACK && error <= SKIP_SLACK;
+					}
+				}
+
+				char counts[32];
+				snprintf(counts, sizeof(counts), "%zu/%zu", event_count, expected_count);
+				printf("%6.0f %6d %-10s %10s\n", clean_rates[r], buffer_millis[b], skip_tones[t].name, counts);
+				if (!same) {
+					fprintf(stderr, "Error: losing a buffer in a %s tone changed the events at %.0fHz\n", skip_tones[t].name, clean_rates[r]);
+					ok = false;
+				}
+			}
+
+			free(samples);
+		}
+	}
+
+	return ok;
+}
+
+bool write_signal(struct context * ctx) {
+	struct signal sig;
+	if (!build_signal(&sig, 16000, ctx->noise)) {
+		fprintf(stderr, "Error: could not build test signal\n");
+		return false;
+	}
+
+	FILE * f = fopen(ctx->write_path, "wb");
+	bool ok = f != NULL && fwrite(sig.samples, sizeof(float), sig.sample_count, f) == sig.sample_count;
+	if (f == NULL || fclose(f) != 0 || !ok) {
+		fprintf(stderr, "Error: could not write \"%s\"\n", ctx->write_path);
+		ok = false;
+	}
+
+	free(sig.samples_s16);
+	free(sig.samples);
+	return ok;
+}
+
+int main(int argc, char ** argv) {
+	struct context ctx = { 0 };
+
+	if (!parse_config(&ctx, argc, argv)) {
+		return 1;
+	}
+
+	if (ctx.write_path) {
+		return write_signal(&ctx) ? 0 : 3;
+	}
+
+	printf("%6s %6s %-10s %12s %10s\n", "rate", "buf ms", "stage", "Msamples/s", "ns/sample");
+
+	for (size_t i = 0; i < sizeof(sample_rates) / sizeof(sample_rates[0]); i++) {
+		if (!bench_rate(&ctx, sample_rates[i])) {
+			return 3;
+		}
+	}
+
+	if (!bench_telegram(&ctx)) {
+		return 3;
+	}
+
+	if (!bench_ber(&ctx)) {
+		return 3;
+	}
+
+	if (!bench_drift(&ctx)) {
+		return 3;
+	}
+
+	if (!bench_samplers(&ctx)) {
+		return 3;
+	}
+
+	if (!bench_clean(&ctx)) {
+		return 3;
+	}
+
+	if (!bench_skip(&ctx)) {
+		return 3;
+	}
+
+	return 0;
+}
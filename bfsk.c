@@ -1,10 +1,12 @@
 
-// Based on Cypress Semiconductor AN2336 ("PSoC®1 -Simplified FSK Detection")
+// Correlator based on Cypress Semiconductor AN2336 ("PSoC®1 -Simplified FSK Detection")
 
 #include "bfsk.h"
+#include "arena.h"
 #include <math.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 struct bfsk {
 	/**
@@ -80,48 +82,622 @@ struct bfsk {
 	 * Bits per sample.
 	 */
 	float bits_per_sample;
+
+	/**
+	 * Fixed-point bit clock for 16-bit input: fractional part of the bits
+	 * emitted since last change as a 0.32 fixed-point number, whether a whole
+	 * bit has been emitted since then, and bits per sample in 0.32 format.
+	 */
+	uint32_t clock_phase;
+	bool clock_whole_bit;
+	uint32_t clock_step;
+
+	/**
+	 * Timing recovery mode
+	 */
+	bfsk_timing_t timing;
+
+	/**
+	 * Phase-locked loop: correction to the phase step, integrated from the
+	 * phase errors seen at transitions, and its limit
+	 */
+	int32_t clock_correction;
+	int32_t clock_max_correction;
+
+	/**
+	 * Phase-locked loop: divider from the phase error at a transition to the
+	 * change in the phase step, setting the bandwidth of the loop
+	 */
+	int32_t clock_gain;
+
+	/**
+	 * Bit samplers run by the packed engine, and a mask with a bit set for
+	 * each of them. They all share the fixed-point clock above, and sample
+	 * bits at different phases of it.
+	 */
+	int sampler_count;
+	uint32_t sampler_mask;
+
+	/**
+	 * Phase at which each sampler samples a bit, the samplers in the order
+	 * their phases come in a bit, the position in that order of the next one
+	 * to sample and its phase, and masks with the samplers that have sampled
+	 * a whole bit since the last transition, and since their last invalid
+	 * symbol
+	 */
+	uint32_t sampler_phase[BFSK_MAX_SAMPLERS];
+	uint8_t sampler_order[BFSK_MAX_SAMPLERS];
+	int sampler_next;
+	uint32_t sampler_next_phase;
+	uint32_t sampler_whole_bits;
+	uint32_t sampler_fed_bits;
+
+	/**
+	 * Engine in use
+	 */
+	bfsk_engine_t engine;
+
+	/**
+	 * Packed engine: ring of sample signs, one bit per sample, set if the
+	 * sample was negative. Its size in words is a power of two so positions
+	 * can be wrapped with a mask.
+	 */
+	uint64_t * signs;
+
+	/**
+	 * Packed engine: mask for wrapping word indexes in sign ring
+	 */
+	size_t signs_mask;
+
+	/**
+	 * Packed engine: number of samples processed since reset
+	 */
+	uint64_t position;
+
+	/**
+	 * Quadrature engine: ring with the last mixer outputs, four per sample
+	 * for the I and Q of mark and space, and their sums over the ring. The
+	 * sums are the outputs of a boxcar filter about a bit long, see
+	 * bfsk_sizes.
+	 */
+	float * mixed;
+	size_t mixed_size;
+	size_t mixed_idx;
+	double mixed_sum[4];
+
+	/**
+	 * Quadrature engine: energy of both tones together below which neither
+	 * is considered heard
+	 */
+	double mixed_floor;
+
+	/**
+	 * Quadrature engine: local oscillators for mark and space, as complex
+	 * phasors rotated each sample, and the rotation itself
+	 */
+	double osc[4];
+	double osc_step[4];
+
+	/**
+	 * Quadrature engine: samples left before renormalizing the oscillators
+	 */
+	size_t osc_countdown;
+
+	/**
+	 * Set if allocated by bfsk_init, rather than in a caller's buffer
+	 */
+	bool allocated;
+};
+
+/**
+ * Lengths of the buffers of a demodulator, in elements
+ */
+struct bfsk_sizes {
+	size_t prev;
+	size_t corr;
+	size_t signs;
+	size_t mixed;
 };
 
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+// Energy ratio needed for the quadrature engine to change its decision.
+// Filter outputs wobble around the crossing point when the tone changes,
+// which would otherwise be taken as several very short bits.
+#define QUADRATURE_HYSTERESIS 1.5
+
+// Samples between oscillator renormalizations, so rounding errors don't build up
+#define OSC_RENORMALIZE 1024
+
+// Average amplitude below which the quadrature engine takes the input as
+// silence and stops clocking bits. Holding the last decision instead would
+// make up a run of ones after a telegram, which looks like a sync prefix.
+#define QUADRATURE_MIN_LEVEL 1e-4
+
+// Bit samplers are staggered by a bit divided by this
+#define SAMPLER_SPACING 12
+
+/**
+ * Finds the next bit sampler to sample after the given phase of the clock.
+ */
+static void samplers_seek(bfsk_t * d, uint32_t phase) {
+	d->sampler_next = 0;
+	while (d->sampler_next < d->sampler_count && d->sampler_phase[d->sampler_order[d->sampler_next]] <= phase) {
+		d->sampler_next++;
+	}
+	if (d->sampler_next == d->sampler_count) {
+		d->sampler_next = 0;
+	}
+	d->sampler_next_phase = d->sampler_phase[d->sampler_order[d->sampler_next]];
+}
+
+/**
+ * Resets the quadrature engine filters and oscillators.
+ */
+static void quadrature_reset(bfsk_t * d) {
+	memset(d->mixed, 0, sizeof(*d->mixed) * 4 * d->mixed_size);
+	memset(d->mixed_sum, 0, sizeof(d->mixed_sum));
+	d->mixed_idx = 0;
+
+	const float tones[2] = { d->params.mark_hz, d->params.space_hz };
+	for (int i = 0; i < 2; i++) {
+		double w = 2 * PI * tones[i] / d->sample_rate;
+		d->osc[2 * i] = 1;
+		d->osc[2 * i + 1] = 0;
+		d->osc_step[2 * i] = cos(w);
+		d->osc_step[2 * i + 1] = -sin(w);
+	}
+	d->osc_countdown = OSC_RENORMALIZE;
+}
+
+/**
+ * Derives the lengths of the delay line, filters and rings from the
+ * modulation parameters.
+ */
+static void bfsk_sizes(const struct bfsk_params * params, float sample_rate, struct bfsk_sizes * sizes) {
+	// Delay at which the center frequency is in quadrature, which puts mark
+	// and space at opposite signs. Of all the odd multiples of a quarter
+	// period of the center frequency, pick the one closest to half a period
+	// of the frequency shift, where mark and space are furthest apart. For
+	// 1300 and 1700Hz, that is seven quarters of 1500Hz. A sample short of
+	// it holds up best against noise, except where it is a whole number of
+	// samples, as at 12kHz, where falling a full sample short loses every bit.
+	float center_hz = (params->mark_hz + params->space_hz) / 2;
+	float shift_hz = fabs(params->mark_hz - params->space_hz);
+	long quarters = lround((2 * center_hz / shift_hz - 1) / 2) * 2 + 1;
+	if (quarters < 1) {
+		quarters = 1;
+	}
+	double delay = (double) sample_rate * quarters / (4 * center_hz);
+	sizes->prev = delay == floor(delay) ? delay : ceil(delay) - 1;
+	if (sizes->prev < 1) {
+		sizes->prev = 1;
+	}
+
+	// Initialize by default with a correlation buffer size of 6/8 of bit
+	// It's worked fine in my tests
+	sizes->corr = (sample_rate * 6) / (params->bps * 8);
+
+	// The sign ring must hold the current word plus a delay line and a
+	// correlator window of history, plus a word of slack for unaligned reads
+	sizes->signs = 1;
+	while (sizes->signs * 64 < sizes->prev + sizes->corr + 128) {
+		sizes->signs *= 2;
+	}
+
+	// Filter for the quadrature engine. It is matched to the bit length, but
+	// stretched to a whole number of cycles of the frequency shift, where mark
+	// and space are orthogonal and don't leak into each other. Going up to
+	// one and a half bits pays off, as 1300 and 1700Hz at 600bps show.
+	long shift_cycles = floor(1.5 * shift_hz / params->bps);
+	if (shift_cycles > 0) {
+		sizes->mixed = lround(sample_rate * shift_cycles / shift_hz);
+	} else {
+		sizes->mixed = lround(sample_rate / params->bps);
+	}
+	if (sizes->mixed < 1) {
+		sizes->mixed = 1;
+	}
+}
+
+size_t bfsk_sizeof(const struct bfsk_params * params, float sample_rate) {
+	struct bfsk_sizes sizes;
+	bfsk_sizes(params, sample_rate, &sizes);
+
+	struct arena a = { NULL, 0 };
+	arena_alloc(&a, sizeof(struct bfsk));
+	arena_alloc(&a, sizes.prev * sizeof(int_fast8_t));
+	arena_alloc(&a, sizes.corr * sizeof(int_fast8_t));
+	arena_alloc(&a, sizes.signs * sizeof(uint64_t));
+	arena_alloc(&a, sizes.mixed * 4 * sizeof(float));
+	return a.used;
+}
+
 bfsk_t * bfsk_init(const struct bfsk_params * params, float sample_rate) {
-	bfsk_t * d = malloc(sizeof(struct bfsk));
-	if (d == NULL) {
+	void * buffer = arena_malloc(bfsk_sizeof(params, sample_rate));
+	if (buffer == NULL) {
 		return NULL;
 	}
 
+	bfsk_t * d = bfsk_init_in(buffer, params, sample_rate);
+	d->allocated = true;
+	return d;
+}
+
+bfsk_t * bfsk_init_in(void * buffer, const struct bfsk_params * params, float sample_rate) {
+	struct bfsk_sizes sizes;
+	bfsk_sizes(params, sample_rate, &sizes);
+	memset(buffer, 0, bfsk_sizeof(params, sample_rate));
+
+	struct arena a = { buffer, 0 };
+	bfsk_t * d = arena_alloc(&a, sizeof(struct bfsk));
 	d->params = *params;
 	d->sample_rate = sample_rate;
 
-	// TODO: this is hardcoded for 1700 and 1300Hz - calculate it properly
-	float x = sample_rate * 350.0 / 300000.0;
-	d->prev_size = ceil(x) - 1;
+	d->prev_size = sizes.prev;
 	d->prev_idx = 0;
+	d->prev = arena_alloc(&a, sizes.prev * sizeof(int_fast8_t));
 
-	d->prev = calloc(sizeof(*d->prev), d->prev_size);
-	if (d == NULL) {
-		bfsk_free(d);
-		return NULL;
+	d->corr_size = sizes.corr;
+	d->corr_idx = 0;
+	d->corr_sum = 0;
+	d->invert_corr = d->params.mark_hz < d->params.space_hz;
+	d->corr = arena_alloc(&a, sizes.corr * sizeof(int_fast8_t));
+
+	d->signs_mask = sizes.signs - 1;
+	d->signs = arena_alloc(&a, sizes.signs * sizeof(uint64_t));
+
+	d->mixed_size = sizes.mixed;
+	d->mixed = arena_alloc(&a, sizes.mixed * 4 * sizeof(float));
+
+	// A tone of amplitude A adds up to A / 2 per sample in the filter
+	d->mixed_floor = pow(QUADRATURE_MIN_LEVEL * sizes.mixed / 2, 2);
+	quadrature_reset(d);
+
+	d->previous_bit = -1;
+	d->emitted_bits = 0;
+	d->bits_per_sample = d->params.bps / d->sample_rate;
+	d->clock_step = (uint32_t) ((double) d->params.bps / d->sample_rate * 4294967296.0);
+	d->clock_phase = 0;
+	d->clock_whole_bit = false;
+	d->engine = BFSK_ENGINE_PACKED;
+
+	// At each transition, change the rate by a 64th of the phase error per
+	// bit, which settles within a preamble without jumping around with the
+	// jitter of transitions. Follow clocks up to about 3% off.
+	d->timing = BFSK_TIMING_PLL;
+	d->clock_correction = 0;
+	d->clock_max_correction = d->clock_step / 32;
+	d->clock_gain = lround(64 * sample_rate / d->params.bps);
+	if (d->clock_gain < 1) {
+		d->clock_gain = 1;
 	}
 
-	// Initialize by default with a correlation buffer size of 6/8 of bit
-	// It's worked fine in my tests
-	d->corr_size = (sample_rate * 6) / (d->params.bps * 8);
+	bfsk_set_samplers(d, 1);
+
+	return d;
+}
+
+void bfsk_reset(bfsk_t * d) {
+	memset(d->prev, 0, sizeof(*d->prev) * d->prev_size);
+	memset(d->corr, 0, sizeof(*d->corr) * d->corr_size);
+	memset(d->signs, 0, sizeof(*d->signs) * (d->signs_mask + 1));
+	d->prev_idx = 0;
 	d->corr_idx = 0;
 	d->corr_sum = 0;
-	d->invert_corr = d->params.mark_hz < d->params.space_hz;
+	d->position = 0;
+	d->previous_bit = -1;
+	d->emitted_bits = 0;
+	d->clock_phase = 0;
+	d->clock_whole_bit = false;
+	d->clock_correction = 0;
+	d->sampler_whole_bits = 0;
+	d->sampler_fed_bits = d->sampler_mask;
+	quadrature_reset(d);
+}
 
-	d->corr = calloc(sizeof(*d->corr), d->corr_size);
-	if (d == NULL) {
-		bfsk_free(d);
-		return NULL;
+bool bfsk_set_engine(bfsk_t * d, bfsk_engine_t engine) {
+	if (engine != BFSK_ENGINE_CORRELATOR && engine != BFSK_ENGINE_PACKED && engine != BFSK_ENGINE_QUADRATURE) {
+		return false;
 	}
 
+	// Engines keep their history in different places, so start afresh
+	bfsk_reset(d);
+	d->engine = engine;
+
+	return true;
+}
+
+void bfsk_set_timing(bfsk_t * d, bfsk_timing_t timing) {
 	d->previous_bit = -1;
 	d->emitted_bits = 0;
+	d->clock_phase = 0;
+	d->clock_whole_bit = false;
+	d->clock_correction = 0;
+	d->timing = timing;
+	d->sampler_whole_bits = 0;
+	d->sampler_fed_bits = d->sampler_mask;
+}
 
-	return d;
+bool bfsk_set_samplers(bfsk_t * d, int count) {
+	if (count < 1 || count > BFSK_MAX_SAMPLERS) {
+		return false;
+	}
+
+	d->sampler_count = count;
+	d->sampler_mask = (1U << count) - 1;
+
+	// The first one where the phase wraps around, in the middle of the bit,
+	// and the rest alternately later and earlier
+	for (int k = 0; k < count; k++) {
+		int64_t offset = (k + 1) / 2 * (0x100000000LL / SAMPLER_SPACING);
+		if (k % 2 == 0) {
+			offset = -offset;
+		}
+		d->sampler_phase[k] = (uint32_t) offset;
+	}
+
+	// Insertion sort by phase, as there are just a few
+	for (int k = 0; k < count; k++) {
+		int i = k;
+		for (; i > 0 && d->sampler_phase[d->sampler_order[i - 1]] > d->sampler_phase[k]; i--) {
+			d->sampler_order[i] = d->sampler_order[i - 1];
+		}
+		d->sampler_order[i] = k;
+	}
+
+	d->previous_bit = -1;
+	d->clock_phase = 0;
+	d->clock_whole_bit = false;
+	d->clock_correction = 0;
+	d->sampler_whole_bits = 0;
+	d->sampler_fed_bits = d->sampler_mask;
+	samplers_seek(d, 0);
+	return true;
 }
 
-bfsk_result_t bfsk_analyze(bfsk_t * d, const float ** samples, size_t * sample_count) {
+float bfsk_clock_error(bfsk_t * d) {
+	if (d->timing != BFSK_TIMING_PLL) {
+		return 0;
+	}
+
+	return (float) d->clock_correction / d->clock_step;
+}
+
+/**
+ * Updates bit timing with the current correlator output, as a bit decision is
+ * made at the middle of each bit period. Takes the timing state by pointer so
+ * callers can keep it in locals.
+ */
+static inline bfsk_result_t bfsk_clock(int_fast8_t curr_bit, int_fast8_t * previous_bit, float * emitted_bits, float bits_per_sample) {
+	bfsk_result_t result = BFSK_END;
+
+	if (curr_bit == *previous_bit) {
+		// Cast to int to floor it
+		int_fast32_t old_int = (int_fast32_t) *emitted_bits;
+		*emitted_bits += bits_per_sample;
+		int_fast32_t cur_int = (int_fast32_t) *emitted_bits;
+
+		// If we have received a new full bit, feed it
+		if (old_int < cur_int) {
+			if (*previous_bit) {
+				//printf("1");
+				result = BFSK_ONE;
+			} else {
+				//printf("0");
+				result = BFSK_ZERO;
+			}
+		}
+	} else {
+		if (*emitted_bits < 1) {
+			result = BFSK_INVALID;
+		}
+
+		*previous_bit = curr_bit;
+
+		// Half bit to sample in the middle
+		*emitted_bits = 0.5;
+	}
+
+	return result;
+}
+
+/**
+ * Same as bfsk_clock, using integer arithmetic only. The bit period is
+ * tracked as a 32-bit phase, which wraps around once per bit.
+ */
+static inline bfsk_result_t bfsk_clock_fixed(int_fast8_t curr_bit, int_fast8_t * previous_bit, uint32_t * phase, bool * whole_bit, uint32_t step) {
+	bfsk_result_t result = BFSK_END;
+
+	if (curr_bit == *previous_bit) {
+		uint32_t old_phase = *phase;
+		*phase += step;
+
+		// If we have received a new full bit, feed it
+		if (*phase < old_phase) {
+			*whole_bit = true;
+			result = *previous_bit ? BFSK_ONE : BFSK_ZERO;
+		}
+	} else {
+		if (!*whole_bit) {
+			result = BFSK_INVALID;
+		}
+
+		*previous_bit = curr_bit;
+
+		// Half bit to sample in the middle
+		*phase = 0x80000000;
+		*whole_bit = false;
+	}
+
+	return result;
+}
+
+/**
+ * Phase-locked bit clock. The phase wraps around at the middle of each bit,
+ * so transitions are expected halfway through it. At each transition, half
+ * of the phase error is corrected right away and a fraction is integrated
+ * into the phase step, which ends up tracking the clock of the transmitter.
+ *
+ * Transitions coming before a whole bit are still invalid, and restart the
+ * clock like bfsk_clock_fixed, dropping the rate estimate along with them.
+ */
+static inline bfsk_result_t bfsk_clock_pll(bfsk_t * d, int_fast8_t curr_bit, int_fast8_t * previous_bit, uint32_t * phase, bool * whole_bit) {
+	bfsk_result_t result = BFSK_END;
+
+	// Unlike the other clocks, the phase keeps running on transitions
+	uint32_t old_phase = *phase;
+	*phase += d->clock_step + d->clock_correction;
+
+	if (curr_bit == *previous_bit) {
+		// If we have received a new full bit, feed it
+		if (*phase < old_phase) {
+			*whole_bit = true;
+			result = *previous_bit ? BFSK_ONE : BFSK_ZERO;
+		}
+	} else {
+		if (*whole_bit) {
+			// Positive if the transition came late for our clock, which is then running fast
+			int32_t error = (int32_t) (*phase - 0x80000000);
+			*phase -= error / 2;
+
+			int32_t correction = d->clock_correction - error / d->clock_gain;
+			if (correction > d->clock_max_correction) {
+				correction = d->clock_max_correction;
+			} else if (correction < -d->clock_max_correction) {
+				correction = -d->clock_max_correction;
+			}
+			d->clock_correction = correction;
+		} else {
+			result = BFSK_INVALID;
+			*phase = 0x80000000;
+			d->clock_correction = 0;
+		}
+
+		*previous_bit = curr_bit;
+		*whole_bit = false;
+	}
+
+	return result;
+}
+
+/**
+ * Runs the bit clock for the selected timing recovery mode. 16-bit input is
+ * always clocked with integers only.
+ */
+static inline bfsk_result_t bfsk_clock_select(bfsk_t * d, bool s16, int_fast8_t curr_bit, int_fast8_t * previous_bit, float * emitted_bits, uint32_t * phase, bool * whole_bit) {
+	if (d->timing == BFSK_TIMING_PLL) {
+		return bfsk_clock_pll(d, curr_bit, previous_bit, phase, whole_bit);
+	} else if (s16) {
+		return bfsk_clock_fixed(curr_bit, previous_bit, phase, whole_bit, d->clock_step);
+	}
+
+	return bfsk_clock(curr_bit, previous_bit, emitted_bits, d->bits_per_sample);
+}
+
+/**
+ * Stores the symbols of the bit samplers whose phase the bit clock has just
+ * gone past, in the order they sample.
+ *
+ * @returns number of symbols stored
+ */
+static size_t bfsk_sample_bits(bfsk_t * d, int_fast8_t bit, uint32_t old_phase, uint32_t phase, struct bfsk_symbol * symbols, size_t offset) {
+	bfsk_result_t result = bit ? BFSK_ONE : BFSK_ZERO;
+	uint32_t step = phase - old_phase;
+	size_t found = 0;
+
+	do {
+		int k = d->sampler_order[d->sampler_next];
+		symbols[found].result = result;
+		symbols[found].offset = offset;
+		symbols[found].sampler = k;
+		found++;
+
+		d->sampler_whole_bits |= 1U << k;
+		d->sampler_fed_bits |= 1U << k;
+		if (++d->sampler_next == d->sampler_count) {
+			d->sampler_next = 0;
+		}
+		d->sampler_next_phase = d->sampler_phase[d->sampler_order[d->sampler_next]];
+	} while (found < (size_t) d->sampler_count && (uint32_t) (d->sampler_next_phase - old_phase - 1) < step);
+
+	return found;
+}
+
+/**
+ * Runs the bit clock over a transition like bfsk_clock_fixed or
+ * bfsk_clock_pll, and stores an invalid symbol for each bit sampler that had
+ * not sampled a whole bit since the last one. Those that have not sampled any
+ * bit since their last invalid symbol are skipped, as noise would otherwise
+ * give one to every sampler at every transition.
+ *
+ * @returns number of symbols stored
+ */
+static size_t bfsk_samplers_transition(bfsk_t * d, int_fast8_t curr_bit, int_fast8_t * previous_bit, uint32_t * phase, struct bfsk_symbol * symbols, size_t offset) {
+	bool pll = d->timing == BFSK_TIMING_PLL;
+
+	if (pll && (d->sampler_whole_bits & 1)) {
+		*phase += d->clock_step + d->clock_correction;
+
+		// Positive if the transition came late for our clock, which is then running fast
+		int32_t error = (int32_t) (*phase - 0x80000000);
+		*phase -= error / 2;
+
+		int32_t correction = d->clock_correction - error / d->clock_gain;
+		if (correction > d->clock_max_correction) {
+			correction = d->clock_max_correction;
+		} else if (correction < -d->clock_max_correction) {
+			correction = -d->clock_max_correction;
+		}
+		d->clock_correction = correction;
+	} else {
+		*phase = 0x80000000;
+		d->clock_correction = 0;
+	}
+
+	size_t found = 0;
+	uint32_t invalid = ~d->sampler_whole_bits & d->sampler_fed_bits;
+	d->sampler_fed_bits &= ~invalid;
+	for (int k = 0; invalid; k++, invalid >>= 1) {
+		if (invalid & 1) {
+			symbols[found].result = BFSK_INVALID;
+			symbols[found].offset = offset;
+			symbols[found].sampler = k;
+			found++;
+		}
+	}
+
+	d->sampler_whole_bits = 0;
+	*previous_bit = curr_bit;
+	samplers_seek(d, *phase);
+	return found;
+}
+
+/**
+ * Runs the bit clock like bfsk_clock_fixed or bfsk_clock_pll, for several bit
+ * samplers sampling at different phases of it. They are handled all at once,
+ * as masks and a single comparison with the phase of the next one to sample,
+ * so most samples cost the same no matter how many there are.
+ *
+ * @returns number of symbols stored, at most one per sampler
+ */
+static inline size_t bfsk_clock_samplers(bfsk_t * d, int_fast8_t curr_bit, int_fast8_t * previous_bit, uint32_t * phase, struct bfsk_symbol * symbols, size_t offset) {
+	if (curr_bit != *previous_bit) {
+		return bfsk_samplers_transition(d, curr_bit, previous_bit, phase, symbols, offset);
+	}
+
+	// The correction stays at zero without the phase-locked loop
+	uint32_t old_phase = *phase;
+	*phase += d->clock_step + d->clock_correction;
+	if ((uint32_t) (d->sampler_next_phase - old_phase - 1) >= *phase - old_phase) {
+		return 0;
+	}
+
+	return bfsk_sample_bits(d, curr_bit, old_phase, *phase, symbols, offset);
+}
+
+static bfsk_result_t bfsk_analyze_correlator(bfsk_t * d, const float ** samples, size_t * sample_count) {
 	bfsk_result_t result = BFSK_END;
 
 	while (*sample_count > 0 && result == BFSK_END) {
@@ -146,32 +722,7 @@ bfsk_result_t bfsk_analyze(bfsk_t * d, const float ** samples, size_t * sample_c
 
 		// Invert if required
 		int_fast8_t curr_bit = (d->corr_sum >= 0) ^ d->invert_corr;
-		if (curr_bit == d->previous_bit) {
-			// Cast to int to floor it
-			int_fast32_t old_int = (int_fast32_t) d->emitted_bits;
-			d->emitted_bits += d->params.bps / d->sample_rate;
-			int_fast32_t cur_int = (int_fast32_t) d->emitted_bits;
-
-			// If we have received a new full bit, feed it
-			if (old_int < cur_int) {
-				if (d->previous_bit) {
-					//printf("1");
-					result = BFSK_ONE;
-				} else {
-					//printf("0");
-					result = BFSK_ZERO;
-				}
-			}
-		} else {
-			if (d->emitted_bits < 1) {
-				result = BFSK_INVALID;
-			}
-
-			d->previous_bit = curr_bit;
-
-			// Half bit to sample in the middle
-			d->emitted_bits = 0.5;
-		}
+		result = bfsk_clock_select(d, false, curr_bit, &d->previous_bit, &d->emitted_bits, &d->clock_phase, &d->clock_whole_bit);
 
 		// Save this sample
 		d->prev[d->prev_idx] = sample_sign;
@@ -184,11 +735,347 @@ bfsk_result_t bfsk_analyze(bfsk_t * d, const float ** samples, size_t * sample_c
 	return result;
 }
 
+static bfsk_result_t bfsk_analyze_quadrature(bfsk_t * d, const float ** samples, size_t * sample_count) {
+	bfsk_result_t result = BFSK_END;
+
+	while (*sample_count > 0 && result == BFSK_END) {
+		float sample = **samples;
+		float * mixed = d->mixed + 4 * d->mixed_idx;
+
+		// Mix down with mark and space, and slide the matched filters
+		for (int i = 0; i < 4; i += 2) {
+			float in_phase = sample * d->osc[i];
+			float quadrature = sample * d->osc[i + 1];
+			d->mixed_sum[i] += in_phase - mixed[i];
+			d->mixed_sum[i + 1] += quadrature - mixed[i + 1];
+			mixed[i] = in_phase;
+			mixed[i + 1] = quadrature;
+
+			// Rotate the oscillator for the next sample
+			double re = d->osc[i], im = d->osc[i + 1];
+			d->osc[i] = re * d->osc_step[i] - im * d->osc_step[i + 1];
+			d->osc[i + 1] = re * d->osc_step[i + 1] + im * d->osc_step[i];
+		}
+		d->mixed_idx = (d->mixed_idx + 1) % d->mixed_size;
+
+		if (--d->osc_countdown == 0) {
+			for (int i = 0; i < 4; i += 2) {
+				double norm = sqrt(d->osc[i] * d->osc[i] + d->osc[i + 1] * d->osc[i + 1]);
+				d->osc[i] /= norm;
+				d->osc[i + 1] /= norm;
+			}
+			d->osc_countdown = OSC_RENORMALIZE;
+		}
+
+		// Compare the energy of both tones
+		double mark = d->mixed_sum[0] * d->mixed_sum[0] + d->mixed_sum[1] * d->mixed_sum[1];
+		double space = d->mixed_sum[2] * d->mixed_sum[2] + d->mixed_sum[3] * d->mixed_sum[3];
+		int_fast8_t curr_bit = d->previous_bit;
+		if (mark > space * QUADRATURE_HYSTERESIS) {
+			curr_bit = 1;
+		} else if (space > mark * QUADRATURE_HYSTERESIS) {
+			curr_bit = 0;
+		}
+
+		// Nothing to clock until either tone has been heard, nor in silence
+		if (curr_bit >= 0 && mark + space >= d->mixed_floor) {
+			result = bfsk_clock_select(d, false, curr_bit, &d->previous_bit, &d->emitted_bits, &d->clock_phase, &d->clock_whole_bit);
+		}
+
+		(*samples)++;
+		(*sample_count)--;
+	}
+
+	return result;
+}
+
+#if defined(__GNUC__)
+#	define popcount64(x) __builtin_popcountll(x)
+#	define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#	define ALWAYS_INLINE inline
+static inline int popcount64(uint64_t x) {
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (x * 0x0101010101010101ULL) >> 56;
+}
+#endif
+
+/**
+ * Reads 64 sign bits from the ring, starting at the given sample position.
+ * Bit 0 of the result is the sign of sample {@code pos}.
+ */
+static inline uint64_t signs_at(const bfsk_t * d, uint64_t pos) {
+	size_t word = (pos >> 6) & d->signs_mask;
+	unsigned int shift = pos & 63;
+
+	uint64_t bits = d->signs[word] >> shift;
+	if (shift) {
+		bits |= d->signs[(word + 1) & d->signs_mask] << (64 - shift);
+	}
+	return bits;
+}
+
+/**
+ * Returns a mask with the bits set for positions {@code base + i} that are
+ * at or after {@code first}.
+ */
+static inline uint64_t mask_from(uint64_t base, uint64_t first) {
+	if (base >= first) {
+		return ~0ULL;
+	} else if (first - base >= 64) {
+		return 0;
+	}
+	return ~0ULL << (first - base);
+}
+
+/**
+ * Correlator outputs for the 64 positions starting at {@code base}, as two
+ * masks: positions where the sample and the delayed sample had the same sign
+ * (+1), and positions where they differ (-1). Positions before the delay line
+ * has been filled are in neither, like the zeroed buffers of the reference
+ * engine.
+ */
+static inline void products_at(const bfsk_t * d, uint64_t base, uint64_t * same, uint64_t * diff) {
+	uint64_t valid = mask_from(base, d->prev_size);
+	uint64_t x = signs_at(d, base) ^ signs_at(d, base - d->prev_size);
+	*same = ~x & valid;
+	*diff = x & valid;
+}
+
+// Samples per run checked for a possible change in correlator decision
+#define RUN_LENGTH 16
+
+/**
+ * Block engine. Sample signs are packed 64 to a word, and the delay line
+ * product is computed for a whole word at once by XORing it with the word
+ * from {@code prev_size} samples ago. The windowed correlator sum is then
+ * slid along the word bit by bit, without ring buffers or modulo operations.
+ *
+ * Takes either float or 16-bit samples, or their signs already packed by the
+ * caller in {@code packed} from bit {@code first} on. 16-bit samples are clocked in fixed point so that
+ * path never touches the FPU. Always inlined, so each caller gets its own copy
+ * with the type checks folded away.
+ */
+static ALWAYS_INLINE size_t bfsk_analyze_packed(bfsk_t * d, const void * samples, const uint64_t * packed, size_t first, bool s16, size_t * consumed_count, size_t sample_count, struct bfsk_symbol * symbols, size_t max_symbols) {
+	size_t found = 0;
+	size_t consumed = 0;
+	int_fast32_t corr_sum = d->corr_sum;
+	int_fast8_t previous_bit = d->previous_bit;
+	float emitted_bits = d->emitted_bits;
+	uint32_t clock_phase = d->clock_phase;
+	bool clock_whole_bit = d->clock_whole_bit;
+
+	// Each sample may give a symbol per sampler, so leave room for all of them
+	bool samplers = d->sampler_count > 1;
+	size_t limit = max_symbols;
+	if (samplers) {
+		limit = max_symbols >= (size_t) d->sampler_count ? max_symbols - (d->sampler_count - 1) : 0;
+	}
+
+	while (consumed < sample_count && found < limit) {
+		uint64_t pos = d->position;
+		unsigned int offset = pos & 63;
+		uint64_t base = pos - offset;
+
+		size_t count = 64 - offset;
+		if (count > sample_count - consumed) {
+			count = sample_count - consumed;
+		}
+
+		// Pack signs into the current word, keeping the earlier samples
+		size_t word = (pos >> 6) & d->signs_mask;
+		uint64_t signs = offset ? d->signs[word] & ((1ULL << offset) - 1) : 0;
+		if (packed) {
+			const uint64_t * in = packed + (first + consumed) / 64;
+			unsigned int shift = (first + consumed) & 63;
+
+			uint64_t bits = in[0] >> shift;
+			if (shift && shift + count > 64) {
+				bits |= in[1] << (64 - shift);
+			}
+			if (count < 64) {
+				bits &= (1ULL << count) - 1;
+			}
+			signs |= bits << offset;
+		} else if (s16) {
+			const int16_t * in = (const int16_t *) samples + consumed;
+			for (size_t i = 0; i < count; i++) {
+				signs |= (uint64_t) (in[i] < 0) << (offset + i);
+			}
+		} else {
+			const float * in = (const float *) samples + consumed;
+			for (size_t i = 0; i < count; i++) {
+				signs |= (uint64_t) !(in[i] >= 0) << (offset + i);
+			}
+		}
+		d->signs[word] = signs;
+
+		// Outputs entering and leaving the correlator window
+		uint64_t new_same, new_diff, old_same, old_diff;
+		products_at(d, base, &new_same, &new_diff);
+		products_at(d, base - d->corr_size, &old_same, &old_diff);
+		if (base < d->corr_size) {
+			uint64_t valid = mask_from(base, d->corr_size + d->prev_size);
+			old_same &= valid;
+			old_diff &= valid;
+		}
+
+		size_t i = 0;
+		while (i < count && found < limit) {
+			unsigned int bit = offset + i;
+			size_t run = count - i < RUN_LENGTH ? count - i : RUN_LENGTH;
+			size_t end = i + run;
+
+			if (corr_sum >= (int_fast32_t) (2 * run) || corr_sum < -(int_fast32_t) (2 * run)) {
+				/*
+				 * Each sample moves the sum by two at most, so the decision
+				 * cannot flip during this run. Clock the bits without
+				 * touching the correlator and catch up with popcounts.
+				 */
+				int_fast8_t curr_bit = (corr_sum >= 0) ^ d->invert_corr;
+
+				for (; i < end && found < limit; i++) {
+					if (samplers) {
+						found += bfsk_clock_samplers(d, curr_bit, &previous_bit, &clock_phase, symbols + found, consumed + i);
+						continue;
+					}
+
+					bfsk_result_t result = bfsk_clock_select(d, s16, curr_bit, &previous_bit, &emitted_bits, &clock_phase, &clock_whole_bit);
+					if (result != BFSK_END) {
+						symbols[found].result = result;
+						symbols[found].offset = consumed + i;
+						symbols[found].sampler = 0;
+						found++;
+					}
+				}
+
+				uint64_t span = ((1ULL << (i + offset - bit)) - 1) << bit;
+				corr_sum += popcount64(new_same & span) - popcount64(new_diff & span)
+						- popcount64(old_same & span) + popcount64(old_diff & span);
+			} else {
+				for (; i < end && found < limit; i++) {
+					bit = offset + i;
+					corr_sum += (int_fast32_t) ((new_same >> bit) & 1) - ((new_diff >> bit) & 1)
+							- ((old_same >> bit) & 1) + ((old_diff >> bit) & 1);
+
+					// Invert if required
+					int_fast8_t curr_bit = (corr_sum >= 0) ^ d->invert_corr;
+					if (samplers) {
+						found += bfsk_clock_samplers(d, curr_bit, &previous_bit, &clock_phase, symbols + found, consumed + i);
+						continue;
+					}
+
+					bfsk_result_t result = bfsk_clock_select(d, s16, curr_bit, &previous_bit, &emitted_bits, &clock_phase, &clock_whole_bit);
+					if (result != BFSK_END) {
+						symbols[found].result = result;
+						symbols[found].offset = consumed + i;
+						symbols[found].sampler = 0;
+						found++;
+					}
+				}
+			}
+		}
+
+		d->position += i;
+		consumed += i;
+	}
+
+	d->previous_bit = previous_bit;
+	d->emitted_bits = emitted_bits;
+	d->clock_phase = clock_phase;
+	d->clock_whole_bit = clock_whole_bit;
+	d->corr_sum = corr_sum;
+
+	*consumed_count = consumed;
+	return found;
+}
+
+static size_t bfsk_analyze_packed_float(bfsk_t * d, const float ** samples, size_t * sample_count, struct bfsk_symbol * symbols, size_t max_symbols) {
+	size_t consumed;
+	size_t found = bfsk_analyze_packed(d, *samples, NULL, 0, false, &consumed, *sample_count, symbols, max_symbols);
+
+	*samples += consumed;
+	*sample_count -= consumed;
+	return found;
+}
+
+bfsk_result_t bfsk_analyze(bfsk_t * d, const float ** samples, size_t * sample_count) {
+	if (d->engine == BFSK_ENGINE_CORRELATOR) {
+		return bfsk_analyze_correlator(d, samples, sample_count);
+	} else if (d->engine == BFSK_ENGINE_QUADRATURE) {
+		return bfsk_analyze_quadrature(d, samples, sample_count);
+	}
+
+	// Only the symbols of the first sampler are returned, so take all of
+	// them until one comes from it
+	struct bfsk_symbol symbols[BFSK_MAX_SAMPLERS];
+	while (*sample_count > 0) {
+		size_t found = bfsk_analyze_packed_float(d, samples, sample_count, symbols, d->sampler_count);
+		for (size_t i = 0; i < found; i++) {
+			if (symbols[i].sampler == 0) {
+				return symbols[i].result;
+			}
+		}
+	}
+
+	return BFSK_END;
+}
+
+size_t bfsk_analyze_block(bfsk_t * d, const float ** samples, size_t * sample_count, struct bfsk_symbol * symbols, size_t max_symbols) {
+	if (d->engine == BFSK_ENGINE_PACKED) {
+		return bfsk_analyze_packed_float(d, samples, sample_count, symbols, max_symbols);
+	}
+
+	bfsk_result_t (*analyze)(bfsk_t *, const float **, size_t *) = d->engine == BFSK_ENGINE_QUADRATURE
+			? bfsk_analyze_quadrature
+			: bfsk_analyze_correlator;
+
+	size_t found = 0;
+	size_t initial_count = *sample_count;
+	while (*sample_count > 0 && found < max_symbols) {
+		bfsk_result_t result = analyze(d, samples, sample_count);
+		if (result != BFSK_END) {
+			symbols[found].result = result;
+			symbols[found].offset = initial_count - *sample_count - 1;
+			symbols[found].sampler = 0;
+			found++;
+		}
+	}
+
+	return found;
+}
+
+size_t bfsk_analyze_block_s16(bfsk_t * d, const int16_t ** samples, size_t * sample_count, struct bfsk_symbol * symbols, size_t max_symbols) {
+	size_t consumed;
+	size_t found = bfsk_analyze_packed(d, *samples, NULL, 0, true, &consumed, *sample_count, symbols, max_symbols);
+
+	*samples += consumed;
+	*sample_count -= consumed;
+	return found;
+}
+
+size_t bfsk_analyze_signs(bfsk_t * d, const uint64_t * signs, size_t * first, size_t sample_count, struct bfsk_symbol * symbols, size_t max_symbols) {
+	size_t consumed;
+	size_t found = bfsk_analyze_packed(d, NULL, signs, *first, false, &consumed, sample_count - *first, symbols, max_symbols);
+	*first += consumed;
+	return found;
+}
+
+size_t bfsk_analyze_signs_s16(bfsk_t * d, const uint64_t * signs, size_t * first, size_t sample_count, struct bfsk_symbol * symbols, size_t max_symbols) {
+	size_t consumed;
+	size_t found = bfsk_analyze_packed(d, NULL, signs, *first, true, &consumed, sample_count - *first, symbols, max_symbols);
+	*first += consumed;
+	return found;
+}
+
 void bfsk_free(bfsk_t * d) {
 	if (d == NULL) {
 		return;
 	}
 
-	free(d->prev);
-	free(d);
+	if (d->allocated) {
+		free(d);
+	}
 }
@@ -1,9 +1,14 @@
 
 #pragma once
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef struct bfsk bfsk_t;
 
+// Most bit samplers a demodulator can run at once, see bfsk_set_samplers
+#define BFSK_MAX_SAMPLERS 8
+
 struct bfsk_params {
 	float bps;
 	float space_hz;
@@ -18,7 +23,66 @@ typedef enum {
 } bfsk_result_t;
 
 /**
- * Initializes a new correlator-based BFSK demodulator.
+ * Demodulator output for a single sample
+ */
+struct bfsk_symbol {
+	/**
+	 * Demodulated bit or invalid transition. Never BFSK_END.
+	 */
+	bfsk_result_t result;
+
+	/**
+	 * Position of the sample that produced it, counting from the first
+	 * sample passed in.
+	 */
+	size_t offset;
+
+	/**
+	 * Bit sampler that produced it, see bfsk_set_samplers. Zero with a single
+	 * sampler.
+	 */
+	int sampler;
+};
+
+typedef enum {
+	/**
+	 * Reference correlator, processing one sample at a time
+	 */
+	BFSK_ENGINE_CORRELATOR,
+
+	/**
+	 * Same correlator working on signs packed in 64-bit words. Its output is
+	 * bit for bit identical to the reference one.
+	 */
+	BFSK_ENGINE_PACKED,
+
+	/**
+	 * Non-coherent quadrature demodulator. Mixes samples down with I/Q
+	 * oscillators at the mark and space frequencies, and compares the energy
+	 * of each tone after a filter matched to the bit length. Costlier than
+	 * the correlator, but keeps the amplitude of samples, so it holds up much
+	 * better against noise.
+	 */
+	BFSK_ENGINE_QUADRATURE
+} bfsk_engine_t;
+
+typedef enum {
+	/**
+	 * Bit clock restarted half a bit away at every transition, as in AN2336
+	 */
+	BFSK_TIMING_RESET,
+
+	/**
+	 * Bit clock kept by a phase-locked loop. Transitions nudge its phase and
+	 * rate instead of restarting it, so it tracks a transmitter whose clock
+	 * is off from ours, and rides out a misplaced transition. Integer only.
+	 */
+	BFSK_TIMING_PLL
+} bfsk_timing_t;
+
+/**
+ * Initializes a new BFSK demodulator. Delay and filter lengths of every
+ * engine are derived from the modulation parameters.
  *
  * @param params BFSK modulation params
  * @param sample_rate Input sample rate
@@ -26,6 +90,88 @@ typedef enum {
  */
 bfsk_t * bfsk_init(const struct bfsk_params * params, float sample_rate);
 
+/**
+ * Returns the size of the buffer needed by {@code bfsk_init_in}.
+ *
+ * @param params BFSK modulation params
+ * @param sample_rate Input sample rate
+ * @returns size in bytes
+ */
+size_t bfsk_sizeof(const struct bfsk_params * params, float sample_rate);
+
+/**
+ * Initializes a BFSK demodulator like {@code bfsk_init}, laying it out with
+ * all of its buffers in one provided by the caller instead of allocating
+ * them. The buffer must be aligned to 64 bytes, and freed by the caller after
+ * {@code bfsk_free}.
+ *
+ * @param buffer Buffer, at least {@code bfsk_sizeof} bytes long
+ * @param params BFSK modulation params
+ * @param sample_rate Input sample rate
+ * @returns Demodulator, at the start of the buffer
+ */
+bfsk_t * bfsk_init_in(void * buffer, const struct bfsk_params * params, float sample_rate);
+
+/**
+ * Forgets the samples seen so far and restarts bit timing, as if the signal
+ * started anew with the next sample.
+ *
+ * @param d Demodulator object
+ */
+void bfsk_reset(bfsk_t * d);
+
+/**
+ * Selects the demodulator engine, resetting its state. The packed engine is
+ * used by default.
+ *
+ * @param d Demodulator object
+ * @param engine Engine
+ * @returns true on success, false if the engine is not supported
+ */
+bool bfsk_set_engine(bfsk_t * d, bfsk_engine_t engine);
+
+/**
+ * Selects how the bit clock is recovered, resetting it. The phase-locked
+ * loop is used by default.
+ *
+ * @param d Demodulator object
+ * @param timing Timing recovery mode
+ */
+void bfsk_set_timing(bfsk_t * d, bfsk_timing_t timing);
+
+/**
+ * Sets how many bit samplers run over the output of the correlator, resetting
+ * the bit clock. They all follow the same clock, but sample bits at different
+ * points: the first one in the middle of each bit as usual, and the rest
+ * staggered to either side of it. A transition misplaced by noise then throws
+ * off only some of them, so one of the others may still get the whole
+ * telegram right.
+ *
+ * Only the packed engine runs more than one, which it does at little extra
+ * cost, as they share the correlator and the clock. They are always clocked
+ * in fixed point. The block functions return the symbols
+ * of all samplers, tagged with the sampler that produced them, and need room
+ * for at least one symbol per sampler. {@code bfsk_analyze} only returns
+ * those of the first one.
+ *
+ * @param d Demodulator object
+ * @param count Number of samplers, from 1 (default) to BFSK_MAX_SAMPLERS
+ * @returns true on success, false if out of range
+ */
+bool bfsk_set_samplers(bfsk_t * d, int count);
+
+/**
+ * Returns the clock error estimated by the phase-locked loop, as the relative
+ * difference between the received and the nominal bit rate. Positive if the
+ * transmitter runs faster than our sample clock says it should. The estimate
+ * starts from zero after each invalid transition, so it is only meaningful
+ * during a transmission.
+ *
+ * @param d Demodulator object
+ * @returns relative clock error, or zero if not using the phase-locked loop
+ */
+float bfsk_clock_error(bfsk_t * d);
+
 /**
  * Analizes the input samples and returns the result. Updates sample and
  * sample count.
@@ -37,6 +183,69 @@ bfsk_t * bfsk_init(const struct bfsk_params * params, float sample_rate);
  */
 bfsk_result_t bfsk_analyze(bfsk_t * d, const float ** samples, size_t * sample_count);
 
+/**
+ * Analizes the input samples in one go, storing all the results until the
+ * samples run out or the symbol array is full. Updates sample and sample
+ * count.
+ *
+ * @param d Demodulator object
+ * @param samples Pointer to input samples
+ * @param sample_count Pointer to number of samples
+ * @param symbols Output symbols
+ * @param max_symbols Size of symbol array
+ * @returns number of symbols stored
+ */
+size_t bfsk_analyze_block(bfsk_t * d, const float ** samples, size_t * sample_count, struct bfsk_symbol * symbols, size_t max_symbols);
+
+/**
+ * Same as bfsk_analyze_block, for signed 16-bit samples. Only integer
+ * arithmetic is used, so it runs fast without an FPU. Always uses the packed
+ * engine regardless of the selected one, and should not be mixed with float
+ * calls on the same object.
+ *
+ * @param d Demodulator object
+ * @param samples Pointer to input samples
+ * @param sample_count Pointer to number of samples
+ * @param symbols Output symbols
+ * @param max_symbols Size of symbol array
+ * @returns number of symbols stored
+ */
+size_t bfsk_analyze_block_s16(bfsk_t * d, const int16_t ** samples, size_t * sample_count, struct bfsk_symbol * symbols, size_t max_symbols);
+
+/**
+ * Same as bfsk_analyze_block, taking the signs of the samples already packed,
+ * as produced by goertzel_scan, so the samples themselves need not be read
+ * again. Only for the packed engine. Symbol offsets are counted from
+ * {@code first}.
+ *
+ * @param d Demodulator object
+ * @param signs Sign of each sample, set if negative, from bit 0 of the first
+ *   word on
+ * @param first Pointer to the index of the first sample to analyze, advanced
+ *   past the analyzed ones
+ * @param sample_count Number of samples in signs
+ * @param symbols Output symbols
+ * @param max_symbols Size of symbol array
+ * @returns number of symbols stored
+ */
+size_t bfsk_analyze_signs(bfsk_t * d, const uint64_t * signs, size_t * first, size_t sample_count, struct bfsk_symbol * symbols, size_t max_symbols);
+
+/**
+ * Same as bfsk_analyze_signs, for the signs of 16-bit samples, clocked in
+ * fixed point like bfsk_analyze_block_s16.
+ *
+ * @param d Demodulator object
+ * @param signs Sign of each sample, set if negative, from bit 0 of the first
+ *   word on
+ * @param first Pointer to the index of the first sample to analyze, advanced
+ *   past the analyzed ones
+ * @param sample_count Number of samples in signs
+ * @param symbols Output symbols
+ * @param max_symbols Size of symbol array
+ * @returns number of symbols stored
+ */
+size_t bfsk_analyze_signs_s16(bfsk_t * d, const uint64_t * signs, size_t * first, size_t sample_count, struct bfsk_symbol * symbols, size_t max_symbols);
+
 /**
  * Sets window size for correlator output.
  *
@@ -49,7 +258,8 @@ bfsk_result_t bfsk_analyze(bfsk_t * d, const float ** samples, size_t * sample_c
 void bfsk_set_window_size(bfsk_t * d, size_t win_size);
 
 /**
- * Destroys a demodulator object. Accepts NULL.
+ * Destroys a demodulator object. Accepts NULL, and demodulators in a caller's
+ * buffer, which is not freed.
  *
  * @param d Demodulator object
  */
@@ -0,0 +1,227 @@
+#include "channelizer.h"
+#include "fft.h"
+#include <math.h>
+
+struct channelizer {
+	size_t channel_count;
+
+	/**
+	 * Input samples per output sample, half the channel count, and input
+	 * samples left before the next output
+	 */
+	size_t decimation;
+	size_t skip;
+
+	/**
+	 * Index of the last input sample, modulo the channel count, which sets
+	 * the phase of the channels at each output
+	 */
+	size_t time;
+
+	/**
+	 * Prototype lowpass filter taps, a whole number of taps per channel, in
+	 * the same order as the history windows (oldest sample first)
+	 */
+	float * taps;
+	size_t tap_count;
+
+	/**
+	 * Last input samples, I and Q apart, each stored twice back to back so
+	 * the window starting at history_idx is always contiguous
+	 */
+	float * history_i;
+	float * history_q;
+	size_t history_idx;
+
+	/**
+	 * Window times the filter, folded onto one sample per channel, and its
+	 * transform, as interleaved real and imaginary parts
+	 */
+	float * folded_i;
+	float * folded_q;
+	float * fft_input;
+	float * fft_output;
+	fft_t * fft;
+};
+
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+// Normalized transition width of a Blackman window, times filter length
+#define BLACKMAN_WIDTH 5.5
+
+// Channels filtered at once with independent partial sums
+#define ACCUMULATORS 8
+
+// Transition band of the prototype filter, in channel spacings from the center
+// of a channel. Stops at the center of the next channel, while the rest of it
+// is left for the FM demodulator to filter out.
+#define PASSBAND_EDGE 0.5
+#define STOPBAND_EDGE 1.0
+
+channelizer_t * channelizer_init(int channel_count) {
+	if (channel_count < 2 || channel_count % 2 != 0) {
+		return NULL;
+	}
+
+	channelizer_t * c = calloc(1, sizeof(struct channelizer));
+	if (c == NULL) {
+		return NULL;
+	}
+
+	c->channel_count = channel_count;
+	c->decimation = channel_count / 2;
+	c->skip = c->decimation;
+	c->time = channel_count - 1;
+
+	size_t taps_per_channel = ceil(BLACKMAN_WIDTH / (STOPBAND_EDGE - PASSBAND_EDGE));
+	c->tap_count = taps_per_channel * channel_count;
+
+	c->taps = malloc(sizeof(float) * c->tap_count);
+	c->history_i = calloc(2 * c->tap_count, sizeof(float));
+	c->history_q = calloc(2 * c->tap_count, sizeof(float));
+	c->folded_i = malloc(sizeof(float) * channel_count);
+	c->folded_q = malloc(sizeof(float) * channel_count);
+	c->fft_input = malloc(2 * sizeof(float) * channel_count);
+	c->fft_output = malloc(2 * sizeof(float) * channel_count);
+	c->fft = fft_init(channel_count, true);
+	if (c->taps == NULL || c->history_i == NULL || c->history_q == NULL || c->folded_i == NULL || c->folded_q == NULL ||
+			c->fft_input == NULL || c->fft_output == NULL || c->fft == NULL) {
+		channelizer_free(c);
+		return NULL;
+	}
+
+	/***********************************
+	 * windowed sinc, in input samples *
+	 ***********************************/
+
+	// Symmetric, so it needs no reversing to match the history order
+	float cutoff = (PASSBAND_EDGE + STOPBAND_EDGE) / 2 / channel_count;
+	float center = (c->tap_count - 1) / 2.0;
+	float sum = 0;
+
+	for (size_t n = 0; n < c->tap_count; n++) {
+		float t = n - center;
+		float sinc = t == 0 ? 2 * cutoff : sin(2 * PI * cutoff * t) / (PI * t);
+		float window = 0.42 - 0.5 * cos(2 * PI * n / (c->tap_count - 1)) + 0.08 * cos(4 * PI * n / (c->tap_count - 1));
+
+		c->taps[n] = sinc * window;
+		sum += c->taps[n];
+	}
+
+	// Unity gain at the center of each channel
+	for (size_t n = 0; n < c->tap_count; n++) {
+		c->taps[n] /= sum;
+	}
+
+	return c;
+}
+
+size_t channelizer_max_output(channelizer_t * c, size_t input_count) {
+	return input_count / c->decimation + 1;
+}
+
+/**
+ * Filters the history window for all channels at once, and writes the output
+ * sample of each one.
+ */
+static void split(channelizer_t * c, float ** channels, size_t output_idx) {
+	size_t m = c->channel_count;
+	const float * window_i = c->history_i + c->history_idx;
+	const float * window_q = c->history_q + c->history_idx;
+
+	/*
+	 * Each channel is the input shifted down by its center frequency, and
+	 * then lowpass filtered. Shifting the filter up instead, its taps a whole
+	 * number of channels apart meet the same phase of every channel's
+	 * oscillator, so they can be added up first, leaving a DFT.
+	 */
+	size_t r = 0;
+	for (; r + ACCUMULATORS <= m; r += ACCUMULATORS) {
+		// Kept apart from the channelizer, so the compiler can vectorize it
+		float sum_i[ACCUMULATORS] = { 0 };
+		float sum_q[ACCUMULATORS] = { 0 };
+		for (size_t base = r; base < c->tap_count; base += m) {
+			for (int i = 0; i < ACCUMULATORS; i++) {
+				sum_i[i] += c->taps[base + i] * window_i[base + i];
+				sum_q[i] += c->taps[base + i] * window_q[base + i];
+			}
+		}
+
+		for (int i = 0; i < ACCUMULATORS; i++) {
+			c->folded_i[r + i] = sum_i[i];
+			c->folded_q[r + i] = sum_q[i];
+		}
+	}
+
+	for (; r < m; r++) {
+		float sum_i = 0;
+		float sum_q = 0;
+		for (size_t base = r; base < c->tap_count; base += m) {
+			sum_i += c->taps[base] * window_i[base];
+			sum_q += c->taps[base] * window_q[base];
+		}
+
+		c->folded_i[r] = sum_i;
+		c->folded_q[r] = sum_q;
+	}
+
+	// The newest sample goes last in the window, and the DFT input is
+	// rotated so each channel is shifted by its oscillator at the current time
+	for (size_t q = 0; q < m; q++) {
+		size_t r = m - 1 - (q + c->time) % m;
+		c->fft_input[2 * q] = c->folded_i[r];
+		c->fft_input[2 * q + 1] = c->folded_q[r];
+	}
+
+	fft_run(c->fft, c->fft_input, c->fft_output);
+
+	// Bins above half the channel count are the negative frequencies
+	for (size_t i = 0; i < m; i++) {
+		size_t bin = (i + m / 2) % m;
+		channels[i][2 * output_idx] = c->fft_output[2 * bin];
+		channels[i][2 * output_idx + 1] = c->fft_output[2 * bin + 1];
+	}
+}
+
+size_t channelizer_process(channelizer_t * c, const float * iq, size_t input_count, float ** channels) {
+	size_t output_count = 0;
+
+	for (size_t n = 0; n < input_count; n++) {
+		c->history_i[c->history_idx] = iq[2 * n];
+		c->history_i[c->history_idx + c->tap_count] = iq[2 * n];
+		c->history_q[c->history_idx] = iq[2 * n + 1];
+		c->history_q[c->history_idx + c->tap_count] = iq[2 * n + 1];
+		if (++c->history_idx == c->tap_count) {
+			c->history_idx = 0;
+		}
+		if (++c->time == c->channel_count) {
+			c->time = 0;
+		}
+
+		if (--c->skip > 0) {
+			continue;
+		}
+		c->skip = c->decimation;
+
+		split(c, channels, output_count++);
+	}
+
+	return output_count;
+}
+
+void channelizer_free(channelizer_t * c) {
+	if (c == NULL) {
+		return;
+	}
+
+	fft_free(c->fft);
+	free(c->fft_output);
+	free(c->fft_input);
+	free(c->folded_q);
+	free(c->folded_i);
+	free(c->history_q);
+	free(c->history_i);
+	free(c->taps);
+	free(c);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdlib.h>
+
+typedef struct channelizer channelizer_t;
+
+/**
+ * Initializes a polyphase filter bank, splitting complex baseband samples
+ * into evenly spaced channels with a single FFT per output sample, instead of
+ * filtering each channel on its own.
+ *
+ * Channels are centered at multiples of the input rate divided by the channel
+ * count, and ordered by frequency: channel {@code channel_count / 2} is at the
+ * center of the input band, and the ones before it below it. Their output is
+ * oversampled by two, at twice the channel spacing, so signals reaching the
+ * edges of a channel are not aliased into it.
+ *
+ * @param channel_count Number of channels, even
+ * @returns New channelizer, or NULL on error
+ */
+channelizer_t * channelizer_init(int channel_count);
+
+/**
+ * Returns the maximum number of samples per channel that channelizer_process
+ * can output for a given number of input samples.
+ *
+ * @param c Channelizer
+ * @param input_count Number of input samples
+ * @returns Maximum number of output samples per channel
+ */
+size_t channelizer_max_output(channelizer_t * c, size_t input_count);
+
+/**
+ * Splits a buffer into channels. Filter state is kept between calls, so a
+ * stream can be processed using buffers of any size.
+ *
+ * @param c Channelizer
+ * @param iq Input samples, as interleaved I and Q floats
+ * @param input_count Number of input samples, each an I and Q pair
+ * @param channels Output buffers, one per channel, with room for
+ *                 channelizer_max_output samples as interleaved I and Q
+ * @returns Number of output samples per channel
+ */
+size_t channelizer_process(channelizer_t * c, const float * iq, size_t input_count, float ** channels);
+
+/**
+ * Destroys the channelizer. Accepts NULL.
+ *
+ * @param c Channelizer
+ */
+void channelizer_free(channelizer_t * c);
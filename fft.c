@@ -0,0 +1,265 @@
+#include "fft.h"
+#include <math.h>
+
+// Enough stages for any size that fits in memory
+#define MAX_STAGES 64
+
+struct fft {
+	size_t size;
+	bool inverse;
+
+	/**
+	 * Radix and length of the sub-transforms at each stage, the largest
+	 * transforms first
+	 */
+	size_t radix[MAX_STAGES];
+	size_t length[MAX_STAGES];
+
+	/**
+	 * Roots of unity, as interleaved real and imaginary parts
+	 */
+	float * twiddles;
+
+	/**
+	 * Room for a butterfly of the largest radix
+	 */
+	float * scratch;
+};
+
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+fft_t * fft_init(size_t size, bool inverse) {
+	if (size == 0) {
+		return NULL;
+	}
+
+	fft_t * f = calloc(1, sizeof(struct fft));
+	if (f == NULL) {
+		return NULL;
+	}
+
+	f->size = size;
+	f->inverse = inverse;
+
+	// Factor out fours and twos first, which have the cheapest butterflies
+	size_t remaining = size;
+	size_t largest = 1;
+	for (int stage = 0; remaining > 1; stage++) {
+		size_t radix = remaining % 4 == 0 ? 4 : 2;
+		while (remaining % radix != 0) {
+			radix = radix == 2 ? 3 : radix + 2;
+		}
+
+		remaining /= radix;
+		f->radix[stage] = radix;
+		f->length[stage] = remaining;
+		if (radix > largest) {
+			largest = radix;
+		}
+	}
+
+	f->twiddles = malloc(2 * size * sizeof(float));
+	f->scratch = malloc(2 * largest * sizeof(float));
+	if (f->twiddles == NULL || f->scratch == NULL) {
+		fft_free(f);
+		return NULL;
+	}
+
+	double sign = inverse ? 1 : -1;
+	for (size_t i = 0; i < size; i++) {
+		f->twiddles[2 * i] = cos(2 * PI * i / size);
+		f->twiddles[2 * i + 1] = sign * sin(2 * PI * i / size);
+	}
+
+	return f;
+}
+
+/**
+ * Combines the radix 2 sub-transforms of a stage.
+ */
+static void butterfly_2(const fft_t * f, float * out, size_t stride, size_t length) {
+	for (size_t k = 0; k < length; k++) {
+		const float * w = f->twiddles + 2 * k * stride;
+		float * a = out + 2 * k;
+		float * b = out + 2 * (k + length);
+
+		float t_re = b[0] * w[0] - b[1] * w[1];
+		float t_im = b[0] * w[1] + b[1] * w[0];
+		b[0] = a[0] - t_re;
+		b[1] = a[1] - t_im;
+		a[0] += t_re;
+		a[1] += t_im;
+	}
+}
+
+/**
+ * Combines the radix 3 sub-transforms of a stage.
+ */
+static void butterfly_3(const fft_t * f, float * out, size_t stride, size_t length) {
+	// Imaginary part of the first third of a turn, signed by the direction
+	float epi3 = f->twiddles[2 * stride * length + 1];
+
+	for (size_t k = 0; k < length; k++) {
+		const float * w1 = f->twiddles + 2 * k * stride;
+		const float * w2 = f->twiddles + 4 * k * stride;
+		float * a = out + 2 * k;
+		float * b = out + 2 * (k + length);
+		float * c = out + 2 * (k + 2 * length);
+
+		float s1_re = b[0] * w1[0] - b[1] * w1[1];
+		float s1_im = b[0] * w1[1] + b[1] * w1[0];
+		float s2_re = c[0] * w2[0] - c[1] * w2[1];
+		float s2_im = c[0] * w2[1] + c[1] * w2[0];
+
+		float sum_re = s1_re + s2_re;
+		float sum_im = s1_im + s2_im;
+		float diff_re = (s1_re - s2_re) * epi3;
+		float diff_im = (s1_im - s2_im) * epi3;
+
+		float mid_re = a[0] - sum_re / 2;
+		float mid_im = a[1] - sum_im / 2;
+		a[0] += sum_re;
+		a[1] += sum_im;
+		b[0] = mid_re - diff_im;
+		b[1] = mid_im + diff_re;
+		c[0] = mid_re + diff_im;
+		c[1] = mid_im - diff_re;
+	}
+}
+
+/**
+ * Combines the radix 4 sub-transforms of a stage.
+ */
+static void butterfly_4(const fft_t * f, float * out, size_t stride, size_t length) {
+	for (size_t k = 0; k < length; k++) {
+		const float * w1 = f->twiddles + 2 * k * stride;
+		const float * w2 = f->twiddles + 4 * k * stride;
+		const float * w3 = f->twiddles + 6 * k * stride;
+		float * a = out + 2 * k;
+		float * b = out + 2 * (k + length);
+		float * c = out + 2 * (k + 2 * length);
+		float * d = out + 2 * (k + 3 * length);
+
+		float s0_re = b[0] * w1[0] - b[1] * w1[1];
+		float s0_im = b[0] * w1[1] + b[1] * w1[0];
+		float s1_re = c[0] * w2[0] - c[1] * w2[1];
+		float s1_im = c[0] * w2[1] + c[1] * w2[0];
+		float s2_re = d[0] * w3[0] - d[1] * w3[1];
+		float s2_im = d[0] * w3[1] + d[1] * w3[0];
+
+		float s5_re = a[0] - s1_re;
+		float s5_im = a[1] - s1_im;
+		float s3_re = s0_re + s2_re;
+		float s3_im = s0_im + s2_im;
+		float s4_re = s0_re - s2_re;
+		float s4_im = s0_im - s2_im;
+
+		float a_re = a[0] + s1_re;
+		float a_im = a[1] + s1_im;
+		c[0] = a_re - s3_re;
+		c[1] = a_im - s3_im;
+		a[0] = a_re + s3_re;
+		a[1] = a_im + s3_im;
+
+		// Quarter turn of the odd terms, whose direction depends on the transform's
+		if (f->inverse) {
+			b[0] = s5_re - s4_im;
+			b[1] = s5_im + s4_re;
+			d[0] = s5_re + s4_im;
+			d[1] = s5_im - s4_re;
+		} else {
+			b[0] = s5_re + s4_im;
+			b[1] = s5_im - s4_re;
+			d[0] = s5_re - s4_im;
+			d[1] = s5_im + s4_re;
+		}
+	}
+}
+
+/**
+ * Combines the sub-transforms of a stage of any radix, as a plain DFT of
+ * their twiddled outputs.
+ */
+static void butterfly_generic(const fft_t * f, float * out, size_t stride, size_t radix, size_t length) {
+	float * scratch = f->scratch;
+
+	for (size_t u = 0; u < length; u++) {
+		for (size_t q = 0; q < radix; q++) {
+			scratch[2 * q] = out[2 * (u + q * length)];
+			scratch[2 * q + 1] = out[2 * (u + q * length) + 1];
+		}
+
+		for (size_t q1 = 0; q1 < radix; q1++) {
+			size_t k = u + q1 * length;
+			float sum_re = scratch[0];
+			float sum_im = scratch[1];
+
+			size_t twiddle = 0;
+			for (size_t q = 1; q < radix; q++) {
+				twiddle += stride * k;
+				if (twiddle >= f->size) {
+					twiddle %= f->size;
+				}
+
+				const float * w = f->twiddles + 2 * twiddle;
+				sum_re += scratch[2 * q] * w[0] - scratch[2 * q + 1] * w[1];
+				sum_im += scratch[2 * q] * w[1] + scratch[2 * q + 1] * w[0];
+			}
+
+			out[2 * k] = sum_re;
+			out[2 * k + 1] = sum_im;
+		}
+	}
+}
+
+/**
+ * Decimation in time: transforms each of the interleaved subsequences of the
+ * input into consecutive blocks of the output, and combines them.
+ */
+static void transform(const fft_t * f, int stage, const float * in, size_t stride, float * out) {
+	size_t radix = f->radix[stage];
+	size_t length = f->length[stage];
+
+	for (size_t q = 0; q < radix; q++) {
+		const float * sub_in = in + 2 * q * stride;
+		float * sub_out = out + 2 * q * length;
+
+		if (length == 1) {
+			sub_out[0] = sub_in[0];
+			sub_out[1] = sub_in[1];
+		} else {
+			transform(f, stage + 1, sub_in, stride * radix, sub_out);
+		}
+	}
+
+	if (radix == 2) {
+		butterfly_2(f, out, stride, length);
+	} else if (radix == 3) {
+		butterfly_3(f, out, stride, length);
+	} else if (radix == 4) {
+		butterfly_4(f, out, stride, length);
+	} else {
+		butterfly_generic(f, out, stride, radix, length);
+	}
+}
+
+void fft_run(fft_t * f, const float * input, float * output) {
+	if (f->size == 1) {
+		output[0] = input[0];
+		output[1] = input[1];
+		return;
+	}
+
+	transform(f, 0, input, 1, output);
+}
+
+void fft_free(fft_t * f) {
+	if (f == NULL) {
+		return;
+	}
+
+	free(f->scratch);
+	free(f->twiddles);
+	free(f);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef struct fft fft_t;
+
+/**
+ * Initializes a complex FFT of any size. Sizes made of small factors, such as
+ * 64 or 96, are fastest, as each prime factor p costs p operations per
+ * element.
+ *
+ * @param size Number of points
+ * @param inverse Whether to compute the inverse transform, with a positive
+ *                exponent. Neither direction is scaled.
+ * @returns New FFT, or NULL on error
+ */
+fft_t * fft_init(size_t size, bool inverse);
+
+/**
+ * Computes the transform of a buffer.
+ *
+ * @param f FFT
+ * @param input Input, as interleaved real and imaginary parts
+ * @param output Output, in the same layout. Must not overlap the input.
+ */
+void fft_run(fft_t * f, const float * input, float * output);
+
+/**
+ * Destroys the FFT. Accepts NULL.
+ *
+ * @param f FFT
+ */
+void fft_free(fft_t * f);
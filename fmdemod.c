@@ -0,0 +1,262 @@
+#include "fmdemod.h"
+#include "resample.h"
+#include <string.h>
+#include <math.h>
+
+// Audio samples at the intermediate rate resampled at once
+#define AUDIO_CHUNK 512
+
+struct fmdemod {
+	/**
+	 * Decimation factor of the channel filter, and input samples left before
+	 * its next output
+	 */
+	size_t decimation;
+	size_t skip;
+
+	/**
+	 * Channel filter taps, in the same order as the history windows (oldest
+	 * sample first)
+	 */
+	float * taps;
+	size_t tap_count;
+
+	/**
+	 * Last input samples, I and Q apart, each stored twice back to back so
+	 * the window starting at history_idx is always contiguous
+	 */
+	float * history_i;
+	float * history_q;
+	size_t history_idx;
+
+	/**
+	 * Last filtered sample, for the phase step of the next one
+	 */
+	float last_i;
+	float last_q;
+
+	/**
+	 * Scale from phase step to audio, full scale at the peak deviation
+	 */
+	float gain;
+
+	/**
+	 * Coefficient of the de-emphasis filter, or 0 if disabled, and its output
+	 */
+	float deemphasis;
+	float deemphasized;
+
+	/**
+	 * Converts the audio from the intermediate rate to the output one, or
+	 * NULL if both are the same, and audio waiting to be converted
+	 */
+	resample_t * resample;
+	float audio[AUDIO_CHUNK];
+};
+
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+// Normalized transition width of a Blackman window, times filter length
+#define BLACKMAN_WIDTH 5.5
+
+// Partial sums per filter output. The filter length is made a multiple of it.
+#define ACCUMULATORS 8
+
+// Least intermediate rate over the bandwidth of the modulated signal, which
+// leaves a transition band a quarter of the bandwidth wide
+#define INTERMEDIATE_MARGIN 1.5
+
+fmdemod_t * fmdemod_init(int input_rate, int output_rate, float deviation, float passband, float deemphasis) {
+	if (input_rate <= 0 || output_rate <= 0 || deviation <= 0 || passband <= 0 || deemphasis < 0) {
+		return NULL;
+	}
+
+	/*
+	 * Carson's rule: the modulated signal takes the deviation plus the audio
+	 * bandwidth on each side of the carrier. Decimate by the largest factor
+	 * that divides the input rate evenly and leaves room for it.
+	 */
+	float bandwidth = 2 * (deviation + passband);
+	size_t decimation = input_rate / (INTERMEDIATE_MARGIN * bandwidth);
+	while (decimation > 1 && input_rate % decimation != 0) {
+		decimation--;
+	}
+	if (decimation < 1) {
+		decimation = 1;
+	}
+
+	int intermediate_rate = input_rate / decimation;
+	float transition = intermediate_rate / 2.0 - bandwidth / 2;
+	if (transition <= 0) {
+		return NULL;
+	}
+
+	fmdemod_t * f = calloc(1, sizeof(struct fmdemod));
+	if (f == NULL) {
+		return NULL;
+	}
+
+	f->decimation = decimation;
+	f->skip = decimation;
+	f->tap_count = ceil(BLACKMAN_WIDTH * input_rate / transition / ACCUMULATORS) * ACCUMULATORS;
+	f->gain = intermediate_rate / (2 * PI * deviation);
+	f->last_i = 1;
+
+	f->taps = malloc(sizeof(float) * f->tap_count);
+	f->history_i = calloc(2 * f->tap_count, sizeof(float));
+	f->history_q = calloc(2 * f->tap_count, sizeof(float));
+	if (f->taps == NULL || f->history_i == NULL || f->history_q == NULL) {
+		fmdemod_free(f);
+		return NULL;
+	}
+
+	if (intermediate_rate != output_rate) {
+		f->resample = resample_init(intermediate_rate, output_rate, passband);
+		if (f->resample == NULL) {
+			fmdemod_free(f);
+			return NULL;
+		}
+	}
+
+	// Single pole lowpass, with its corner at 1 / (2 pi deemphasis)
+	if (deemphasis > 0) {
+		f->deemphasis = 1 - exp(-1 / (deemphasis * intermediate_rate));
+	}
+
+	/**********************************************************
+	 * windowed sinc, cut off in the middle of the transition *
+	 **********************************************************/
+	float cutoff = (bandwidth / 2 + intermediate_rate / 2.0) / 2;
+	float center = (f->tap_count - 1) / 2.0;
+	float sum = 0;
+
+	for (size_t n = 0; n < f->tap_count; n++) {
+		float t = (n - center) / input_rate;
+		float sinc = t == 0 ? 2 * cutoff / input_rate : sin(2 * PI * cutoff * t) / (PI * t * input_rate);
+		float window = 0.42 - 0.5 * cos(2 * PI * n / (f->tap_count - 1)) + 0.08 * cos(4 * PI * n / (f->tap_count - 1));
+
+		f->taps[n] = sinc * window;
+		sum += f->taps[n];
+	}
+
+	// Unity gain at the carrier, so the phase steps are not biased
+	for (size_t n = 0; n < f->tap_count; n++) {
+		f->taps[n] /= sum;
+	}
+
+	return f;
+}
+
+size_t fmdemod_max_output(fmdemod_t * f, size_t input_count) {
+	size_t intermediate_count = input_count / f->decimation + 1;
+	if (f->resample) {
+		return resample_max_output(f->resample, intermediate_count);
+	}
+
+	return intermediate_count;
+}
+
+/**
+ * Runs the channel filter over the history window.
+ */
+static void filter(fmdemod_t * f, float * i_out, float * q_out) {
+	const float * window_i = f->history_i + f->history_idx;
+	const float * window_q = f->history_q + f->history_idx;
+
+	// Independent partial sums, so the compiler can vectorize it
+	float sum_i[ACCUMULATORS] = { 0 };
+	float sum_q[ACCUMULATORS] = { 0 };
+	for (size_t tap = 0; tap < f->tap_count; tap += ACCUMULATORS) {
+		for (int i = 0; i < ACCUMULATORS; i++) {
+			sum_i[i] += f->taps[tap + i] * window_i[tap + i];
+			sum_q[i] += f->taps[tap + i] * window_q[tap + i];
+		}
+	}
+
+	float total_i = 0;
+	float total_q = 0;
+	for (int i = 0; i < ACCUMULATORS; i++) {
+		total_i += sum_i[i];
+		total_q += sum_q[i];
+	}
+
+	*i_out = total_i;
+	*q_out = total_q;
+}
+
+size_t fmdemod_process(fmdemod_t * f, const float * iq, size_t input_count, float * output) {
+	size_t output_count = 0;
+	size_t audio_count = 0;
+
+	for (size_t n = 0; n < input_count; n++) {
+		f->history_i[f->history_idx] = iq[2 * n];
+		f->history_i[f->history_idx + f->tap_count] = iq[2 * n];
+		f->history_q[f->history_idx] = iq[2 * n + 1];
+		f->history_q[f->history_idx + f->tap_count] = iq[2 * n + 1];
+		if (++f->history_idx == f->tap_count) {
+			f->history_idx = 0;
+		}
+
+		if (--f->skip > 0) {
+			continue;
+		}
+		f->skip = f->decimation;
+
+		float i, q;
+		filter(f, &i, &q);
+
+		// Quadrature discriminator: phase of the sample times the conjugate of the last one
+		float sample = f->gain * atan2f(q * f->last_i - i * f->last_q, i * f->last_i + q * f->last_q);
+		f->last_i = i;
+		f->last_q = q;
+
+		if (f->deemphasis > 0) {
+			f->deemphasized += f->deemphasis * (sample - f->deemphasized);
+			sample = f->deemphasized;
+		}
+
+		if (f->resample == NULL) {
+			output[output_count++] = sample;
+			continue;
+		}
+
+		f->audio[audio_count++] = sample;
+		if (audio_count == AUDIO_CHUNK) {
+			output_count += resample_process(f->resample, f->audio, audio_count, output + output_count);
+			audio_count = 0;
+		}
+	}
+
+	if (audio_count > 0) {
+		output_count += resample_process(f->resample, f->audio, audio_count, output + output_count);
+	}
+
+	return output_count;
+}
+
+void fmdemod_reset(fmdemod_t * f) {
+	memset(f->history_i, 0, 2 * f->tap_count * sizeof(float));
+	memset(f->history_q, 0, 2 * f->tap_count * sizeof(float));
+	f->history_idx = 0;
+	f->skip = f->decimation;
+	f->last_i = 1;
+	f->last_q = 0;
+	f->deemphasized = 0;
+
+	if (f->resample != NULL) {
+		resample_reset(f->resample);
+	}
+}
+
+void fmdemod_free(fmdemod_t * f) {
+	if (f == NULL) {
+		return;
+	}
+
+	resample_free(f->resample);
+	free(f->history_q);
+	free(f->history_i);
+	free(f->taps);
+	free(f);
+}
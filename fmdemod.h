@@ -0,0 +1,60 @@
+#pragma once
+#include <stdlib.h>
+
+typedef struct fmdemod fmdemod_t;
+
+/**
+ * Initializes an FM demodulator for complex baseband samples, such as those
+ * captured by SDR receivers, producing audio for the UIC demodulator.
+ *
+ * The channel is first filtered and decimated by an integer factor to an
+ * intermediate rate just wide enough for the modulated signal. The phase step
+ * between consecutive samples is then taken as the audio, de-emphasized and
+ * finally resampled to the output rate.
+ *
+ * @param input_rate Input sample rate
+ * @param output_rate Output sample rate
+ * @param deviation Peak frequency deviation, demodulated to full scale
+ * @param passband Highest audio frequency that must be kept undistorted.
+ *                 Must be below half the output rate.
+ * @param deemphasis De-emphasis time constant in seconds, or 0 to disable it
+ * @returns New demodulator, or NULL on error
+ */
+fmdemod_t * fmdemod_init(int input_rate, int output_rate, float deviation, float passband, float deemphasis);
+
+/**
+ * Returns the maximum number of samples that fmdemod_process can output for a
+ * given number of input samples.
+ *
+ * @param f Demodulator
+ * @param input_count Number of input samples
+ * @returns Maximum number of output samples
+ */
+size_t fmdemod_max_output(fmdemod_t * f, size_t input_count);
+
+/**
+ * Demodulates a buffer. Filter state is kept between calls, so a stream can
+ * be processed using buffers of any size.
+ *
+ * @param f Demodulator
+ * @param iq Input samples, as interleaved I and Q floats
+ * @param input_count Number of input samples, each an I and Q pair
+ * @param output Output buffer, with room for fmdemod_max_output samples
+ * @returns Number of output samples
+ */
+size_t fmdemod_process(fmdemod_t * f, const float * iq, size_t input_count, float * output);
+
+/**
+ * Forgets the samples seen so far, as if the stream started anew with the
+ * next sample.
+ *
+ * @param f Demodulator
+ */
+void fmdemod_reset(fmdemod_t * f);
+
+/**
+ * Destroys the demodulator. Accepts NULL.
+ *
+ * @param f Demodulator
+ */
+void fmdemod_free(fmdemod_t * f);
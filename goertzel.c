@@ -1,56 +1,560 @@
-
 #include "goertzel.h"
+#include "arena.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define GOERTZEL_X86
+#	include <immintrin.h>
+#endif
+
+/**
+ * Advances the resonators for {@code lane_count} frequencies over all the
+ * samples, starting from and leaving the last two outputs of each one in
+ * {@code current} and {@code old}.
+ */
+typedef void (*goertzel_kernel_t)(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old);
+
+/**
+ * Same as a kernel, for at most {@code MAX_LANES} frequencies, running all of
+ * them over each sample in turn so the samples are read once. Meanwhile adds
+ * up the absolute values of the samples and packs their signs, see
+ * goertzel_scan.
+ */
+typedef float (*goertzel_scan_t)(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old, uint64_t * signs);
+
 struct goertzel {
 	size_t freq_count;
+
+	/**
+	 * Number of frequencies rounded up to a whole number of vector lanes.
+	 * Padding lanes have a zero coefficient and are never reported.
+	 */
+	size_t lane_count;
+
 	float * coeffs;
+
+	/**
+	 * Sine of each frequency, for the phase of the DFT
+	 */
+	float * sines;
+
+	/**
+	 * Cosine and sine of each frequency, in Q23 format, and resonator outputs
+	 * for the fixed-point kernel
+	 */
+	int32_t * coeffs_q23;
+	int32_t * sines_q23;
+	int32_t * current_q;
+	int32_t * old_q;
+
+	/**
+	 * Resonator outputs after the last run, one per lane
+	 */
+	float * current;
+	float * old;
+
+	goertzel_engine_t engine;
+	goertzel_kernel_t kernel;
+	goertzel_scan_t scan;
+
+	/**
+	 * Set if allocated by goertzel_init, rather than in a caller's buffer
+	 */
+	bool allocated;
 };
 
 // M_PI isn't really standard - define here our own version
 #define PI 3.14159265358979323846264338327950288419716939937510582
 
+// Widest vector we support, in floats
+#define MAX_LANES 8
+
+/**
+ * Portable kernel. Runs four resonators at a time in a single pass, which
+ * already breaks the serial dependency between consecutive samples enough for
+ * the CPU to overlap them.
+ */
+static void kernel_scalar(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old) {
+	for (size_t lane = 0; lane < lane_count; lane += 4) {
+		const float * c = coeffs + lane;
+		float s0[4], s1[4], s2[4];
+		memcpy(s0, current + lane, sizeof(s0));
+		memcpy(s1, old + lane, sizeof(s1));
+
+		for (size_t sample = 0; sample < sample_count; sample++) {
+			for (int i = 0; i < 4; i++) {
+				s2[i] = s1[i];
+				s1[i] = s0[i];
+				s0[i] = samples[sample] + c[i] * s1[i] - s2[i];
+			}
+		}
+
+		memcpy(current + lane, s0, sizeof(s0));
+		memcpy(old + lane, s1, sizeof(s1));
+	}
+}
+
+/**
+ * 2 * cos(w) * s1, with the cosine in Q23. The product is the only step wider
+ * than 32 bits, a single widening multiply on 32-bit CPUs.
+ */
+static inline int32_t mul_q22(int32_t coeff, int32_t resonator) {
+	return (int32_t) (((int64_t) coeff * resonator) >> 22);
+}
+
+/**
+ * Fixed-point kernel for 16-bit samples. Works like the scalar one, with the
+ * coefficient product shifted back to the input scale.
+ *
+ * A resonator grows with the hop length divided by the sine of its frequency,
+ * so 32 bits hold a full-scale tone for 131072 * sin(w) samples, see
+ * goertzel_magnitude_s16. The cosine is in Q23 rather than Q15, which would
+ * detune them enough to miss a tone over a few thousand samples.
+ */
+static void kernel_s16(const int32_t * coeffs, size_t lane_count, const int16_t * samples, size_t sample_count, int32_t * current, int32_t * old) {
+	for (size_t lane = 0; lane < lane_count; lane += 4) {
+		const int32_t * c = coeffs + lane;
+		int32_t s0[4], s1[4], s2[4];
+		memcpy(s0, current + lane, sizeof(s0));
+		memcpy(s1, old + lane, sizeof(s1));
+
+		for (size_t sample = 0; sample < sample_count; sample++) {
+			for (int i = 0; i < 4; i++) {
+				s2[i] = s1[i];
+				s1[i] = s0[i];
+				s0[i] = samples[sample] + mul_q22(c[i], s1[i]) - s2[i];
+			}
+		}
+
+		memcpy(current + lane, s0, sizeof(s0));
+		memcpy(old + lane, s1, sizeof(s1));
+	}
+}
+
+/**
+ * Portable single pass kernel. Up to {@code MAX_LANES} resonators are kept in
+ * arrays small enough for the compiler to hold in registers.
+ */
+static float scan_scalar(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old, uint64_t * signs) {
+	float s0[MAX_LANES], s1[MAX_LANES];
+	memcpy(s0, current, lane_count * sizeof(float));
+	memcpy(s1, old, lane_count * sizeof(float));
+
+	float power = 0;
+	for (size_t base = 0; base < sample_count; base += 64) {
+		size_t count = sample_count - base < 64 ? sample_count - base : 64;
+		uint64_t bits = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			float sample = samples[base + i];
+			for (size_t lane = 0; lane < lane_count; lane++) {
+				float s2 = s1[lane];
+				s1[lane] = s0[lane];
+				s0[lane] = sample + coeffs[lane] * s1[lane] - s2;
+			}
+
+			power += sample < 0 ? -sample : sample;
+			bits |= (uint64_t) !(sample >= 0) << i;
+		}
+
+		signs[base / 64] = bits;
+	}
+
+	memcpy(current, s0, lane_count * sizeof(float));
+	memcpy(old, s1, lane_count * sizeof(float));
+	return power;
+}
+
+/**
+ * Fixed-point single pass kernel for 16-bit samples, see kernel_s16.
+ */
+static int64_t scan_s16(const int32_t * coeffs, size_t lane_count, const int16_t * samples, size_t sample_count, int32_t * current, int32_t * old, uint64_t * signs) {
+	int32_t s0[MAX_LANES], s1[MAX_LANES];
+	memcpy(s0, current, lane_count * sizeof(int32_t));
+	memcpy(s1, old, lane_count * sizeof(int32_t));
+
+	int64_t power = 0;
+	for (size_t base = 0; base < sample_count; base += 64) {
+		size_t count = sample_count - base < 64 ? sample_count - base : 64;
+		uint64_t bits = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			int32_t sample = samples[base + i];
+			for (size_t lane = 0; lane < lane_count; lane++) {
+				int32_t s2 = s1[lane];
+				s1[lane] = s0[lane];
+				s0[lane] = sample + mul_q22(coeffs[lane], s1[lane]) - s2;
+			}
+
+			power += sample < 0 ? -sample : sample;
+			bits |= (uint64_t) (sample < 0) << i;
+		}
+
+		signs[base / 64] = bits;
+	}
+
+	memcpy(current, s0, lane_count * sizeof(int32_t));
+	memcpy(old, s1, lane_count * sizeof(int32_t));
+	return power;
+}
+
+#ifdef GOERTZEL_X86
+
+__attribute__((target("sse")))
+static void kernel_sse(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old) {
+	for (size_t lane = 0; lane < lane_count; lane += 4) {
+		__m128 c = _mm_loadu_ps(coeffs + lane);
+		__m128 s0 = _mm_loadu_ps(current + lane), s1 = _mm_loadu_ps(old + lane), s2;
+
+		for (size_t sample = 0; sample < sample_count; sample++) {
+			s2 = s1;
+			s1 = s0;
+			s0 = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(samples[sample]), _mm_mul_ps(c, s1)), s2);
+		}
+
+		_mm_storeu_ps(current + lane, s0);
+		_mm_storeu_ps(old + lane, s1);
+	}
+}
+
+__attribute__((target("avx")))
+static void kernel_avx(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old) {
+	for (size_t lane = 0; lane < lane_count; lane += 8) {
+		__m256 c = _mm256_loadu_ps(coeffs + lane);
+		__m256 s0 = _mm256_loadu_ps(current + lane), s1 = _mm256_loadu_ps(old + lane), s2;
+
+		for (size_t sample = 0; sample < sample_count; sample++) {
+			s2 = s1;
+			s1 = s0;
+			s0 = _mm256_sub_ps(_mm256_add_ps(_mm256_broadcast_ss(&samples[sample]), _mm256_mul_ps(c, s1)), s2);
+		}
+
+		_mm256_storeu_ps(current + lane, s0);
+		_mm256_storeu_ps(old + lane, s1);
+	}
+}
+
+/**
+ * SSE single pass kernel, for one or two registers of resonators. Always
+ * inlined, so each count gets its own copy with the loops over registers
+ * unrolled.
+ */
+__attribute__((target("sse")))
+static inline __attribute__((always_inline)) float scan_sse_registers(const float * coeffs, size_t registers, const float * samples, size_t sample_count, float * current, float * old, uint64_t * signs) {
+	__m128 c[2], s0[2], s1[2], s2;
+	for (size_t r = 0; r < registers; r++) {
+		c[r] = _mm_loadu_ps(coeffs + 4 * r);
+		s0[r] = _mm_loadu_ps(current + 4 * r);
+		s1[r] = _mm_loadu_ps(old + 4 * r);
+	}
+
+	float power = 0;
+	for (size_t base = 0; base < sample_count; base += 64) {
+		size_t count = sample_count - base < 64 ? sample_count - base : 64;
+		uint64_t bits = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			float sample = samples[base + i];
+			__m128 x = _mm_set1_ps(sample);
+			for (size_t r = 0; r < registers; r++) {
+				s2 = s1[r];
+				s1[r] = s0[r];
+				s0[r] = _mm_sub_ps(_mm_add_ps(x, _mm_mul_ps(c[r], s1[r])), s2);
+			}
+
+			power += sample < 0 ? -sample : sample;
+			bits |= (uint64_t) !(sample >= 0) << i;
+		}
+
+		signs[base / 64] = bits;
+	}
+
+	for (size_t r = 0; r < registers; r++) {
+		_mm_storeu_ps(current + 4 * r, s0[r]);
+		_mm_storeu_ps(old + 4 * r, s1[r]);
+	}
+	return power;
+}
+
+__attribute__((target("sse")))
+static float scan_sse(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old, uint64_t * signs) {
+	if (lane_count > 4) {
+		return scan_sse_registers(coeffs, 2, samples, sample_count, current, old, signs);
+	}
+	return scan_sse_registers(coeffs, 1, samples, sample_count, current, old, signs);
+}
+
+__attribute__((target("avx")))
+static float scan_avx(const float * coeffs, size_t lane_count, const float * samples, size_t sample_count, float * current, float * old, uint64_t * signs) {
+	__m256 c = _mm256_loadu_ps(coeffs);
+	__m256 s0 = _mm256_loadu_ps(current), s1 = _mm256_loadu_ps(old), s2;
+
+	float power = 0;
+	for (size_t base = 0; base < sample_count; base += 64) {
+		size_t count = sample_count - base < 64 ? sample_count - base : 64;
+		uint64_t bits = 0;
+
+		for (size_t i = 0; i < count; i++) {
+			float sample = samples[base + i];
+			s2 = s1;
+			s1 = s0;
+			s0 = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(sample), _mm256_mul_ps(c, s1)), s2);
+
+			power += sample < 0 ? -sample : sample;
+			bits |= (uint64_t) !(sample >= 0) << i;
+		}
+
+		signs[base / 64] = bits;
+	}
+
+	_mm256_storeu_ps(current, s0);
+	_mm256_storeu_ps(old, s1);
+	return power;
+}
+
+#endif
+
+static const struct {
+	const char * name;
+	goertzel_kernel_t kernel;
+	goertzel_scan_t scan;
+	size_t lanes;
+} engines[] = {
+	[GOERTZEL_ENGINE_SCALAR] = { "scalar", kernel_scalar, scan_scalar, 4 },
+#ifdef GOERTZEL_X86
+	[GOERTZEL_ENGINE_SSE] = { "sse", kernel_sse, scan_sse, 4 },
+	[GOERTZEL_ENGINE_AVX] = { "avx", kernel_avx, scan_avx, 8 },
+#else
+	[GOERTZEL_ENGINE_SSE] = { "sse", NULL, NULL, 4 },
+	[GOERTZEL_ENGINE_AVX] = { "avx", NULL, NULL, 8 },
+#endif
+};
+
+static bool engine_supported(goertzel_engine_t engine) {
+	if (engines[engine].kernel == NULL) {
+		return false;
+	}
+
+#ifdef GOERTZEL_X86
+	switch (engine) {
+		case GOERTZEL_ENGINE_SSE:
+			return __builtin_cpu_supports("sse");
+		case GOERTZEL_ENGINE_AVX:
+			return __builtin_cpu_supports("avx");
+		default:
+			break;
+	}
+#endif
+
+	return true;
+}
+
+static size_t lane_count(size_t freq_count) {
+	return (freq_count + MAX_LANES - 1) / MAX_LANES * MAX_LANES;
+}
+
+size_t goertzel_sizeof(size_t freq_count) {
+	size_t lanes = lane_count(freq_count);
+
+	struct arena a = { NULL, 0 };
+	arena_alloc(&a, sizeof(struct goertzel));
+	arena_alloc(&a, lanes * sizeof(float));
+	arena_alloc(&a, lanes * sizeof(float));
+	arena_alloc(&a, lanes * sizeof(float));
+	arena_alloc(&a, lanes * sizeof(float));
+	arena_alloc(&a, lanes * sizeof(int32_t));
+	arena_alloc(&a, lanes * sizeof(int32_t));
+	arena_alloc(&a, lanes * sizeof(int32_t));
+	arena_alloc(&a, lanes * sizeof(int32_t));
+	return a.used;
+}
+
 goertzel_t * goertzel_init(const float * frequencies, size_t freq_count, float sample_rate) {
-	/********************
-	 * malloc structure *
-	 ********************/
-	goertzel_t * g = malloc(sizeof(struct goertzel));
-	if (g == NULL) {
+	void * buffer = arena_malloc(goertzel_sizeof(freq_count));
+	if (buffer == NULL) {
 		return NULL;
 	}
 
+	goertzel_t * g = goertzel_init_in(buffer, frequencies, freq_count, sample_rate);
+	g->allocated = true;
+	return g;
+}
+
+goertzel_t * goertzel_init_in(void * buffer, const float * frequencies, size_t freq_count, float sample_rate) {
+	/*********************
+	 * lay out structure *
+	 *********************/
+	memset(buffer, 0, goertzel_sizeof(freq_count));
+
+	struct arena a = { buffer, 0 };
+	goertzel_t * g = arena_alloc(&a, sizeof(struct goertzel));
 	g->freq_count = freq_count;
+	g->lane_count = lane_count(freq_count);
+
+	g->coeffs = arena_alloc(&a, g->lane_count * sizeof(float));
+	g->sines = arena_alloc(&a, g->lane_count * sizeof(float));
+	g->current = arena_alloc(&a, g->lane_count * sizeof(float));
+	g->old = arena_alloc(&a, g->lane_count * sizeof(float));
+	g->coeffs_q23 = arena_alloc(&a, g->lane_count * sizeof(int32_t));
+	g->sines_q23 = arena_alloc(&a, g->lane_count * sizeof(int32_t));
+	g->current_q = arena_alloc(&a, g->lane_count * sizeof(int32_t));
+	g->old_q = arena_alloc(&a, g->lane_count * sizeof(int32_t));
 
 	/**************************
 	 * calculate coefficients *
 	 **************************/
-	g->coeffs = malloc(sizeof(float) * freq_count);
-	if (g->coeffs == NULL) {
-		goertzel_free(g);
-		return NULL;
+	for (size_t i = 0; i < freq_count; i++) {
+		double cosine = cos(2 * PI * frequencies[i] / sample_rate);
+		double sine = sin(2 * PI * frequencies[i] / sample_rate);
+		g->coeffs[i] = 2 * cosine;
+		g->sines[i] = sine;
+
+		g->coeffs_q23[i] = lround(cosine * 8388608);
+		g->sines_q23[i] = lround(sine * 8388608);
 	}
 
-	for (size_t i = 0; i < freq_count; i++) {
-		g->coeffs[i] = 2 * cos(2 * PI * frequencies[i] / sample_rate);
+	/*****************
+	 * select engine *
+	 *****************/
+	// AVX only pays off if it fills more than a single SSE register
+	if (freq_count > 4 && goertzel_set_engine(g, GOERTZEL_ENGINE_AVX)) {
+		return g;
 	}
-	
+
+	if (goertzel_set_engine(g, GOERTZEL_ENGINE_SSE)) {
+		return g;
+	}
+
+	goertzel_set_engine(g, GOERTZEL_ENGINE_SCALAR);
 	return g;
 }
 
+bool goertzel_set_engine(goertzel_t * g, goertzel_engine_t engine) {
+	if (!engine_supported(engine)) {
+		return false;
+	}
+
+	g->engine = engine;
+	g->kernel = engines[engine].kernel;
+	g->scan = engines[engine].scan;
+	return true;
+}
+
+const char * goertzel_engine_name(goertzel_t * g) {
+	return engines[g->engine].name;
+}
+
+void goertzel_reset(goertzel_t * g) {
+	memset(g->current, 0, sizeof(float) * g->lane_count);
+	memset(g->old, 0, sizeof(float) * g->lane_count);
+	memset(g->current_q, 0, sizeof(int32_t) * g->lane_count);
+	memset(g->old_q, 0, sizeof(int32_t) * g->lane_count);
+}
+
+void goertzel_feed(goertzel_t * g, const float * samples, size_t sample_count) {
+	// Only run as many lanes as needed by the frequencies
+	size_t lanes = engines[g->engine].lanes;
+	size_t lane_count = (g->freq_count + lanes - 1) / lanes * lanes;
+
+	g->kernel(g->coeffs, lane_count, samples, sample_count, g->current, g->old);
+}
+
+void goertzel_feed_s16(goertzel_t * g, const int16_t * samples, size_t sample_count) {
+	size_t lane_count = (g->freq_count + 3) / 4 * 4;
+
+	kernel_s16(g->coeffs_q23, lane_count, samples, sample_count, g->current_q, g->old_q);
+}
+
+float goertzel_scan(goertzel_t * g, const float * samples, size_t sample_count, uint64_t * signs) {
+	size_t lanes = engines[g->engine].lanes;
+	size_t lane_count = (g->freq_count + lanes - 1) / lanes * lanes;
+	if (lane_count <= MAX_LANES) {
+		return g->scan(g->coeffs, lane_count, samples, sample_count, g->current, g->old, signs);
+	}
+
+	// Too many frequencies to keep in registers, so go over the samples twice
+	g->kernel(g->coeffs, lane_count, samples, sample_count, g->current, g->old);
+	return scan_scalar(g->coeffs, 0, samples, sample_count, g->current, g->old, signs);
+}
+
+int64_t goertzel_scan_s16(goertzel_t * g, const int16_t * samples, size_t sample_count, uint64_t * signs) {
+	size_t lane_count = (g->freq_count + 3) / 4 * 4;
+	if (lane_count <= MAX_LANES) {
+		return scan_s16(g->coeffs_q23, lane_count, samples, sample_count, g->current_q, g->old_q, signs);
+	}
+
+	kernel_s16(g->coeffs_q23, lane_count, samples, sample_count, g->current_q, g->old_q);
+	return scan_s16(g->coeffs_q23, 0, samples, sample_count, g->current_q, g->old_q, signs);
+}
+
+void goertzel_dft(goertzel_t * g, float * real, float * imag) {
+	for (size_t freq = 0; freq < g->freq_count; freq++) {
+		float current = g->current[freq], old = g->old[freq];
+		real[freq] = current - old * g->coeffs[freq] / 2;
+		imag[freq] = old * g->sines[freq];
+	}
+}
+
+void goertzel_dft_s16(goertzel_t * g, float * real, float * imag) {
+	for (size_t freq = 0; freq < g->freq_count; freq++) {
+		int64_t current = g->current_q[freq], old = g->old_q[freq];
+		real[freq] = (current - ((old * g->coeffs_q23[freq]) >> 23)) / 32768.0f;
+		imag[freq] = ((old * g->sines_q23[freq]) >> 23) / 32768.0f;
+	}
+}
+
+/**
+ * Integer square root, rounded down. Takes one branchless step per two bits
+ * of the input.
+ */
+static uint32_t isqrt64(uint64_t x) {
+	uint64_t bit = (uint64_t) 1 << 62;
+	while (bit > x) {
+		bit >>= 2;
+	}
+
+	uint64_t root = 0;
+	for (; bit != 0; bit >>= 2) {
+		uint64_t trial = root + bit;
+		uint64_t taken = -(uint64_t) (x >= trial);
+		x -= trial & taken;
+		root = (root >> 1) + (bit & taken);
+	}
+	return root;
+}
+
 void goertzel_magnitude(goertzel_t * g, const float * samples, size_t sample_count, float * magnitude) {
-	float * coeffs = g->coeffs;
+	memset(g->current, 0, sizeof(float) * g->lane_count);
+	memset(g->old, 0, sizeof(float) * g->lane_count);
+	goertzel_feed(g, samples, sample_count);
 
 	for (size_t freq = 0; freq < g->freq_count; freq++) {
-		float reallyold, old = 0, current = 0;
+		float current = g->current[freq], old = g->old[freq];
+		magnitude[freq] = sqrt(current * current + old * old - current * old * g->coeffs[freq]);
+	}
+}
 
-		for (size_t sample = 0; sample < sample_count; sample++) {
-			reallyold = old;
-			old = current;
-			current = samples[sample] + coeffs[freq] * old - reallyold;
+void goertzel_magnitude_s16(goertzel_t * g, const int16_t * samples, size_t sample_count, float * magnitude) {
+	memset(g->current_q, 0, sizeof(int32_t) * g->lane_count);
+	memset(g->old_q, 0, sizeof(int32_t) * g->lane_count);
+	goertzel_feed_s16(g, samples, sample_count);
+
+	for (size_t freq = 0; freq < g->freq_count; freq++) {
+		int64_t current = g->current_q[freq], old = g->old_q[freq];
+
+		// Halve resonators in the top bit of their range, so the sum of
+		// their squares fits in 64 bits
+		int shift = 0;
+		if (llabs(current) >= 1 << 30 || llabs(old) >= 1 << 30) {
+			current /= 2;
+			old /= 2;
+			shift = 1;
 		}
 
-		magnitude[freq] = sqrt(current * current + old * old - current * old * coeffs[freq]);
+		int64_t power = current * current + old * old - ((current * old) >> 22) * g->coeffs_q23[freq];
+		magnitude[freq] = (float) ((uint64_t) isqrt64(power > 0 ? power : 0) << shift) / 32768;
 	}
 }
 
@@ -59,6 +563,7 @@ void goertzel_free(goertzel_t * g) {
 		return;
 	}
 
-	free(g->coeffs);
-	free(g);
+	if (g->allocated) {
+		free(g);
+	}
 }
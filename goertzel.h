@@ -1,12 +1,33 @@
 
 #pragma once
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 typedef struct goertzel goertzel_t;
 
+typedef enum {
+	/**
+	 * Portable C implementation
+	 */
+	GOERTZEL_ENGINE_SCALAR,
+
+	/**
+	 * x86 SSE, four frequencies per register
+	 */
+	GOERTZEL_ENGINE_SSE,
+
+	/**
+	 * x86 AVX, eight frequencies per register
+	 */
+	GOERTZEL_ENGINE_AVX
+} goertzel_engine_t;
+
 /**
  * Initializes a new Goertzel filter, precalculating the coefficients for the given frequencies.
  *
+ * The fastest engine supported by the running CPU is selected automatically.
+ *
  * @param frequencies Frequency array
  * @param freq_count Number of frequencies in array
  * @param sample_rate Input sample rate
@@ -14,6 +35,44 @@ typedef struct goertzel goertzel_t;
  */
 goertzel_t * goertzel_init(const float * frequencies, size_t freq_count, float sample_rate);
 
+/**
+ * Returns the size of the buffer needed by {@code goertzel_init_in}.
+ *
+ * @param freq_count Number of frequencies
+ * @returns size in bytes
+ */
+size_t goertzel_sizeof(size_t freq_count);
+
+/**
+ * Initializes a Goertzel filter like {@code goertzel_init}, laying it out in
+ * a buffer provided by the caller instead of allocating it. The buffer must be
+ * aligned to 64 bytes, and freed by the caller after {@code goertzel_free}.
+ *
+ * @param buffer Buffer, at least {@code goertzel_sizeof} bytes long
+ * @param frequencies Frequency array
+ * @param freq_count Number of frequencies in array
+ * @param sample_rate Input sample rate
+ * @returns Goertzel filter, at the start of the buffer
+ */
+goertzel_t * goertzel_init_in(void * buffer, const float * frequencies, size_t freq_count, float sample_rate);
+
+/**
+ * Forces the use of a given engine.
+ *
+ * @param g Goertzel filter
+ * @param engine Engine
+ * @returns true on success, false if the engine is not supported by this CPU
+ */
+bool goertzel_set_engine(goertzel_t * g, goertzel_engine_t engine);
+
+/**
+ * Returns the name of the engine in use.
+ *
+ * @param g Goertzel filter
+ * @returns Engine name
+ */
+const char * goertzel_engine_name(goertzel_t * g);
+
 /**
  * Calculates the relative Goertzel magnitude for given samples.
  *
@@ -25,7 +84,104 @@ goertzel_t * goertzel_init(const float * frequencies, size_t freq_count, float s
 void goertzel_magnitude(goertzel_t * g, const float * samples, size_t sample_count, float * magnitude);
 
 /**
- * Destroys a Goertzel filter. Accepts NULL.
+ * Calculates the relative Goertzel magnitude for signed 16-bit samples, using
+ * Q23 coefficients and 32-bit resonators. Results are scaled as if samples
+ * had been divided by 32768, so they match goertzel_magnitude.
+ *
+ * Everything up to the magnitudes runs on 32-bit integers, but for the
+ * widening multiply by the coefficients, so CPUs without an FPU only convert
+ * each final magnitude to float. A full-scale tone at w radians per sample
+ * overflows the resonators after 131072 * sin(w) samples, which is over ten
+ * thousand samples for 1300Hz up to 96kHz.
+ *
+ * @param g Goertzel filter
+ * @param samples Input samples
+ * @param sample_count Number of samples in input
+ * @param magnitude Calculated relative magnitudes, not squared
+ */
+void goertzel_magnitude_s16(goertzel_t * g, const int16_t * samples, size_t sample_count, float * magnitude);
+
+/**
+ * Clears the resonators before feeding a new block of samples with
+ * {@code goertzel_feed} or {@code goertzel_feed_s16}.
+ *
+ * @param g Goertzel filter
+ */
+void goertzel_reset(goertzel_t * g);
+
+/**
+ * Advances the resonators over more samples of the current block. A block may
+ * be fed in as many pieces as needed.
+ *
+ * @param g Goertzel filter
+ * @param samples Input samples
+ * @param sample_count Number of samples in input
+ */
+void goertzel_feed(goertzel_t * g, const float * samples, size_t sample_count);
+
+/**
+ * Same as {@code goertzel_feed}, for signed 16-bit samples, which are scaled
+ * as if divided by 32768. The same length limit as in
+ * {@code goertzel_magnitude_s16} applies to the whole block.
+ *
+ * @param g Goertzel filter
+ * @param samples Input samples
+ * @param sample_count Number of samples in input
+ */
+void goertzel_feed_s16(goertzel_t * g, const int16_t * samples, size_t sample_count);
+
+/**
+ * Same as {@code goertzel_feed}, going over the samples only once to also
+ * measure their power and pack their signs for the BFSK demodulator. Up to
+ * eight frequencies are filtered in that same pass.
+ *
+ * @param g Goertzel filter
+ * @param samples Input samples
+ * @param sample_count Number of samples in input
+ * @param signs Sign of each sample, set if negative, from bit 0 of the first
+ *   word on. Must hold a bit for every sample, rounded up to whole words.
+ * @returns sum of the absolute values of the samples
+ */
+float goertzel_scan(goertzel_t * g, const float * samples, size_t sample_count, uint64_t * signs);
+
+/**
+ * Same as {@code goertzel_scan}, for signed 16-bit samples, see
+ * {@code goertzel_feed_s16}.
+ *
+ * @param g Goertzel filter
+ * @param samples Input samples
+ * @param sample_count Number of samples in input
+ * @param signs Sign of each sample, as in {@code goertzel_scan}
+ * @returns sum of the absolute values of the samples, unscaled
+ */
+int64_t goertzel_scan_s16(goertzel_t * g, const int16_t * samples, size_t sample_count, uint64_t * signs);
+
+/**
+ * Calculates the complex DFT of each frequency over the samples fed since the
+ * last reset. Phases are referred to the last sample fed, so the DFTs of
+ * consecutive blocks can be added up after rotating each one by its delay
+ * times the frequency in radians per sample.
+ *
+ * @param g Goertzel filter
+ * @param real Real part of each frequency
+ * @param imag Imaginary part of each frequency
+ */
+void goertzel_dft(goertzel_t * g, float * real, float * imag);
+
+/**
+ * Same as {@code goertzel_dft}, over the 16-bit samples fed since the last
+ * reset. The DFT is calculated in integer arithmetic, and only converted to
+ * float at the end, scaled as if samples had been divided by 32768.
+ *
+ * @param g Goertzel filter
+ * @param real Real part of each frequency
+ * @param imag Imaginary part of each frequency
+ */
+void goertzel_dft_s16(goertzel_t * g, float * real, float * imag);
+
+/**
+ * Destroys a Goertzel filter. Accepts NULL, and filters in a caller's buffer,
+ * which is not freed.
  *
  * @param g Goertzel filter
  */
@@ -0,0 +1,771 @@
+#include "input.h"
+#include <pulse/error.h>
+#include <pulse/sample.h>
+#include <pulse/simple.h>
+#include <pulse/stream.h>
+#include <pulse/thread-mainloop.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _WIN32
+#	include <fcntl.h>
+#	include <io.h>
+#endif
+
+struct input {
+	int sample_rate;
+	int channels;
+
+	/**
+	 * Backend read callback, returning interleaved frames in {@code frames}
+	 */
+	ssize_t (*read)(input_t * in, size_t frame_count);
+
+	/**
+	 * Backend read callback writing straight into the channel buffers, used
+	 * instead of {@code read} if set
+	 */
+	ssize_t (*read_direct)(input_t * in, void ** channels, input_sample_t type, size_t frame_count);
+
+	/**
+	 * Backend cleanup callback
+	 */
+	void (*close)(input_t * in);
+
+	/**
+	 * PulseAudio backend
+	 */
+	pa_simple * pulse;
+
+	/**
+	 * Asynchronous PulseAudio backend. Fragments are read in place from the
+	 * stream, and {@code fragment_offset} bytes of the current one have been
+	 * consumed already.
+	 */
+	pa_threaded_mainloop * mainloop;
+	pa_context * context;
+	pa_stream * stream;
+	size_t fragment_offset;
+
+	/**
+	 * Interleaved frame buffer, split into channels after each read. Samples
+	 * are kept in the backend's own type, and only converted while splitting.
+	 */
+	void * frames;
+	size_t frames_size;
+	input_sample_t frame_type;
+
+	/**
+	 * File backend: stream, sample format after resolving the WAV header, and
+	 * byte buffer used to convert samples to floats.
+	 */
+	FILE * file;
+	input_format_t format;
+	unsigned char * raw;
+	size_t raw_size;
+
+	/**
+	 * Remaining data bytes in WAV file, or SIZE_MAX if unbounded
+	 */
+	size_t remaining;
+
+	/**
+	 * Monotonic time at which the last sample read was captured, in
+	 * nanoseconds, or -1 if unknown
+	 */
+	int64_t capture_time;
+};
+
+static size_t sample_size(input_sample_t type) {
+	return type == INPUT_SAMPLE_S16 ? sizeof(int16_t) : sizeof(float);
+}
+
+static int16_t float_to_s16(float sample) {
+	float scaled = sample * 32768.0f;
+	if (scaled >= 32767.0f) {
+		return 32767;
+	} else if (scaled <= -32768.0f) {
+		return -32768;
+	}
+	return lrintf(scaled);
+}
+
+/**
+ * Splits interleaved frames into one buffer per channel, converting samples
+ * between types if needed.
+ */
+static void deinterleave(const void * frames, input_sample_t from, int channel_count, void ** channels, input_sample_t to, size_t offset, size_t frame_count) {
+	for (int c = 0; c < channel_count; c++) {
+		if (from == INPUT_SAMPLE_FLOAT && to == INPUT_SAMPLE_FLOAT) {
+			const float * src = (const float *) frames + c;
+			float * dst = (float *) channels[c] + offset;
+			for (size_t i = 0; i < frame_count; i++) {
+				dst[i] = src[i * channel_count];
+			}
+		} else if (from == INPUT_SAMPLE_S16 && to == INPUT_SAMPLE_S16) {
+			const int16_t * src = (const int16_t *) frames + c;
+			int16_t * dst = (int16_t *) channels[c] + offset;
+			for (size_t i = 0; i < frame_count; i++) {
+				dst[i] = src[i * channel_count];
+			}
+		} else if (from == INPUT_SAMPLE_S16) {
+			const int16_t * src = (const int16_t *) frames + c;
+			float * dst = (float *) channels[c] + offset;
+			for (size_t i = 0; i < frame_count; i++) {
+				dst[i] = src[i * channel_count] / 32768.0f;
+			}
+		} else {
+			const float * src = (const float *) frames + c;
+			int16_t * dst = (int16_t *) channels[c] + offset;
+			for (size_t i = 0; i < frame_count; i++) {
+				dst[i] = float_to_s16(src[i * channel_count]);
+			}
+		}
+	}
+}
+
+static pa_sample_format_t pulse_format(input_sample_t type) {
+	return type == INPUT_SAMPLE_S16 ? PA_SAMPLE_S16LE : PA_SAMPLE_FLOAT32LE;
+}
+
+static input_t * input_alloc(void) {
+	input_t * in = calloc(1, sizeof(struct input));
+	if (in == NULL) {
+		fprintf(stderr, "Error: could not allocate input\n");
+		return NULL;
+	}
+
+	in->capture_time = -1;
+	return in;
+}
+
+/**
+ * Stores the capture time of the last sample read, given how long ago it was
+ * captured according to the server.
+ */
+static void set_capture_time(input_t * in, pa_usec_t latency) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	in->capture_time = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec - (int64_t) latency * 1000;
+}
+
+/**********************
+ * PulseAudio backend *
+ **********************/
+
+static ssize_t pulse_read(input_t * in, size_t frame_count) {
+	int pa_error;
+	if (pa_simple_read(in->pulse, in->frames, frame_count * in->channels * sample_size(in->frame_type), &pa_error) < 0) {
+		fprintf(stderr, "Error: pa_simple_read() failed: %s\n", pa_strerror(pa_error));
+		return -1;
+	}
+
+	// The latency covers the audio still buffered after the samples just read
+	pa_usec_t latency = pa_simple_get_latency(in->pulse, &pa_error);
+	if (latency != (pa_usec_t) -1) {
+		set_capture_time(in, latency);
+	}
+
+	return frame_count;
+}
+
+static void pulse_close(input_t * in) {
+	if (in->pulse) {
+		pa_simple_free(in->pulse);
+	}
+}
+
+input_t * input_open_pulse(const char * app_name, const char * source_name, int sample_rate, int channels, input_sample_t sample_type) {
+	input_t * in = input_alloc();
+	if (in == NULL) {
+		return NULL;
+	}
+
+	in->sample_rate = sample_rate;
+	in->channels = channels;
+	in->read = pulse_read;
+	in->close = pulse_close;
+	in->frame_type = sample_type;
+
+	int pa_error;
+	pa_sample_spec pa_spec = {
+		.format = pulse_format(sample_type),
+		.rate = sample_rate,
+		.channels = channels
+	};
+	in->pulse = pa_simple_new(NULL, app_name, PA_STREAM_RECORD, source_name, "uicterm", &pa_spec, NULL, NULL, &pa_error);
+	if (!in->pulse) {
+		fprintf(stderr, "Error: pa_simple_new() failed: %s\n", pa_strerror(pa_error));
+		input_free(in);
+		return NULL;
+	}
+
+	return in;
+}
+
+/***********************************
+ * Asynchronous PulseAudio backend *
+ ***********************************/
+
+// Fragments the server may buffer before dropping audio
+#define PULSE_MAX_FRAGMENTS 8
+
+/**
+ * Wakes up the reader on any context or stream change, and on new data
+ */
+static void pulse_async_notify(void * userdata) {
+	input_t * in = userdata;
+	pa_threaded_mainloop_signal(in->mainloop, 0);
+}
+
+static void pulse_async_context_cb(pa_context * c, void * userdata) {
+	pulse_async_notify(userdata);
+}
+
+static void pulse_async_stream_cb(pa_stream * s, void * userdata) {
+	pulse_async_notify(userdata);
+}
+
+static void pulse_async_read_cb(pa_stream * s, size_t nbytes, void * userdata) {
+	pulse_async_notify(userdata);
+}
+
+static ssize_t pulse_async_read(input_t * in, void ** channels, input_sample_t type, size_t frame_count) {
+	size_t frame_size = in->channels * sample_size(in->frame_type);
+	size_t frames_read = 0;
+
+	pa_threaded_mainloop_lock(in->mainloop);
+	while (frames_read < frame_count) {
+		const void * data;
+		size_t nbytes;
+		if (pa_stream_peek(in->stream, &data, &nbytes) < 0) {
+			fprintf(stderr, "Error: pa_stream_peek() failed: %s\n", pa_strerror(pa_context_errno(in->context)));
+			pa_threaded_mainloop_unlock(in->mainloop);
+			return -1;
+		}
+
+		if (nbytes == 0) {
+			if (!PA_STREAM_IS_GOOD(pa_stream_get_state(in->stream))) {
+				fprintf(stderr, "Error: PulseAudio stream failed: %s\n", pa_strerror(pa_context_errno(in->context)));
+				pa_threaded_mainloop_unlock(in->mainloop);
+				return -1;
+			}
+
+			pa_threaded_mainloop_wait(in->mainloop);
+			continue;
+		}
+
+		// Holes are audio lost by the server - skip them
+		if (data == NULL) {
+			pa_stream_drop(in->stream);
+			continue;
+		}
+
+		size_t available = (nbytes - in->fragment_offset) / frame_size;
+		if (available > frame_count - frames_read) {
+			available = frame_count - frames_read;
+		}
+
+		const void * frames = (const char *) data + in->fragment_offset;
+		deinterleave(frames, in->frame_type, in->channels, channels, type, frames_read, available);
+		frames_read += available;
+		in->fragment_offset += available * frame_size;
+
+		// Fragments can only be released as a whole
+		if (in->fragment_offset + frame_size > nbytes) {
+			pa_stream_drop(in->stream);
+			in->fragment_offset = 0;
+		}
+	}
+
+	// The latency still counts the part of the fragment read but not dropped yet
+	pa_usec_t latency;
+	int negative;
+	if (pa_stream_get_latency(in->stream, &latency, &negative) == 0) {
+		pa_usec_t consumed = (pa_usec_t) (in->fragment_offset / frame_size) * 1000000 / in->sample_rate;
+		set_capture_time(in, negative || latency < consumed ? 0 : latency - consumed);
+	}
+	pa_threaded_mainloop_unlock(in->mainloop);
+
+	return frames_read;
+}
+
+static void pulse_async_close(input_t * in) {
+	if (in->mainloop) {
+		pa_threaded_mainloop_stop(in->mainloop);
+	}
+
+	if (in->stream) {
+		pa_stream_disconnect(in->stream);
+		pa_stream_unref(in->stream);
+	}
+
+	if (in->context) {
+		pa_context_disconnect(in->context);
+		pa_context_unref(in->context);
+	}
+
+	if (in->mainloop) {
+		pa_threaded_mainloop_free(in->mainloop);
+	}
+}
+
+/**
+ * Connects the context and the recording stream. Must be called with the
+ * mainloop lock held.
+ */
+static bool pulse_async_connect(input_t * in, const char * app_name, const char * source_name, const pa_sample_spec * spec, int fragment_millis) {
+	in->context = pa_context_new(pa_threaded_mainloop_get_api(in->mainloop), app_name);
+	if (in->context == NULL) {
+		fprintf(stderr, "Error: pa_context_new() failed\n");
+		return false;
+	}
+
+	pa_context_set_state_callback(in->context, pulse_async_context_cb, in);
+	if (pa_context_connect(in->context, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
+		fprintf(stderr, "Error: pa_context_connect() failed: %s\n", pa_strerror(pa_context_errno(in->context)));
+		return false;
+	}
+
+	pa_context_state_t context_state;
+	while ((context_state = pa_context_get_state(in->context)) != PA_CONTEXT_READY) {
+		if (!PA_CONTEXT_IS_GOOD(context_state)) {
+			fprintf(stderr, "Error: could not connect to PulseAudio: %s\n", pa_strerror(pa_context_errno(in->context)));
+			return false;
+		}
+		pa_threaded_mainloop_wait(in->mainloop);
+	}
+
+	in->stream = pa_stream_new(in->context, "uicterm", spec, NULL);
+	if (in->stream == NULL) {
+		fprintf(stderr, "Error: pa_stream_new() failed: %s\n", pa_strerror(pa_context_errno(in->context)));
+		return false;
+	}
+
+	pa_stream_set_state_callback(in->stream, pulse_async_stream_cb, in);
+	pa_stream_set_read_callback(in->stream, pulse_async_read_cb, in);
+
+	// Ask the server to deliver a fragment as soon as it is filled, instead
+	// of buffering as much as it likes
+	uint32_t fragsize = pa_usec_to_bytes((pa_usec_t) fragment_millis * 1000, spec);
+	pa_buffer_attr attr = {
+		.maxlength = fragsize * PULSE_MAX_FRAGMENTS,
+		.tlength = (uint32_t) -1,
+		.prebuf = (uint32_t) -1,
+		.minreq = (uint32_t) -1,
+		.fragsize = fragsize
+	};
+
+	if (pa_stream_connect_record(in->stream, source_name, &attr, PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE) < 0) {
+		fprintf(stderr, "Error: pa_stream_connect_record() failed: %s\n", pa_strerror(pa_context_errno(in->context)));
+		return false;
+	}
+
+	pa_stream_state_t stream_state;
+	while ((stream_state = pa_stream_get_state(in->stream)) != PA_STREAM_READY) {
+		if (!PA_STREAM_IS_GOOD(stream_state)) {
+			fprintf(stderr, "Error: could not open PulseAudio source: %s\n", pa_strerror(pa_context_errno(in->context)));
+			return false;
+		}
+		pa_threaded_mainloop_wait(in->mainloop);
+	}
+
+	return true;
+}
+
+input_t * input_open_pulse_async(const char * app_name, const char * source_name, int sample_rate, int channels, input_sample_t sample_type, int fragment_millis) {
+	input_t * in = input_alloc();
+	if (in == NULL) {
+		return NULL;
+	}
+
+	in->sample_rate = sample_rate;
+	in->channels = channels;
+	in->read_direct = pulse_async_read;
+	in->close = pulse_async_close;
+	in->frame_type = sample_type;
+
+	pa_sample_spec pa_spec = {
+		.format = pulse_format(sample_type),
+		.rate = sample_rate,
+		.channels = channels
+	};
+
+	in->mainloop = pa_threaded_mainloop_new();
+	if (in->mainloop == NULL) {
+		fprintf(stderr, "Error: pa_threaded_mainloop_new() failed\n");
+		input_free(in);
+		return NULL;
+	}
+
+	if (pa_threaded_mainloop_start(in->mainloop) < 0) {
+		fprintf(stderr, "Error: pa_threaded_mainloop_start() failed\n");
+		pa_threaded_mainloop_free(in->mainloop);
+		in->mainloop = NULL;
+		input_free(in);
+		return NULL;
+	}
+
+	pa_threaded_mainloop_lock(in->mainloop);
+	bool connected = pulse_async_connect(in, app_name, source_name, &pa_spec, fragment_millis);
+	pa_threaded_mainloop_unlock(in->mainloop);
+
+	if (!connected) {
+		input_free(in);
+		return NULL;
+	}
+
+	return in;
+}
+
+/****************
+ * File backend *
+ ****************/
+
+static size_t format_sample_size(input_format_t format) {
+	if (format == INPUT_FORMAT_CU8) {
+		return 1;
+	}
+	return format == INPUT_FORMAT_S16 ? 2 : 4;
+}
+
+static bool format_is_iq(input_format_t format) {
+	return format == INPUT_FORMAT_CU8 || format == INPUT_FORMAT_CF32;
+}
+
+/**
+ * Returns whether a file name ends in the given extension.
+ */
+static bool has_extension(const char * path, const char * extension) {
+	size_t len = path ? strlen(path) : 0;
+	size_t ext_len = strlen(extension);
+	return len >= ext_len && !strcmp(path + len - ext_len, extension);
+}
+
+static uint32_t read_le(const unsigned char * p, int bytes) {
+	uint32_t v = 0;
+	for (int i = bytes - 1; i >= 0; i--) {
+		v = v << 8 | p[i];
+	}
+	return v;
+}
+
+static bool read_exact(FILE * f, void * buf, size_t len) {
+	return fread(buf, 1, len, f) == len;
+}
+
+static bool skip_bytes(FILE * f, size_t len) {
+	unsigned char junk[256];
+	while (len > 0) {
+		size_t chunk = len < sizeof(junk) ? len : sizeof(junk);
+		if (!read_exact(f, junk, chunk)) {
+			return false;
+		}
+		len -= chunk;
+	}
+	return true;
+}
+
+/**
+ * Parses the RIFF WAVE header up to the start of the data chunk. The file is
+ * read strictly sequentially so this also works on pipes.
+ */
+static bool wav_parse_header(input_t * in) {
+	unsigned char hdr[12];
+	if (!read_exact(in->file, hdr, 12) || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {
+		fprintf(stderr, "Error: input is not a RIFF WAVE file\n");
+		return false;
+	}
+
+	bool have_fmt = false;
+	while (1) {
+		unsigned char chunk[8];
+		if (!read_exact(in->file, chunk, 8)) {
+			fprintf(stderr, "Error: WAV file has no data chunk\n");
+			return false;
+		}
+
+		uint32_t chunk_size = read_le(chunk + 4, 4);
+
+		if (!memcmp(chunk, "fmt ", 4)) {
+			// Room for the extensible format fields, up to the subformat GUID
+			unsigned char fmt[40];
+			size_t fmt_size = chunk_size < sizeof(fmt) ? chunk_size : sizeof(fmt);
+			if (chunk_size < 16 || !read_exact(in->file, fmt, fmt_size) || !skip_bytes(in->file, chunk_size - fmt_size + (chunk_size & 1))) {
+				fprintf(stderr, "Error: truncated WAV format chunk\n");
+				return false;
+			}
+
+			unsigned int tag = read_le(fmt, 2);
+			unsigned int channels = read_le(fmt + 2, 2);
+			unsigned int bits = read_le(fmt + 14, 2);
+			in->sample_rate = read_le(fmt + 4, 4);
+
+			// Extensible format stores the real tag at the start of the subformat GUID
+			if (tag == 0xFFFE) {
+				if (fmt_size < 40 || read_le(fmt + 16, 2) < 22) {
+					fprintf(stderr, "Error: truncated WAV extensible format\n");
+					return false;
+				}
+				tag = read_le(fmt + 24, 2);
+			}
+
+			if (channels < 1) {
+				fprintf(stderr, "Error: WAV file has no channels\n");
+				return false;
+			}
+			in->channels = channels;
+
+			if (tag == 1 && bits == 16) {
+				in->format = INPUT_FORMAT_S16;
+			} else if (tag == 3 && bits == 32) {
+				in->format = INPUT_FORMAT_F32;
+			} else {
+				fprintf(stderr, "Error: unsupported WAV sample format (tag %u, %u bits)\n", tag, bits);
+				return false;
+			}
+
+			have_fmt = true;
+		} else if (!memcmp(chunk, "data", 4)) {
+			if (!have_fmt) {
+				fprintf(stderr, "Error: WAV data chunk before format chunk\n");
+				return false;
+			}
+
+			// Streaming writers leave the size at zero or all ones
+			in->remaining = (chunk_size == 0 || chunk_size == 0xFFFFFFFF) ? SIZE_MAX : chunk_size;
+			return true;
+		} else if (!skip_bytes(in->file, chunk_size + (chunk_size & 1))) {
+			fprintf(stderr, "Error: truncated WAV file\n");
+			return false;
+		}
+	}
+}
+
+/**
+ * Reads frames, converting them to the sample type of the file into the given
+ * buffer. IQ samples take two values each.
+ */
+static ssize_t file_read_into(input_t * in, void * out, size_t frame_count) {
+	size_t values = format_is_iq(in->format) ? 2 * in->channels : in->channels;
+	size_t frame_size = format_sample_size(in->format) * values;
+	size_t want = frame_count * frame_size;
+	if (want > in->remaining) {
+		want = in->remaining - in->remaining % frame_size;
+	}
+
+	if (want > in->raw_size) {
+		unsigned char * raw = realloc(in->raw, want);
+		if (raw == NULL) {
+			fprintf(stderr, "Error: could not allocate input buffer\n");
+			return -1;
+		}
+		in->raw = raw;
+		in->raw_size = want;
+	}
+
+	size_t got = 0;
+	while (got < want) {
+		size_t n = fread(in->raw + got, 1, want - got, in->file);
+		if (n == 0) {
+			if (ferror(in->file)) {
+				perror("Error: could not read input");
+				return -1;
+			}
+			break;
+		}
+		got += n;
+	}
+
+	if (in->remaining != SIZE_MAX) {
+		in->remaining -= got;
+	}
+
+	// A truncated trailing frame is dropped
+	size_t count = got / frame_size * values;
+	const unsigned char * p = in->raw;
+	if (in->format == INPUT_FORMAT_S16) {
+		int16_t * samples = out;
+		for (size_t i = 0; i < count; i++, p += 2) {
+			samples[i] = (int16_t) read_le(p, 2);
+		}
+	} else if (in->format == INPUT_FORMAT_CU8) {
+		float * samples = out;
+		for (size_t i = 0; i < count; i++, p++) {
+			samples[i] = (*p - 127.5f) / 127.5f;
+		}
+	} else {
+		float * samples = out;
+		for (size_t i = 0; i < count; i++, p += 4) {
+			uint32_t v = read_le(p, 4);
+			memcpy(&samples[i], &v, sizeof(float));
+		}
+	}
+
+	return count / values;
+}
+
+static ssize_t file_read(input_t * in, size_t frame_count) {
+	return file_read_into(in, in->frames, frame_count);
+}
+
+static void file_close(input_t * in) {
+	if (in->file && in->file != stdin) {
+		fclose(in->file);
+	}
+	free(in->raw);
+}
+
+input_t * input_open_file(const char * path, input_format_t format, int sample_rate, int channels) {
+	input_t * in = input_alloc();
+	if (in == NULL) {
+		return NULL;
+	}
+
+	in->sample_rate = sample_rate;
+	in->channels = channels;
+	in->read = file_read;
+	in->close = file_close;
+	in->remaining = SIZE_MAX;
+
+	if (format == INPUT_FORMAT_AUTO) {
+		if (has_extension(path, ".wav")) {
+			format = INPUT_FORMAT_WAV;
+		} else if (has_extension(path, ".cu8")) {
+			format = INPUT_FORMAT_CU8;
+		} else if (has_extension(path, ".cf32")) {
+			format = INPUT_FORMAT_CF32;
+		} else {
+			format = INPUT_FORMAT_F32;
+		}
+	}
+	in->format = format;
+
+	if (path == NULL || !strcmp(path, "-")) {
+		#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+		#endif
+		in->file = stdin;
+	} else {
+		in->file = fopen(path, "rb");
+		if (in->file == NULL) {
+			fprintf(stderr, "Error: could not open \"%s\": ", path);
+			perror(NULL);
+			input_free(in);
+			return NULL;
+		}
+	}
+
+	if (format == INPUT_FORMAT_WAV && !wav_parse_header(in)) {
+		input_free(in);
+		return NULL;
+	}
+
+	in->frame_type = in->format == INPUT_FORMAT_S16 ? INPUT_SAMPLE_S16 : INPUT_SAMPLE_FLOAT;
+	return in;
+}
+
+/**********
+ * Common *
+ **********/
+
+int input_parse_format(const char * name, input_format_t * format) {
+	static const struct {
+		const char * name;
+		input_format_t format;
+	} names[] = {
+		{ "auto", INPUT_FORMAT_AUTO },
+		{ "f32", INPUT_FORMAT_F32 },
+		{ "s16", INPUT_FORMAT_S16 },
+		{ "wav", INPUT_FORMAT_WAV },
+		{ "cu8", INPUT_FORMAT_CU8 },
+		{ "cf32", INPUT_FORMAT_CF32 }
+	};
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (!strcmp(name, names[i].name)) {
+			*format = names[i].format;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+int input_sample_rate(input_t * in) {
+	return in->sample_rate;
+}
+
+int input_channels(input_t * in) {
+	return in->channels;
+}
+
+bool input_is_iq(input_t * in) {
+	return format_is_iq(in->format);
+}
+
+static ssize_t read_channels(input_t * in, void ** channels, input_sample_t type, size_t frame_count) {
+	if (input_is_iq(in)) {
+		fprintf(stderr, "Error: IQ samples must be demodulated before decoding\n");
+		return -1;
+	}
+
+	if (in->read_direct) {
+		return in->read_direct(in, channels, type, frame_count);
+	}
+
+	size_t needed = frame_count * in->channels * sample_size(in->frame_type);
+	if (needed > in->frames_size) {
+		void * frames = realloc(in->frames, needed);
+		if (frames == NULL) {
+			fprintf(stderr, "Error: could not allocate buffer for %u frames\n", (unsigned int) frame_count);
+			return -1;
+		}
+		in->frames = frames;
+		in->frames_size = needed;
+	}
+
+	ssize_t frames_read = in->read(in, frame_count);
+	if (frames_read <= 0) {
+		return frames_read;
+	}
+
+	deinterleave(in->frames, in->frame_type, in->channels, channels, type, 0, frames_read);
+	return frames_read;
+}
+
+ssize_t input_read(input_t * in, float ** channels, size_t frame_count) {
+	return read_channels(in, (void **) channels, INPUT_SAMPLE_FLOAT, frame_count);
+}
+
+ssize_t input_read_s16(input_t * in, int16_t ** channels, size_t frame_count) {
+	return read_channels(in, (void **) channels, INPUT_SAMPLE_S16, frame_count);
+}
+
+ssize_t input_read_iq(input_t * in, float * iq, size_t frame_count) {
+	if (!input_is_iq(in)) {
+		fprintf(stderr, "Error: input does not have IQ samples\n");
+		return -1;
+	}
+
+	return file_read_into(in, iq, frame_count);
+}
+
+int64_t input_capture_time(input_t * in) {
+	return in->capture_time;
+}
+
+void input_free(input_t * in) {
+	if (in == NULL) {
+		return;
+	}
+
+	in->close(in);
+	free(in->frames);
+	free(in);
+}
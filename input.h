@@ -0,0 +1,186 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct input input_t;
+
+typedef enum {
+	/**
+	 * Guess the format from the file name: WAV if it ends in ".wav", IQ if
+	 * it ends in ".cu8" or ".cf32", else raw 32-bit floats.
+	 */
+	INPUT_FORMAT_AUTO,
+
+	/**
+	 * Raw little-endian 32-bit float samples.
+	 */
+	INPUT_FORMAT_F32,
+
+	/**
+	 * Raw little-endian signed 16-bit samples.
+	 */
+	INPUT_FORMAT_S16,
+
+	/**
+	 * RIFF WAVE file, with either 16-bit PCM or 32-bit float samples.
+	 */
+	INPUT_FORMAT_WAV,
+
+	/**
+	 * Raw complex baseband samples, as interleaved unsigned 8-bit I and Q
+	 * centered at 127.5, as written by rtl_sdr.
+	 */
+	INPUT_FORMAT_CU8,
+
+	/**
+	 * Raw complex baseband samples, as interleaved little-endian 32-bit float
+	 * I and Q.
+	 */
+	INPUT_FORMAT_CF32
+} input_format_t;
+
+typedef enum {
+	/**
+	 * 32-bit floats, from -1 to 1.
+	 */
+	INPUT_SAMPLE_FLOAT,
+
+	/**
+	 * Signed 16-bit integers, for the fixed-point decoder.
+	 */
+	INPUT_SAMPLE_S16
+} input_sample_t;
+
+/**
+ * Opens a PulseAudio source for recording.
+ *
+ * @param app_name Application name reported to PulseAudio
+ * @param source_name Source name
+ * @param sample_rate Requested sample rate
+ * @param channels Requested number of channels
+ * @param sample_type Sample type to capture. Samples are converted if read
+ *                    as the other type.
+ * @returns New input, or NULL on error
+ */
+input_t * input_open_pulse(const char * app_name, const char * source_name, int sample_rate, int channels, input_sample_t sample_type);
+
+/**
+ * Opens a PulseAudio source for recording with low latency, using the
+ * asynchronous API on a background mainloop thread.
+ *
+ * The server is asked to deliver audio in fragments of the given length as
+ * soon as each one is filled, and to hold only a few of them before dropping
+ * audio, so latency stays bounded. Samples are read in place from the stream
+ * fragments.
+ *
+ * @param app_name Application name reported to PulseAudio
+ * @param source_name Source name, or NULL for the default one
+ * @param sample_rate Requested sample rate
+ * @param channels Requested number of channels
+ * @param sample_type Sample type to capture. Samples are converted if read
+ *                    as the other type.
+ * @param fragment_millis Fragment length, in milliseconds
+ * @returns New input, or NULL on error
+ */
+input_t * input_open_pulse_async(const char * app_name, const char * source_name, int sample_rate, int channels, input_sample_t sample_type, int fragment_millis);
+
+/**
+ * Opens a file for reading samples as fast as they can be decoded.
+ *
+ * For raw formats the sample rate and channel count must be given by the
+ * caller, and multichannel samples are expected to be interleaved. For WAV
+ * files the values stored in the header are used instead.
+ *
+ * @param path File path, or NULL or "-" for standard input
+ * @param format Sample format
+ * @param sample_rate Sample rate for raw formats
+ * @param channels Number of channels for raw formats
+ * @returns New input, or NULL on error
+ */
+input_t * input_open_file(const char * path, input_format_t format, int sample_rate, int channels);
+
+/**
+ * Parses a format name as used in the command line.
+ *
+ * @param name Format name ("auto", "f32", "s16", "wav", "cu8" or "cf32")
+ * @param format Parsed format
+ * @returns 0 on success, -1 if the name is unknown
+ */
+int input_parse_format(const char * name, input_format_t * format);
+
+/**
+ * Returns the sample rate of the input.
+ *
+ * @param in Input
+ * @returns Sample rate
+ */
+int input_sample_rate(input_t * in);
+
+/**
+ * Returns the number of channels of the input.
+ *
+ * @param in Input
+ * @returns Channel count
+ */
+int input_channels(input_t * in);
+
+/**
+ * Returns whether the input has complex baseband samples, which can only be
+ * read with input_read_iq.
+ *
+ * @param in Input
+ * @returns true for IQ inputs
+ */
+bool input_is_iq(input_t * in);
+
+/**
+ * Reads samples, blocking until the buffers have been filled or the input has
+ * been exhausted. Each channel is written to its own buffer.
+ *
+ * @param in Input
+ * @param channels Output buffers, one per channel
+ * @param frame_count Number of samples to read per channel
+ * @returns number of samples read per channel, 0 at end of input, or -1 on error
+ */
+ssize_t input_read(input_t * in, float ** channels, size_t frame_count);
+
+/**
+ * Reads samples as signed 16-bit integers. Works like input_read, and is
+ * cheapest on 16-bit sources, where no conversion is needed.
+ *
+ * @param in Input
+ * @param channels Output buffers, one per channel
+ * @param frame_count Number of samples to read per channel
+ * @returns number of samples read per channel, 0 at end of input, or -1 on error
+ */
+ssize_t input_read_s16(input_t * in, int16_t ** channels, size_t frame_count);
+
+/**
+ * Reads complex baseband samples from an IQ input, as interleaved I and Q
+ * floats from -1 to 1. Works like input_read, for a single channel.
+ *
+ * @param in Input
+ * @param iq Output buffer, with room for twice the number of samples
+ * @param frame_count Number of samples to read
+ * @returns number of samples read, 0 at end of input, or -1 on error
+ */
+ssize_t input_read_iq(input_t * in, float * iq, size_t frame_count);
+
+/**
+ * Returns when the last sample read was captured, on CLOCK_MONOTONIC. Only
+ * known for PulseAudio sources, where it is corrected for the latency of
+ * the server, and not for files, which are not captured live.
+ *
+ * @param in Input
+ * @returns time in nanoseconds, or -1 if unknown
+ */
+int64_t input_capture_time(input_t * in);
+
+/**
+ * Closes an input. Accepts NULL.
+ *
+ * @param in Input
+ */
+void input_free(input_t * in);
@@ -1,78 +1,342 @@
-
 #include <assert.h>
-#include <pulse/error.h>
-#include <pulse/simple.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
+#include "channelizer.h"
+#include "fmdemod.h"
+#include "input.h"
+#include "metrics.h"
+#include "pool.h"
+#include "resample.h"
+#include "ring.h"
 #include "uicdemod.h"
 #include "telegram.h"
 #include "signal.h"
+#include "writer.h"
 
 #define DEFAULT_SAMPLE_RATE 16000
 #define DEFAULT_BUFFER_MILLIS 50
-#define DEFAULT_TICKS 2
+#define DEFAULT_TICKS 4
+#define DEFAULT_HOP_MILLIS 10
+#define DEFAULT_WINDOW_MILLIS 40
 #define DEFAULT_CERTAINTY 0.75
+#define DEFAULT_DECODE_RATE 12000
+#define DEFAULT_FM_DEVIATION 5000
+#define DEFAULT_DEEMPHASIS_MICROS 750
+#define DEFAULT_QUEUE_BUFFERS 16
+#define MAX_SOURCES 64
+#define GROUPS_PER_THREAD 4
+#define OUTPUT_BUFFER_SIZE 65536
 
-// From http://stackoverflow.com/a/7924459
-#ifdef _WIN32
-#	include <fcntl.h>
-#	include <io.h>
-#endif
+// Highest tone is at 2800Hz, keep some margin over it when decimating
+#define DECODE_PASSBAND 3000
 
 static const char * me;
 
+// Set from the SIGUSR1 handler to dump the statistics
+static volatile sig_atomic_t stats_requested;
+
+struct channel {
+	int index;
+
+	// Input sample rate, and rate it is decoded at
+	int sample_rate;
+	int decode_rate;
+
+	// Samples read from the source per channel sample, more than one if the
+	// channel is split from wideband IQ
+	int input_decimation;
+
+	uicdemod_t * uic;
+
+	// Points into the capture block being decoded, floats or 16-bit samples
+	void * samples;
+	size_t sample_count;
+
+	// Input samples before the current buffer, and monotonic time at which
+	// its last one was captured, in nanoseconds, or -1 if unknown
+	uint64_t position;
+	int64_t capture_time;
+
+	// Only used if the input is decimated or FM demodulated before decoding
+	resample_t * resample;
+	fmdemod_t * fm;
+	float * decode_buffer;
+
+	// Events are kept until all channels are done with the current buffer
+	struct uicdemod_event * events;
+	size_t event_count;
+	size_t event_size;
+};
+
+struct source {
+	const char * name;
+	bool is_pulse;
+	bool ended;
+
+	input_t * input;
+	void ** buffers;
+	struct channel * channels;
+	int channel_count;
+
+	// Only used if IQ input is split into channels, read into the wideband
+	// buffer before splitting
+	channelizer_t * channelizer;
+	float * wideband;
+
+	// Samples per channel in blocks dropped since the last one handed over,
+	// only touched by the capture thread
+	size_t dropped_count;
+};
+
+/**
+ * Buffer handed from the capture thread to the decoding one
+ */
+struct capture_block {
+	// Samples read from each source
+	size_t sample_counts[MAX_SOURCES];
+
+	// When the last sample from each source was captured, see input_capture_time
+	int64_t capture_times[MAX_SOURCES];
+
+	// Samples from each source dropped right before this block, as decoding
+	// fell behind
+	size_t dropped_counts[MAX_SOURCES];
+
+	// All channels, one after another, each one input buffer long
+	unsigned char samples[];
+};
+
+typedef enum {
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_BINARY
+} output_format_t;
+
+/**
+ * Size of the records written in binary output. All fields are little endian:
+ *
+ *   0  u16  channel
+ *   2  u8   event type, as uicdemod_status_t
+ *   3  u8   telegram status, as telegram_status_t, only for packets
+ *   4  u64  input sample where the event was detected
+ *   12 u32  train number
+ *   16 u8   code number
+ *   17 u8   received CRC
+ *   18 u8   correct CRC
+ *   19 u8   reserved, zero
+ *   20 u64  raw 39 telegram bits
+ *   28 i32  transmitter clock error, in ppm
+ *   32 i64  wall clock time of capture, in nanoseconds since the epoch, or
+ *           zero if unknown
+ */
+#define BINARY_RECORD_SIZE 40
+
+/**
+ * Event of a file decoded in batch mode
+ */
+struct file_event {
+	int channel;
+	struct uicdemod_event event;
+};
+
+/**
+ * File decoded in batch mode. Its output is formatted as soon as it is
+ * decoded, and kept until all files before it have been written out.
+ */
+struct batch_file {
+	char * path;
+	bool done;
+	bool failed;
+	writer_t * output;
+
+	struct channel * channels;
+	int channel_count;
+	int sample_rate;
+
+	/**
+	 * Samples read from the file, and samples decoded over all channels,
+	 * which differ for channelized IQ input
+	 */
+	uint64_t sample_count;
+	uint64_t decoded_count;
+
+	struct file_event * events;
+	size_t event_count;
+	size_t event_size;
+};
+
 struct context {
-	const char * source_name;
+	struct source sources[MAX_SOURCES];
+	int source_count;
+
+	input_format_t input_format;
+	int input_channels;
 	int sample_rate;
+	int decode_rate;
+	int buffer_millis;
+	int fragment_millis;
+	bool fixed_point;
+	bool iq;
+	size_t sample_size;
+	int queue_buffers;
+	int threads;
+
+	// FM demodulation of IQ input, and spacing of the channels it is split
+	// into, or 0 to decode it as a single one
+	float fm_deviation;
+	int deemphasis_micros;
+	int channel_spacing;
 
-	pa_simple * pulse_source;
-	float * float_buffer;
+	// Input samples read, and samples of each channel, per buffer. The
+	// channels of split IQ input get fewer samples than read.
+	size_t read_count;
 	size_t sample_count;
 	float tone_certainty;
 	int required_ticks;
+	int hop_millis;
+	int window_millis;
 	bool show_raw_telegrams;
 	bool hide_damaged;
+	int error_correction;
+	bfsk_engine_t bfsk_engine;
+	bfsk_timing_t bfsk_timing;
+	int bit_samplers;
+	bool demodulate_all;
+	int stats_interval;
+	struct timespec next_stats;
+	const char * metrics_path;
+	metrics_t * metrics;
+	struct metrics_snapshot metrics_snapshot;
+	output_format_t output_format;
+	int flush_millis;
+	writer_t * out;
+	bool show_timestamps;
 
-	uicdemod_t * uic;
+	// Wall clock time minus monotonic time, in nanoseconds
+	int64_t clock_offset;
+
+	// Whether output lines are tagged with the channel
+	bool tag_channels;
+
+	// Batch mode: files to decode, and next one to be printed, under the lock
+	bool batch;
+	struct batch_file * files;
+	size_t file_count;
+	size_t next_file;
+	pthread_mutex_t print_lock;
+
+	// File the events being printed come from, in batch mode
+	const char * current_file;
+
+	struct channel * channels;
+	int channel_count;
+	pool_t * pool;
+
+	// Channels decoded together by each pool job
+	int group_size;
+	int group_count;
+
+	ring_t * ring;
+	pthread_t capture_thread;
+	bool capture_started;
+	bool capture_failed;
+	unsigned long reported_drops;
 };
 
 void show_usage() {
 	fprintf(stderr,
 			"UIC-751-3 demodulator\n"
 			"Usage: %s [OPTION]\n"
+			"       %s -B [OPTION] FILE|DIRECTORY...\n"
 			"Reads audio from standard input and decodes digital information "
 			"information according to railway standard UIC-751-3\n"
 			"\n"
 			"Audio options:\n"
-			"  -s[SOURCE]  pulse audio source name (required)\n"
+			"  -s[SOURCE]  pulse audio source name, may be repeated\n"
+			"  -i[FILE]    reads audio from a file instead, \"-\" for standard input (default), may be repeated\n"
+			"  -f[FORMAT]  input file format: auto, f32, s16, wav, or cu8 or cf32 for SDR IQ (default: auto)\n"
+			"  -n[COUNT]   number of channels in each source, decoded independently (default: 1)\n"
 			"  -r[RATE]    sets input sample rate (default: %d)\n"
 			"  -b[MILLIS]  sets input buffer length, in milliseconds (default: %dms)\n"
+			"  -F          capture and decode 16-bit samples in fixed point, without decimation\n"
+			"  -l[MILLIS]  low latency PulseAudio capture, with fragments of this length\n"
+			"  -q[COUNT]   number of buffers queued for decoding, audio is dropped if full (default: %d)\n"
+			"  -R[RATE]    decimates input to this sample rate if at least twice as fast, 0 to disable (default: %d)\n"
+			"  -D[HZ]      peak FM deviation of IQ input, demodulated to the decimated rate (default: %dHz)\n"
+			"  -E[MICROS]  FM de-emphasis time constant, 0 to disable (default: %dus)\n"
+			"  -C[HZ]      splits IQ input into channels this far apart, numbered from the lowest frequency,\n"
+			"              each FM demodulated and decoded at twice the spacing. The sample rate must be an\n"
+			"              even multiple of the spacing.\n"
 			"  -c[TH]      normalized threshold for a tone to be detected as present (default: %f)\n"
-			"  -t[TICKS]   number of consecutive buffers to have a tone before printing it (default: %d)\n"
+			"  -p[MILLIS]  tone detection hop, how often tones are checked (default: %dms)\n"
+			"  -w[MILLIS]  tone detection window, rounded to whole hops (default: %dms)\n"
+			"  -t[TICKS]   number of consecutive hops to have a tone before printing it (default: %d)\n"
 			"  -u          show unparsed, raw telegram bits\n"
 			"  -d          hide damaged packets not passing integrity checks\n"
+			"  -e[BITS]    correct up to 1 or 2 bit errors in damaged packets (default: 0)\n"
+			"  -m[ENGINE]  BFSK demodulator: correlator, or quadrature for noisy signals (default: correlator)\n"
+			"  -T          restart the bit clock at every transition, instead of tracking it with a PLL\n"
+			"  -P[COUNT]   bit samplers at staggered points of each bit, reporting the first telegram passing\n"
+			"              its CRC (default: 1)\n"
+			"  -A          demodulate all samples, instead of only while mark and space are heard\n"
+			"\n"
+			"Output options:\n"
+			"  -o[FORMAT]  output format: text, json (one object per line) or binary (default: text)\n"
+			"  -O[MILLIS]  longest time output is buffered before writing it, 0 for every input buffer (default: 0)\n"
+			"  -k          prefix text lines with the input sample and, for PulseAudio sources, the capture time\n"
 			"\n"
 			"Miscellaneous options:\n"
+			"  -j[THREADS] number of decoding threads (default: one per CPU, up to one per channel)\n"
+			"  -B          batch mode: decode each file given, or each file in each directory given, on its own\n"
+			"  -S[SECS]    print decoding statistics to standard error at this interval, or on SIGUSR1\n"
+			"  -M[PATH]    serve Prometheus metrics over a Unix domain socket at this path\n"
 			"  -h, -?      shows this help text\n",
-			me, DEFAULT_SAMPLE_RATE, DEFAULT_BUFFER_MILLIS, DEFAULT_CERTAINTY, DEFAULT_TICKS
+			me, me, DEFAULT_SAMPLE_RATE, DEFAULT_BUFFER_MILLIS, DEFAULT_QUEUE_BUFFERS, DEFAULT_DECODE_RATE, DEFAULT_FM_DEVIATION, DEFAULT_DEEMPHASIS_MICROS, DEFAULT_CERTAINTY, DEFAULT_HOP_MILLIS, DEFAULT_WINDOW_MILLIS, DEFAULT_TICKS
 	);
 }
 
+bool add_source(struct context * ctx, const char * name, bool is_pulse) {
+	if (ctx->source_count == MAX_SOURCES) {
+		fprintf(stderr, "Error: too many sources, at most %d are supported\n", MAX_SOURCES);
+		return false;
+	}
+
+	struct source * src = &ctx->sources[ctx->source_count++];
+	src->name = name;
+	src->is_pulse = is_pulse;
+	return true;
+}
+
 bool parse_config(struct context * ctx, int argc, char ** argv) {
 	me = argv[0];
 
 	ctx->sample_rate = DEFAULT_SAMPLE_RATE;
+	ctx->decode_rate = DEFAULT_DECODE_RATE;
+	ctx->fm_deviation = DEFAULT_FM_DEVIATION;
+	ctx->deemphasis_micros = DEFAULT_DEEMPHASIS_MICROS;
 	ctx->required_ticks = DEFAULT_TICKS;
+	ctx->hop_millis = DEFAULT_HOP_MILLIS;
+	ctx->window_millis = DEFAULT_WINDOW_MILLIS;
+	ctx->bfsk_engine = BFSK_ENGINE_PACKED;
+	ctx->bfsk_timing = BFSK_TIMING_PLL;
+	ctx->bit_samplers = 1;
 	ctx->tone_certainty = DEFAULT_CERTAINTY;
-
-	int buffer_millis = DEFAULT_BUFFER_MILLIS;
+	ctx->buffer_millis = DEFAULT_BUFFER_MILLIS;
+	ctx->queue_buffers = DEFAULT_QUEUE_BUFFERS;
+	ctx->input_channels = 1;
 
 	int c;
-	while ((c = getopt(argc, argv, "hs:r:b:t:c:ud")) != -1) {
+	while ((c = getopt(argc, argv, "hs:i:f:n:r:R:D:E:C:b:Fl:q:t:p:w:c:ude:m:TP:Aj:S:M:o:O:kB")) != -1) {
 		switch (c) {
 			case 'h':
 			case '?':
@@ -80,15 +344,86 @@ bool parse_config(struct context * ctx, int argc, char ** argv) {
 				return false;
 
 			case 's':
-				ctx->source_name = optarg;
+				if (!add_source(ctx, optarg, true)) {
+					return false;
+				}
+				break;
+
+			case 'i':
+				if (!add_source(ctx, optarg, false)) {
+					return false;
+				}
+				break;
+
+			case 'f':
+				if (input_parse_format(optarg, &ctx->input_format) < 0) {
+					fprintf(stderr, "Error: unknown input format \"%s\"\n", optarg);
+					return false;
+				}
+				break;
+
+			case 'n':
+				ctx->input_channels = atoi(optarg);
 				break;
 
 			case 'r':
 				ctx->sample_rate = atoi(optarg);
 				break;
 
+			case 'R':
+				ctx->decode_rate = atoi(optarg);
+				if (ctx->decode_rate < 0) {
+					fprintf(stderr, "Error: invalid decoding sample rate\n");
+					return false;
+				}
+				break;
+
+			case 'D':
+				ctx->fm_deviation = atof(optarg);
+				if (ctx->fm_deviation <= 0) {
+					fprintf(stderr, "Error: invalid FM deviation\n");
+					return false;
+				}
+				break;
+
+			case 'E':
+				ctx->deemphasis_micros = atoi(optarg);
+				if (ctx->deemphasis_micros < 0) {
+					fprintf(stderr, "Error: invalid de-emphasis time constant\n");
+					return false;
+				}
+				break;
+
+			case 'C':
+				ctx->channel_spacing = atoi(optarg);
+				if (ctx->channel_spacing <= 0) {
+					fprintf(stderr, "Error: invalid channel spacing\n");
+					return false;
+				}
+				break;
+
 			case 'b':
-				buffer_millis = atoi(optarg);
+				ctx->buffer_millis = atoi(optarg);
+				break;
+
+			case 'F':
+				ctx->fixed_point = true;
+				break;
+
+			case 'l':
+				ctx->fragment_millis = atoi(optarg);
+				if (ctx->fragment_millis < 1) {
+					fprintf(stderr, "Error: fragment length must be at least one millisecond\n");
+					return false;
+				}
+				break;
+
+			case 'q':
+				ctx->queue_buffers = atoi(optarg);
+				if (ctx->queue_buffers < 1) {
+					fprintf(stderr, "Error: at least one buffer must be queued\n");
+					return false;
+				}
 				break;
 
 			case 'c':
@@ -99,6 +434,14 @@ bool parse_config(struct context * ctx, int argc, char ** argv) {
 				ctx->required_ticks = atoi(optarg);
 				break;
 
+			case 'p':
+				ctx->hop_millis = atoi(optarg);
+				break;
+
+			case 'w':
+				ctx->window_millis = atoi(optarg);
+				break;
+
 			case 'u':
 				ctx->show_raw_telegrams = true;
 				break;
@@ -107,25 +450,137 @@ bool parse_config(struct context * ctx, int argc, char ** argv) {
 				ctx->hide_damaged = true;
 				break;
 
+			case 'e':
+				ctx->error_correction = atoi(optarg);
+				if (ctx->error_correction < 0 || ctx->error_correction > 2) {
+					fprintf(stderr, "Error: error correction must be between 0 and 2 bits\n");
+					return false;
+				}
+				break;
+
+			case 'm':
+				if (!strcmp(optarg, "correlator")) {
+					ctx->bfsk_engine = BFSK_ENGINE_PACKED;
+				} else if (!strcmp(optarg, "quadrature")) {
+					ctx->bfsk_engine = BFSK_ENGINE_QUADRATURE;
+				} else {
+					fprintf(stderr, "Error: unknown BFSK demodulator \"%s\"\n", optarg);
+					return false;
+				}
+				break;
+
+			case 'T':
+				ctx->bfsk_timing = BFSK_TIMING_RESET;
+				break;
+
+			case 'P':
+				ctx->bit_samplers = atoi(optarg);
+				if (ctx->bit_samplers < 1 || ctx->bit_samplers > BFSK_MAX_SAMPLERS) {
+					fprintf(stderr, "Error: bit samplers must be between 1 and %d\n", BFSK_MAX_SAMPLERS);
+					return false;
+				}
+				break;
+
+			case 'A':
+				ctx->demodulate_all = true;
+				break;
+
+			case 'B':
+				ctx->batch = true;
+				break;
+
+			case 'j':
+				ctx->threads = atoi(optarg);
+				if (ctx->threads < 1) {
+					fprintf(stderr, "Error: thread count must be at least one\n");
+					return false;
+				}
+				break;
+
+			case 'S':
+				ctx->stats_interval = atoi(optarg);
+				if (ctx->stats_interval < 1) {
+					fprintf(stderr, "Error: statistics interval must be at least one second\n");
+					return false;
+				}
+				if (!STATS_ENABLED) {
+					fprintf(stderr, "Error: statistics were compiled out\n");
+					return false;
+				}
+				break;
+
+			case 'o':
+				if (!strcmp(optarg, "text")) {
+					ctx->output_format = OUTPUT_TEXT;
+				} else if (!strcmp(optarg, "json")) {
+					ctx->output_format = OUTPUT_JSON;
+				} else if (!strcmp(optarg, "binary")) {
+					ctx->output_format = OUTPUT_BINARY;
+				} else {
+					fprintf(stderr, "Error: unknown output format \"%s\"\n", optarg);
+					return false;
+				}
+				break;
+
+			case 'O':
+				ctx->flush_millis = atoi(optarg);
+				if (ctx->flush_millis < 0) {
+					fprintf(stderr, "Error: invalid output flush interval\n");
+					return false;
+				}
+				break;
+
+			case 'k':
+				ctx->show_timestamps = true;
+				break;
+
+			case 'M':
+				ctx->metrics_path = optarg;
+				if (!STATS_ENABLED) {
+					fprintf(stderr, "Error: statistics were compiled out\n");
+					return false;
+				}
+				break;
+
 			default:
 				fprintf(stderr, "Error: unknown option \"%c\"", c);
 				return false;
 		}
 	}
 
-	if (!ctx->source_name) {
-		fprintf(stderr, "Error: PulseAudio source not set\n");
+	if (ctx->batch) {
+		if (ctx->source_count > 0 || ctx->metrics_path || ctx->stats_interval > 0) {
+			fprintf(stderr, "Error: batch mode takes files as arguments, and has no statistics or metrics\n");
+			return false;
+		}
+
+		if (optind == argc) {
+			fprintf(stderr, "Error: no files given for batch mode\n");
+			return false;
+		}
+
+		if (ctx->output_format == OUTPUT_BINARY) {
+			fprintf(stderr, "Error: binary output cannot tell files apart in batch mode\n");
+			return false;
+		}
+	}
+
+	// Default to standard input
+	if (ctx->source_count == 0 && !ctx->batch) {
+		add_source(ctx, NULL, false);
+	}
+
+	if (ctx->input_channels < 1) {
+		fprintf(stderr, "Error: channel count must be at least one\n");
 		return false;
 	}
 
 	if (ctx->sample_rate <= 0) {
 		fprintf(stderr, "Error: invalid sample rate\n");
 		return false;
-	} else if (ctx->sample_rate < 11800) {
-		fprintf(stderr, "Warning: sample rate is too low, consider using 11800Hz or more\n");
 	}
 
-	if (buffer_millis <= 0) {
+	if (ctx->buffer_millis <= 0) {
 		fprintf(stderr, "Error: invalid buffer length\n");
 		return false;
 	}
@@ -135,161 +590,1381 @@ bool parse_config(struct context * ctx, int argc, char ** argv) {
 		return false;
 	}
 
+	if (ctx->hop_millis <= 0) {
+		fprintf(stderr, "Error: invalid tone detection hop\n");
+		return false;
+	}
+
+	if (ctx->window_millis < ctx->hop_millis) {
+		fprintf(stderr, "Error: tone detection window must be at least one hop long\n");
+		return false;
+	}
+
 	if (ctx->required_ticks < 1) {
 		fprintf(stderr, "Error: required signal ticks must be at least one\n");
 		return false;
 	}
 
-	ctx->sample_count = ceil(buffer_millis * ctx->sample_rate / 1000);
+	if (ctx->fixed_point && ctx->bfsk_engine != BFSK_ENGINE_PACKED) {
+		fprintf(stderr, "Error: only the correlator is available in fixed point\n");
+		return false;
+	}
+
+	if (ctx->bit_samplers > 1 && ctx->bfsk_engine != BFSK_ENGINE_PACKED) {
+		fprintf(stderr, "Error: only the correlator can run several bit samplers\n");
+		return false;
+	}
 
 	return true;
 }
 
+/**
+ * Releases the decoder of a channel, keeping its events.
+ */
+void close_channel(struct channel * ch) {
+	free(ch->decode_buffer);
+	ch->decode_buffer = NULL;
+	resample_free(ch->resample);
+	ch->resample = NULL;
+	fmdemod_free(ch->fm);
+	ch->fm = NULL;
+	uicdemod_free(ch->uic);
+	ch->uic = NULL;
+}
+
+void free_channel(struct channel * ch) {
+	close_channel(ch);
+	free(ch->events);
+	ch->events = NULL;
+}
+
+/**
+ * Releases the channels and events of a batch file.
+ */
+void free_file(struct batch_file * file) {
+	if (file->channels) {
+		for (int i = 0; i < file->channel_count; i++) {
+			free_channel(&file->channels[i]);
+		}
+		free(file->channels);
+		file->channels = NULL;
+	}
+
+	free(file->events);
+	file->events = NULL;
+}
+
 void destroy_ctx(struct context * ctx) {
-	free(ctx->float_buffer);
-	pa_simple_free(ctx->pulse_source);
-	uicdemod_free(ctx->uic);
+	if (ctx->capture_started) {
+		pthread_join(ctx->capture_thread, NULL);
+	}
+	ring_free(ctx->ring);
+	pool_free(ctx->pool);
+	metrics_free(ctx->metrics);
+	writer_free(ctx->out);
+	free(ctx->metrics_snapshot.channels);
+
+	for (int i = 0; i < ctx->source_count; i++) {
+		input_free(ctx->sources[i].input);
+		free(ctx->sources[i].buffers);
+		channelizer_free(ctx->sources[i].channelizer);
+		free(ctx->sources[i].wideband);
+	}
+
+	if (ctx->channels) {
+		for (int i = 0; i < ctx->channel_count; i++) {
+			free_channel(&ctx->channels[i]);
+		}
+		free(ctx->channels);
+	}
+
+	if (ctx->files) {
+		for (size_t i = 0; i < ctx->file_count; i++) {
+			free_file(&ctx->files[i]);
+			writer_free(ctx->files[i].output);
+			free(ctx->files[i].path);
+		}
+		free(ctx->files);
+		pthread_mutex_destroy(&ctx->print_lock);
+	}
 }
 
-bool init_ctx(struct context * ctx) {
-	#ifdef _WIN32
-		_setmode(_fileno(stdin), _O_BINARY);
-	#endif
-
-	int pa_error;
-	pa_sample_spec pa_spec = {
-		.format = PA_SAMPLE_FLOAT32LE,
-		.rate = ctx->sample_rate,
-		.channels = 1
-	};
-	ctx->pulse_source = pa_simple_new(NULL, me, PA_STREAM_RECORD, ctx->source_name, "uicterm", &pa_spec, NULL, NULL, &pa_error);
-	if (!ctx->pulse_source) {
-		fprintf(stderr, "Error: pa_simple_new() failed: %s\n", pa_strerror(pa_error));
-		destroy_ctx(ctx);
+/**
+ * Returns the sample rate an input is decoded at. Decimation only pays for
+ * its own filtering cost if it at least halves the sample rate. IQ input is
+ * always demodulated to audio at the decimated rate.
+ */
+int decode_rate(struct context * ctx, int sample_rate, bool iq) {
+	if (iq) {
+		return ctx->decode_rate > 0 ? ctx->decode_rate : DEFAULT_DECODE_RATE;
+	}
+
+	if (!ctx->fixed_point && ctx->decode_rate > 0 && sample_rate >= 2 * ctx->decode_rate) {
+		return ctx->decode_rate;
+	}
+
+	return sample_rate;
+}
+
+/**
+ * Checks whether an input can be decoded with the options given.
+ */
+bool check_input(struct context * ctx, input_t * in) {
+	if (!input_is_iq(in)) {
+		return true;
+	}
+
+	if (ctx->fixed_point) {
+		fprintf(stderr, "Error: IQ input cannot be decoded in fixed point\n");
 		return false;
 	}
 
-	ctx->float_buffer = malloc(ctx->sample_count * sizeof(float));
-	if (ctx->float_buffer == NULL) {
-		fprintf(stderr, "Error: could not allocate buffer for %u floats\n", (unsigned int) ctx->sample_count);
-		destroy_ctx(ctx);
+	if (input_channels(in) != 1) {
+		fprintf(stderr, "Error: IQ input has a single channel\n");
 		return false;
 	}
 
-	ctx->uic = uicdemod_init(ctx->sample_rate);
-	if (ctx->uic == NULL) {
-		fprintf(stderr, "Error: could not initialize UIC demodulator\n");
-		destroy_ctx(ctx);
+	return true;
+}
+
+/**
+ * Sets up the channelizer splitting IQ input into channels at the channel
+ * spacing, if one was given.
+ *
+ * @returns true on success, or if not splitting into channels
+ */
+bool init_channelizer(struct context * ctx, input_t * in, channelizer_t ** channelizer) {
+	*channelizer = NULL;
+	if (ctx->channel_spacing == 0) {
+		return true;
+	}
+
+	if (!input_is_iq(in)) {
+		fprintf(stderr, "Error: only IQ input can be split into channels\n");
+		return false;
+	}
+
+	int rate = input_sample_rate(in);
+	if (rate % ctx->channel_spacing != 0 || rate / ctx->channel_spacing % 2 != 0) {
+		fprintf(stderr, "Error: sample rate must be an even multiple of the channel spacing\n");
 		return false;
 	}
 
-	uicdemod_set_tone_certainty(ctx->uic, ctx->tone_certainty);
-	uicdemod_set_required_ticks(ctx->uic, ctx->required_ticks);
+	*channelizer = channelizer_init(rate / ctx->channel_spacing);
+	if (*channelizer == NULL) {
+		fprintf(stderr, "Error: could not split input into %d channels\n", rate / ctx->channel_spacing);
+		return false;
+	}
 
 	return true;
 }
 
-void print_bits(uint64_t bits, int_least8_t len) {
-	uint64_t mask = (1ULL << len) >> 1;
+/**
+ * Sets up the decoder of a channel, for buffers of up to the given number of
+ * input samples, either audio or IQ.
+ */
+bool init_channel(struct context * ctx, struct channel * ch, int sample_rate, size_t sample_count, bool iq) {
+	ch->sample_rate = sample_rate;
+	ch->decode_rate = decode_rate(ctx, sample_rate, iq);
 
-	while (mask != 0) {
-		if (bits & mask) {
-			printf("1");
-		} else {
-			printf("0");
+	if (iq) {
+		ch->fm = fmdemod_init(ch->sample_rate, ch->decode_rate, ctx->fm_deviation, DECODE_PASSBAND, ctx->deemphasis_micros / 1e6);
+		if (ch->fm == NULL) {
+			fprintf(stderr, "Error: could not FM demodulate from %dHz to %dHz\n", ch->sample_rate, ch->decode_rate);
+			return false;
 		}
-		mask = mask >> 1;
+
+		ch->decode_buffer = malloc(fmdemod_max_output(ch->fm, sample_count) * sizeof(float));
+		if (ch->decode_buffer == NULL) {
+			fprintf(stderr, "Error: could not allocate decoding buffer\n");
+			return false;
+		}
+	} else if (ch->decode_rate != ch->sample_rate) {
+		ch->resample = resample_init(ch->sample_rate, ch->decode_rate, DECODE_PASSBAND);
+		if (ch->resample == NULL) {
+			fprintf(stderr, "Error: could not decimate from %dHz to %dHz\n", ch->sample_rate, ch->decode_rate);
+			return false;
+		}
+
+		ch->decode_buffer = malloc(resample_max_output(ch->resample, sample_count) * sizeof(float));
+		if (ch->decode_buffer == NULL) {
+			fprintf(stderr, "Error: could not allocate decoding buffer\n");
+			return false;
+		}
+	}
+
+	ch->uic = uicdemod_init(ch->decode_rate);
+	if (ch->uic == NULL) {
+		fprintf(stderr, "Error: could not initialize UIC demodulator\n");
+		return false;
+	}
+
+	if (!uicdemod_set_tone_window(ch->uic, ctx->hop_millis, ctx->window_millis)) {
+		fprintf(stderr, "Error: could not set up tone detection\n");
+		return false;
 	}
+
+	uicdemod_set_tone_certainty(ch->uic, ctx->tone_certainty);
+	uicdemod_set_required_ticks(ch->uic, ctx->required_ticks);
+	uicdemod_set_error_correction(ch->uic, ctx->error_correction);
+	uicdemod_set_bfsk_engine(ch->uic, ctx->bfsk_engine);
+	uicdemod_set_bit_samplers(ch->uic, ctx->bit_samplers);
+	uicdemod_set_symbol_timing(ch->uic, ctx->bfsk_timing);
+	uicdemod_set_gating(ch->uic, !ctx->demodulate_all);
+
+	return true;
 }
 
-void print_event(struct context * ctx, uicdemod_status_t event) {
-	telegram_t * telegram;
-	switch (event) {
-		case UICDEMOD_PACKET:
-			telegram = uicdemod_get_telegram(ctx->uic);
+bool init_ctx(struct context * ctx) {
+	for (int i = 0; i < ctx->source_count; i++) {
+		struct source * src = &ctx->sources[i];
 
-			switch (telegram_status(telegram)) {
-				case TELEGRAM_OK:
-					printf(
-							"Packet %06X %02X\n",
-							telegram_train_number(telegram),
-							telegram_code_number(telegram)
-					);
-					break;
+		input_sample_t sample_type = ctx->fixed_point ? INPUT_SAMPLE_S16 : INPUT_SAMPLE_FLOAT;
+		if (src->is_pulse && ctx->fragment_millis > 0) {
+			src->input = input_open_pulse_async(me, src->name, ctx->sample_rate, ctx->input_channels, sample_type, ctx->fragment_millis);
+		} else if (src->is_pulse) {
+			src->input = input_open_pulse(me, src->name, ctx->sample_rate, ctx->input_channels, sample_type);
+		} else {
+			src->input = input_open_file(src->name, ctx->input_format, ctx->sample_rate, ctx->input_channels);
+		}
+		if (src->input == NULL || !check_input(ctx, src->input)) {
+			destroy_ctx(ctx);
+			return false;
+		}
 
-				case TELEGRAM_INTEGRITY:
-					if (!ctx->hide_damaged) {
-						printf(
-							"Packet %06X %02X (received CRC: %02X, correct: %02X)\n",
-							telegram_train_number(telegram),
-							telegram_code_number(telegram),
-							telegram_received_crc(telegram),
-							telegram_correct_crc(telegram)
-						);
-					}
-					break;
+		// WAV files carry their own sample rate, and all sources must agree
+		int rate = input_sample_rate(src->input);
+		bool iq = input_is_iq(src->input);
+		if (i == 0) {
+			ctx->sample_rate = rate;
+			ctx->iq = iq;
+		} else if (rate != ctx->sample_rate) {
+			fprintf(stderr, "Error: all sources must have the same sample rate\n");
+			destroy_ctx(ctx);
+			return false;
+		} else if (iq != ctx->iq) {
+			fprintf(stderr, "Error: sources cannot mix audio and IQ samples\n");
+			destroy_ctx(ctx);
+			return false;
+		}
 
-				default:
-					// Should never happen
-					assert(0);
-			}
+		if (!init_channelizer(ctx, src->input, &src->channelizer)) {
+			destroy_ctx(ctx);
+			return false;
+		}
 
-			if (ctx->show_raw_telegrams) {
-				printf("Raw packet: ");
-				print_bits(telegram_raw(telegram), 39);
-				printf("\n");
-			}
+		src->channel_count = input_channels(src->input);
+		if (src->channelizer) {
+			src->channel_count = rate / ctx->channel_spacing;
+		}
+		ctx->channel_count += src->channel_count;
+	}
 
-			break;
+	if (decode_rate(ctx, ctx->sample_rate, ctx->iq) < 11800) {
+		fprintf(stderr, "Warning: sample rate is too low, consider using 11800Hz or more\n");
+	}
 
-		case UICDEMOD_WARNING:
-			printf("Warning\n");
-			break;
-		case UICDEMOD_LISTENING:
-			printf("Listening\n");
-			break;
-		case UICDEMOD_CHFREE:
-			printf("Channel free\n");
-			break;
-		case UICDEMOD_PILOT:
-			printf("Voice pilot\n");
-			break;
-		case UICDEMOD_SILENCE:
-			printf("Silence\n");
-			break;
-		default:
-			// Should never happen
-			assert(0);
-			break;
+	ctx->read_count = ceil(ctx->buffer_millis * ctx->sample_rate / 1000);
+	ctx->sample_count = ctx->read_count;
+
+	// Channels split from IQ input are oversampled by two
+	int channel_rate = ctx->sample_rate;
+	if (ctx->channel_spacing > 0) {
+		ctx->sample_count = channelizer_max_output(ctx->sources[0].channelizer, ctx->read_count);
+		channel_rate = 2 * ctx->channel_spacing;
 	}
-	fflush(stdout);
-}
 
-bool read_loop(struct context * ctx) {
-	while (1) {
-		int pa_error;
-		if (pa_simple_read(ctx->pulse_source, ctx->float_buffer, ctx->sample_count * sizeof(float), &pa_error) < 0) {
-			fprintf(stderr, "Error: pa_simple_read() failed: %s\n", pa_strerror(pa_error));
+	ctx->tag_channels = ctx->channel_count > 1;
+
+	ctx->channels = calloc(ctx->channel_count, sizeof(struct channel));
+	if (ctx->channels == NULL) {
+		fprintf(stderr, "Error: could not allocate %d channels\n", ctx->channel_count);
+		destroy_ctx(ctx);
+		return false;
+	}
+
+	int channel_index = 0;
+	for (int i = 0; i < ctx->source_count; i++) {
+		struct source * src = &ctx->sources[i];
+
+		src->channels = &ctx->channels[channel_index];
+		src->buffers = malloc(src->channel_count * sizeof(void *));
+		if (src->buffers == NULL) {
+			fprintf(stderr, "Error: could not allocate %d channels\n", src->channel_count);
+			destroy_ctx(ctx);
 			return false;
 		}
 
-		uicdemod_analyze_begin(ctx->uic);
+		if (src->channelizer) {
+			src->wideband = malloc(2 * ctx->read_count * sizeof(float));
+			if (src->wideband == NULL) {
+				fprintf(stderr, "Error: could not allocate input buffer\n");
+				destroy_ctx(ctx);
+				return false;
+			}
+		}
+
+		for (int j = 0; j < src->channel_count; j++) {
+			struct channel * ch = &src->channels[j];
+			ch->index = channel_index++;
 
-		const float * sample_ptr = ctx->float_buffer;
-		size_t remaining_samples = ctx->sample_count;
-		uicdemod_status_t event = uicdemod_analyze(ctx->uic, &sample_ptr, &remaining_samples);
-		while (event != UICDEMOD_NONE) {
-			print_event(ctx, event);
-			event = uicdemod_analyze(ctx->uic, &sample_ptr, &remaining_samples);
+			if (!init_channel(ctx, ch, channel_rate, ctx->sample_count, ctx->iq)) {
+				destroy_ctx(ctx);
+				return false;
+			}
+			ch->input_decimation = src->channelizer ? src->channel_count / 2 : 1;
 		}
 	}
-}
 
-int main(int argc, char ** argv) {
-	struct context ctx = { 0 };
+	// Live sources cannot be paused, so drop audio rather than lose sync
+	bool live = false;
+	for (int i = 0; i < ctx->source_count; i++) {
+		live |= ctx->sources[i].is_pulse;
+	}
 
-	if (!parse_config(&ctx, argc, argv)) {
-		return 1;
+	ctx->sample_size = ctx->fixed_point ? sizeof(int16_t) : sizeof(float);
+	if (ctx->iq) {
+		ctx->sample_size = 2 * sizeof(float);
+	}
+	size_t block_size = sizeof(struct capture_block) + ctx->channel_count * ctx->sample_count * ctx->sample_size;
+	ctx->ring = ring_init(block_size, ctx->queue_buffers, live);
+	if (ctx->ring == NULL) {
+		fprintf(stderr, "Error: could not allocate %d buffers\n", ctx->queue_buffers);
+		destroy_ctx(ctx);
+		return false;
+	}
+
+	ctx->out = writer_init(STDOUT_FILENO, OUTPUT_BUFFER_SIZE, ctx->flush_millis);
+	if (ctx->out == NULL) {
+		fprintf(stderr, "Error: could not allocate output buffer\n");
+		destroy_ctx(ctx);
+		return false;
+	}
+
+	int threads = ctx->threads;
+	if (threads == 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > ctx->channel_count) {
+			threads = ctx->channel_count;
+		}
+		if (threads < 1) {
+			threads = 1;
+		}
+	}
+
+	ctx->pool = pool_init(threads);
+	if (ctx->pool == NULL) {
+		fprintf(stderr, "Error: could not start %d decoding threads\n", threads);
+		destroy_ctx(ctx);
+		return false;
+	}
+
+	// Neighbouring channels are decoded together, in a few groups per thread
+	// so they still balance out if some channels are busier
+	ctx->group_size = (ctx->channel_count + threads * GROUPS_PER_THREAD - 1) / (threads * GROUPS_PER_THREAD);
+	ctx->group_count = (ctx->channel_count + ctx->group_size - 1) / ctx->group_size;
+
+	if (ctx->metrics_path) {
+		ctx->metrics_snapshot.channels = calloc(ctx->channel_count, sizeof(struct uicdemod_stats));
+		if (ctx->metrics_snapshot.channels == NULL) {
+			fprintf(stderr, "Error: could not allocate metrics\n");
+			destroy_ctx(ctx);
+			return false;
+		}
+
+		ctx->metrics = metrics_init(ctx->metrics_path, ctx->channel_count);
+		if (ctx->metrics == NULL) {
+			destroy_ctx(ctx);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Returns the channel sample where an event was detected, converting it back
+ * to the channel sample rate if decimated.
+ */
+uint64_t channel_sample(struct channel * ch, const struct uicdemod_event * event) {
+	return event->sample * ch->sample_rate / ch->decode_rate;
+}
+
+/**
+ * Returns the input sample where an event was detected, counting the samples
+ * read from the source before it was split into channels.
+ */
+uint64_t event_sample(struct channel * ch, const struct uicdemod_event * event) {
+	return channel_sample(ch, event) * ch->input_decimation;
+}
+
+/**
+ * Returns the wall clock time at which an event was captured, counting back
+ * from the last sample of the buffer.
+ *
+ * @returns nanoseconds since the epoch, or -1 if unknown
+ */
+int64_t event_time(struct context * ctx, struct channel * ch, const struct uicdemod_event * event) {
+	if (ch->capture_time < 0) {
+		return -1;
+	}
+
+	int64_t samples_after = (int64_t) (ch->position + ch->sample_count - 1) - (int64_t) channel_sample(ch, event);
+	return ch->capture_time + ctx->clock_offset - samples_after * 1000000000 / ch->sample_rate;
+}
+
+/**
+ * Formats a time as ISO 8601 in UTC, with microseconds.
+ */
+void format_time(char * buf, size_t size, int64_t time) {
+	time_t secs = time / 1000000000;
+	struct tm tm;
+	gmtime_r(&secs, &tm);
+
+	size_t len = strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buf + len, size - len, ".%06dZ", (int) (time % 1000000000 / 1000));
+}
+
+void print_bits(struct context * ctx, uint64_t bits, int_least8_t len) {
+	uint64_t mask = (1ULL << len) >> 1;
+
+	while (mask != 0) {
+		if (bits & mask) {
+			writer_write(ctx->out, "1", 1);
+		} else {
+			writer_write(ctx->out, "0", 1);
+		}
+		mask = mask >> 1;
+	}
+}
+
+void print_channel(struct context * ctx, struct channel * ch, const struct uicdemod_event * event) {
+	if (ctx->show_timestamps) {
+		writer_printf(ctx->out, "%llu ", (unsigned long long) event_sample(ch, event));
+
+		int64_t time = event_time(ctx, ch, event);
+		if (time >= 0) {
+			char buf[40];
+			format_time(buf, sizeof(buf), time);
+			writer_printf(ctx->out, "%s ", buf);
+		}
+	}
+
+	// Only tag lines if there is more than one channel, to keep the output unchanged otherwise
+	if (ctx->tag_channels) {
+		writer_printf(ctx->out, "[%d] ", ch->index);
+	}
+}
+
+int count_bits(uint64_t bits) {
+	int count = 0;
+	for (; bits; bits &= bits - 1) {
+		count++;
+	}
+	return count;
+}
+
+void print_event(struct context * ctx, struct channel * ch, const struct uicdemod_event * event) {
+	if (event->status != UICDEMOD_PACKET) {
+		print_channel(ctx, ch, event);
+	}
+
+	switch (event->status) {
+		case UICDEMOD_PACKET:
+			switch (event->telegram.status) {
+				case TELEGRAM_OK:
+					print_channel(ctx, ch, event);
+					writer_printf(
+							ctx->out,
+							"Packet %06X %02X\n",
+							event->telegram.train_number,
+							event->telegram.code_number
+					);
+					break;
+
+				case TELEGRAM_CORRECTED:
+					print_channel(ctx, ch, event);
+					writer_printf(
+							ctx->out,
+							"Packet %06X %02X (corrected %d bit%s)\n",
+							event->telegram.train_number,
+							event->telegram.code_number,
+							count_bits(event->telegram.error_mask),
+							count_bits(event->telegram.error_mask) == 1 ? "" : "s"
+					);
+					break;
+
+				case TELEGRAM_INTEGRITY:
+					if (!ctx->hide_damaged) {
+						print_channel(ctx, ch, event);
+						writer_printf(
+							ctx->out,
+							"Packet %06X %02X (received CRC: %02X, correct: %02X)\n",
+							event->telegram.train_number,
+							event->telegram.code_number,
+							event->telegram.received_crc,
+							event->telegram.correct_crc
+						);
+					}
+					break;
+
+				default:
+					// Should never happen
+					assert(0);
+			}
+
+			if (ctx->show_raw_telegrams) {
+				print_channel(ctx, ch, event);
+				writer_printf(ctx->out, "Raw packet: ");
+				print_bits(ctx, event->telegram.raw, 39);
+				writer_printf(ctx->out, "\n");
+
+				if (ctx->bfsk_timing == BFSK_TIMING_PLL) {
+					print_channel(ctx, ch, event);
+					writer_printf(ctx->out, "Clock error: %+.0f ppm\n", event->clock_error * 1e6);
+				}
+			}
+
+			break;
+
+		case UICDEMOD_WARNING:
+			writer_printf(ctx->out, "Warning\n");
+			break;
+		case UICDEMOD_LISTENING:
+			writer_printf(ctx->out, "Listening\n");
+			break;
+		case UICDEMOD_CHFREE:
+			writer_printf(ctx->out, "Channel free\n");
+			break;
+		case UICDEMOD_PILOT:
+			writer_printf(ctx->out, "Voice pilot\n");
+			break;
+		case UICDEMOD_SILENCE:
+			writer_printf(ctx->out, "Silence\n");
+			break;
+		default:
+			// Should never happen
+			assert(0);
+			break;
+	}
+}
+
+
+static const char * event_names[] = {
+	[UICDEMOD_WARNING] = "warning",
+	[UICDEMOD_LISTENING] = "listening",
+	[UICDEMOD_CHFREE] = "channel_free",
+	[UICDEMOD_PILOT] = "pilot",
+	[UICDEMOD_SILENCE] = "silence",
+	[UICDEMOD_PACKET] = "packet"
+};
+
+static const char * telegram_names[] = {
+	[TELEGRAM_OK] = "ok",
+	[TELEGRAM_CORRECTED] = "corrected",
+	[TELEGRAM_INTEGRITY] = "crc_fail"
+};
+
+/**
+ * Writes a string as a JSON string literal.
+ */
+void print_json_string(struct context * ctx, const char * str) {
+	writer_write(ctx->out, "\"", 1);
+	for (; *str; str++) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			writer_printf(ctx->out, "\\%c", c);
+		} else if (c < 0x20) {
+			writer_printf(ctx->out, "\\u%04x", c);
+		} else {
+			writer_write(ctx->out, str, 1);
+		}
+	}
+	writer_write(ctx->out, "\"", 1);
+}
+
+void print_event_json(struct context * ctx, struct channel * ch, const struct uicdemod_event * event) {
+	writer_write(ctx->out, "{", 1);
+	if (ctx->current_file) {
+		writer_printf(ctx->out, "\"file\":");
+		print_json_string(ctx, ctx->current_file);
+		writer_write(ctx->out, ",", 1);
+	}
+
+	writer_printf(
+			ctx->out,
+			"\"channel\":%d,\"sample\":%llu,\"event\":\"%s\"",
+			ch->index,
+			(unsigned long long) event_sample(ch, event),
+			event_names[event->status]
+	);
+
+	int64_t time = event_time(ctx, ch, event);
+	if (time >= 0) {
+		char buf[40];
+		format_time(buf, sizeof(buf), time);
+		writer_printf(ctx->out, ",\"time\":\"%s\"", buf);
+	}
+
+	if (event->status == UICDEMOD_PACKET) {
+		writer_printf(
+				ctx->out,
+				",\"status\":\"%s\",\"train_number\":%d,\"code_number\":%d,"
+				"\"received_crc\":%d,\"correct_crc\":%d,\"raw\":%llu",
+				telegram_names[event->telegram.status],
+				event->telegram.train_number,
+				event->telegram.code_number,
+				event->telegram.received_crc,
+				event->telegram.correct_crc,
+				(unsigned long long) event->telegram.raw
+		);
+
+		if (event->telegram.status == TELEGRAM_CORRECTED) {
+			writer_printf(ctx->out, ",\"corrected_bits\":%d", count_bits(event->telegram.error_mask));
+		}
+
+		if (ctx->bfsk_timing == BFSK_TIMING_PLL) {
+			writer_printf(ctx->out, ",\"clock_error_ppm\":%.0f", event->clock_error * 1e6);
+		}
+	}
+
+	writer_write(ctx->out, "}\n", 2);
+}
+
+/**
+ * Stores a little endian integer of the given number of bytes.
+ */
+void put_le(unsigned char * dst, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		dst[i] = value >> (8 * i);
+	}
+}
+
+void print_event_binary(struct context * ctx, struct channel * ch, const struct uicdemod_event * event) {
+	unsigned char record[BINARY_RECORD_SIZE] = { 0 };
+
+	put_le(record + 0, ch->index, 2);
+	put_le(record + 2, event->status, 1);
+	put_le(record + 4, event_sample(ch, event), 8);
+
+	int64_t time = event_time(ctx, ch, event);
+	if (time >= 0) {
+		put_le(record + 32, time, 8);
+	}
+
+	if (event->status == UICDEMOD_PACKET) {
+		put_le(record + 3, event->telegram.status, 1);
+		put_le(record + 12, event->telegram.train_number, 4);
+		put_le(record + 16, event->telegram.code_number, 1);
+		put_le(record + 17, event->telegram.received_crc, 1);
+		put_le(record + 18, event->telegram.correct_crc, 1);
+		put_le(record + 20, event->telegram.raw, 8);
+		put_le(record + 28, (uint32_t) (int32_t) lround(event->clock_error * 1e6), 4);
+	}
+
+	writer_write(ctx->out, record, sizeof(record));
+}
+
+/**
+ * Writes an event in the selected output format.
+ */
+void output_event(struct context * ctx, struct channel * ch, const struct uicdemod_event * event) {
+	if (ctx->output_format == OUTPUT_TEXT) {
+		print_event(ctx, ch, event);
+		return;
+	}
+
+	// Text output has its own handling, as raw bits may still be shown
+	if (ctx->hide_damaged && event->status == UICDEMOD_PACKET && event->telegram.status == TELEGRAM_INTEGRITY) {
+		return;
+	}
+
+	if (ctx->output_format == OUTPUT_JSON) {
+		print_event_json(ctx, ch, event);
+	} else {
+		print_event_binary(ctx, ch, event);
+	}
+}
+
+/**
+ * Demodulator callback storing events for a channel.
+ */
+void push_event(void * arg, const struct uicdemod_event * event) {
+	struct channel * ch = arg;
+
+	if (ch->event_count == ch->event_size) {
+		size_t new_size = ch->event_size ? ch->event_size * 2 : 8;
+		struct uicdemod_event * events = realloc(ch->events, new_size * sizeof(struct uicdemod_event));
+		if (events == NULL) {
+			fprintf(stderr, "Error: could not store event for channel %d\n", ch->index);
+			return;
+		}
+		ch->events = events;
+		ch->event_size = new_size;
+	}
+
+	ch->events[ch->event_count++] = *event;
+}
+
+/**
+ * Moves a channel past samples lost before its current buffer, so the sample
+ * indices of later events still count them.
+ */
+void skip_samples(struct channel * ch, size_t sample_count) {
+	ch->position += sample_count;
+
+	// Filter history from before the gap would blend into the samples after it
+	if (ch->resample != NULL) {
+		resample_reset(ch->resample);
+	}
+	if (ch->fm != NULL) {
+		fmdemod_reset(ch->fm);
+	}
+	uicdemod_skip(ch->uic, (uint64_t) sample_count * ch->decode_rate / ch->sample_rate);
+}
+
+/**
+ * Decodes the current buffer of a channel, adding its events to those stored.
+ */
+void decode_samples(struct context * ctx, struct channel * ch) {
+	if (ch->sample_count == 0) {
+		return;
+	}
+
+	if (ctx->fixed_point) {
+		uicdemod_analyze_s16_callback(ch->uic, ch->samples, ch->sample_count, push_event, ch);
+	} else if (ch->fm) {
+		size_t count = fmdemod_process(ch->fm, ch->samples, ch->sample_count, ch->decode_buffer);
+		uicdemod_analyze_callback(ch->uic, ch->decode_buffer, count, push_event, ch);
+	} else if (ch->resample) {
+		size_t count = resample_process(ch->resample, ch->samples, ch->sample_count, ch->decode_buffer);
+		uicdemod_analyze_callback(ch->uic, ch->decode_buffer, count, push_event, ch);
+	} else {
+		uicdemod_analyze_callback(ch->uic, ch->samples, ch->sample_count, push_event, ch);
+	}
+}
+
+/**
+ * Pool job decoding the current buffer of a group of channels.
+ */
+void decode_group(void * arg, size_t index) {
+	struct context * ctx = arg;
+	int first = index * ctx->group_size;
+	int last = first + ctx->group_size;
+	if (last > ctx->channel_count) {
+		last = ctx->channel_count;
+	}
+
+	for (int i = first; i < last; i++) {
+		struct channel * ch = &ctx->channels[i];
+		ch->event_count = 0;
+		decode_samples(ctx, ch);
+	}
+}
+
+/**
+ * Returns the samples of a channel in a capture block.
+ */
+void * block_channel(struct context * ctx, struct capture_block * block, int index) {
+	return block->samples + index * ctx->sample_count * ctx->sample_size;
+}
+
+/**
+ * Reads all sources into capture blocks, until all of them end or one fails.
+ * Runs on its own thread so a slow decoder or output never stalls capture.
+ */
+void * capture_loop(void * arg) {
+	struct context * ctx = arg;
+
+	while (1) {
+		struct capture_block * block = ring_acquire(ctx->ring);
+		bool any_read = false;
+
+		for (int i = 0; i < ctx->source_count; i++) {
+			struct source * src = &ctx->sources[i];
+
+			ssize_t read_count = 0;
+			size_t sample_count = 0;
+			if (!src->ended) {
+				for (int j = 0; j < src->channel_count; j++) {
+					src->buffers[j] = block_channel(ctx, block, src->channels[j].index);
+				}
+
+				if (src->channelizer) {
+					read_count = input_read_iq(src->input, src->wideband, ctx->read_count);
+				} else if (ctx->iq) {
+					read_count = input_read_iq(src->input, src->buffers[0], ctx->sample_count);
+				} else if (ctx->fixed_point) {
+					read_count = input_read_s16(src->input, (int16_t **) src->buffers, ctx->sample_count);
+				} else {
+					read_count = input_read(src->input, (float **) src->buffers, ctx->sample_count);
+				}
+				if (read_count < 0) {
+					ctx->capture_failed = true;
+					ring_close(ctx->ring);
+					return NULL;
+				} else if (read_count == 0) {
+					src->ended = true;
+				} else {
+					any_read = true;
+					sample_count = read_count;
+				}
+
+				// Split here, so it overlaps with decoding the previous block
+				if (src->channelizer && read_count > 0) {
+					sample_count = channelizer_process(src->channelizer, src->wideband, read_count, (float **) src->buffers);
+				}
+			}
+
+			block->sample_counts[i] = sample_count;
+			block->capture_times[i] = read_count > 0 ? input_capture_time(src->input) : -1;
+			block->dropped_counts[i] = src->dropped_count;
+		}
+
+		if (!any_read) {
+			break;
+		}
+
+		// Dropped blocks are added up, so the next one tells how long the gap was
+		bool committed = ring_commit(ctx->ring);
+		for (int i = 0; i < ctx->source_count; i++) {
+			struct source * src = &ctx->sources[i];
+			src->dropped_count = committed ? 0 : src->dropped_count + block->sample_counts[i];
+		}
+	}
+
+	ring_close(ctx->ring);
+	return NULL;
+}
+
+void report_drops(struct context * ctx, const struct ring_stats * stats) {
+	if (stats->dropped != ctx->reported_drops) {
+		fprintf(stderr, "Warning: decoding is falling behind, %lu buffers dropped so far (%lu decoded)\n", stats->dropped, stats->committed);
+		ctx->reported_drops = stats->dropped;
+	}
+}
+
+/**
+ * Takes a snapshot of the decoder after a buffer is done, and publishes it
+ * for the metrics server.
+ */
+void publish_metrics(struct context * ctx, const struct ring_stats * stats, const struct timespec * start) {
+	struct metrics_snapshot * s = &ctx->metrics_snapshot;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	metrics_observe_loop(s, (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9);
+
+	s->buffers = stats->committed;
+	s->overruns = stats->dropped;
+	for (int i = 0; i < ctx->channel_count; i++) {
+		uicdemod_get_stats(ctx->channels[i].uic, &s->channels[i]);
+	}
+
+	metrics_publish(ctx->metrics, s);
+}
+
+void print_stats(struct context * ctx) {
+	for (int i = 0; i < ctx->channel_count; i++) {
+		struct uicdemod_stats stats;
+		uicdemod_get_stats(ctx->channels[i].uic, &stats);
+
+		double samples = stats.samples ? stats.samples : 1;
+		double bits = stats.bits + stats.invalid ? stats.bits + stats.invalid : 1;
+
+		fprintf(stderr,
+				"Stats [%d]: %llu samples (%llu idle), %llu bits, %llu invalid, %llu without sync, "
+				"%llu packets OK, %llu corrected, %llu damaged, %llu tone events\n",
+				i,
+				(unsigned long long) stats.samples,
+				(unsigned long long) stats.idle,
+				(unsigned long long) stats.bits,
+				(unsigned long long) stats.invalid,
+				(unsigned long long) stats.no_sync,
+				(unsigned long long) stats.telegram_ok,
+				(unsigned long long) stats.telegram_corrected,
+				(unsigned long long) stats.telegram_integrity,
+				(unsigned long long) stats.tone_events
+		);
+		fprintf(stderr,
+				"Stats [%d]: per sample, goertzel %.2f, power %.2f, bfsk %.2f " STATS_TIME_UNIT "; "
+				"per bit, telegram %.1f " STATS_TIME_UNIT "\n",
+				i,
+				stats.goertzel.time / samples,
+				stats.power.time / samples,
+				stats.bfsk.time / samples,
+				stats.telegram.time / bits
+		);
+	}
+}
+
+/**
+ * Prints the statistics if requested with SIGUSR1 or if the interval has
+ * elapsed.
+ */
+void check_stats(struct context * ctx) {
+	bool due = stats_requested;
+
+	if (ctx->stats_interval > 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (now.tv_sec > ctx->next_stats.tv_sec || (now.tv_sec == ctx->next_stats.tv_sec && now.tv_nsec >= ctx->next_stats.tv_nsec)) {
+			due = true;
+			ctx->next_stats = now;
+			ctx->next_stats.tv_sec += ctx->stats_interval;
+		}
+	}
+
+	if (due) {
+		stats_requested = 0;
+		print_stats(ctx);
+	}
+}
+
+bool read_loop(struct context * ctx) {
+	if (pthread_create(&ctx->capture_thread, NULL, capture_loop, ctx) != 0) {
+		fprintf(stderr, "Error: could not start capture thread\n");
+		return false;
+	}
+	ctx->capture_started = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &ctx->next_stats);
+	ctx->next_stats.tv_sec += ctx->stats_interval;
+
+	// Capture times are monotonic, so later changes to the wall clock do not make them jump
+	struct timespec wall, mono;
+	clock_gettime(CLOCK_REALTIME, &wall);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	ctx->clock_offset = ((int64_t) wall.tv_sec - mono.tv_sec) * 1000000000 + wall.tv_nsec - mono.tv_nsec;
+
+	struct capture_block * block;
+	while ((block = ring_peek(ctx->ring)) != NULL) {
+		struct timespec start;
+		if (ctx->metrics) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+		}
+
+		for (int i = 0; i < ctx->source_count; i++) {
+			struct source * src = &ctx->sources[i];
+
+			for (int j = 0; j < src->channel_count; j++) {
+				struct channel * ch = &src->channels[j];
+				ch->samples = block_channel(ctx, block, ch->index);
+				ch->sample_count = block->sample_counts[i];
+				ch->capture_time = block->capture_times[i];
+				if (block->dropped_counts[i] > 0) {
+					skip_samples(ch, block->dropped_counts[i]);
+				}
+			}
+		}
+
+		pool_run(ctx->pool, decode_group, ctx, ctx->group_count);
+
+		// Events have been copied out, so the block can be reused already
+		ring_release(ctx->ring);
+
+		// Print in channel order so output does not depend on scheduling
+		for (int i = 0; i < ctx->channel_count; i++) {
+			struct channel * ch = &ctx->channels[i];
+			for (size_t j = 0; j < ch->event_count; j++) {
+				output_event(ctx, ch, &ch->events[j]);
+			}
+			ch->position += ch->sample_count;
+		}
+
+		writer_poll(ctx->out);
+
+		struct ring_stats stats;
+		ring_get_stats(ctx->ring, &stats);
+		report_drops(ctx, &stats);
+
+		if (ctx->metrics) {
+			publish_metrics(ctx, &stats, &start);
+		}
+		check_stats(ctx);
+	}
+
+	return !ctx->capture_failed;
+}
+
+bool add_batch_file(struct context * ctx, const char * path) {
+	struct batch_file * files = realloc(ctx->files, (ctx->file_count + 1) * sizeof(struct batch_file));
+	if (files == NULL) {
+		fprintf(stderr, "Error: could not allocate %zu files\n", ctx->file_count + 1);
+		return false;
+	}
+	ctx->files = files;
+
+	struct batch_file * file = &ctx->files[ctx->file_count];
+	memset(file, 0, sizeof(struct batch_file));
+	file->path = strdup(path);
+	if (file->path == NULL) {
+		fprintf(stderr, "Error: could not allocate %zu files\n", ctx->file_count + 1);
+		return false;
+	}
+
+	ctx->file_count++;
+	return true;
+}
+
+int compare_names(const void * a, const void * b) {
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * Adds a file to the batch, or all the files in a directory, sorted by name
+ * so the output does not depend on the order of the directory.
+ */
+bool add_batch_path(struct context * ctx, const char * path) {
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "Error: could not open \"%s\"\n", path);
+		return false;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		return add_batch_file(ctx, path);
+	}
+
+	DIR * dir = opendir(path);
+	if (dir == NULL) {
+		fprintf(stderr, "Error: could not open directory \"%s\"\n", path);
+		return false;
+	}
+
+	char ** names = NULL;
+	size_t name_count = 0;
+	bool ok = true;
+
+	struct dirent * entry;
+	while (ok && (entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		char * name = malloc(strlen(path) + strlen(entry->d_name) + 2);
+		char ** new_names = realloc(names, (name_count + 1) * sizeof(char *));
+		if (name == NULL || new_names == NULL) {
+			fprintf(stderr, "Error: could not list directory \"%s\"\n", path);
+			free(name);
+			ok = false;
+			break;
+		}
+		names = new_names;
+
+		sprintf(name, "%s/%s", path, entry->d_name);
+		if (stat(name, &st) == 0 && S_ISREG(st.st_mode)) {
+			names[name_count++] = name;
+		} else {
+			free(name);
+		}
+	}
+	closedir(dir);
+
+	qsort(names, name_count, sizeof(char *), compare_names);
+	for (size_t i = 0; i < name_count; i++) {
+		ok = ok && add_batch_file(ctx, names[i]);
+		free(names[i]);
+	}
+	free(names);
+
+	return ok;
+}
+
+bool init_batch(struct context * ctx, int argc, char ** argv) {
+	for (int i = 0; i < argc; i++) {
+		if (!add_batch_path(ctx, argv[i])) {
+			destroy_ctx(ctx);
+			return false;
+		}
+	}
+
+	if (ctx->file_count == 0) {
+		fprintf(stderr, "Error: no files found for batch mode\n");
+		destroy_ctx(ctx);
+		return false;
+	}
+	pthread_mutex_init(&ctx->print_lock, NULL);
+
+	ctx->out = writer_init(STDOUT_FILENO, OUTPUT_BUFFER_SIZE, ctx->flush_millis);
+	if (ctx->out == NULL) {
+		fprintf(stderr, "Error: could not allocate output buffer\n");
+		destroy_ctx(ctx);
+		return false;
+	}
+
+	int threads = ctx->threads;
+	if (threads == 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > (long) ctx->file_count) {
+			threads = ctx->file_count;
+		}
+		if (threads < 1) {
+			threads = 1;
+		}
+	}
+
+	ctx->pool = pool_init(threads);
+	if (ctx->pool == NULL) {
+		fprintf(stderr, "Error: could not start %d decoding threads\n", threads);
+		destroy_ctx(ctx);
+		return false;
+	}
+
+	return true;
+}
+
+bool push_file_event(struct batch_file * file, int channel, const struct uicdemod_event * event) {
+	if (file->event_count == file->event_size) {
+		size_t new_size = file->event_size ? file->event_size * 2 : 16;
+		struct file_event * events = realloc(file->events, new_size * sizeof(struct file_event));
+		if (events == NULL) {
+			fprintf(stderr, "Error: could not store event for \"%s\"\n", file->path);
+			return false;
+		}
+		file->events = events;
+		file->event_size = new_size;
+	}
+
+	file->events[file->event_count].channel = channel;
+	file->events[file->event_count].event = *event;
+	file->event_count++;
+	return true;
+}
+
+/**
+ * Decodes a whole file of the batch, keeping its events in the same order as
+ * if decoded live.
+ */
+bool decode_file(struct context * ctx, struct batch_file * file) {
+	input_t * in = input_open_file(file->path, ctx->input_format, ctx->sample_rate, ctx->input_channels);
+	if (in == NULL) {
+		return false;
+	}
+
+	channelizer_t * channelizer;
+	if (!check_input(ctx, in) || !init_channelizer(ctx, in, &channelizer)) {
+		input_free(in);
+		return false;
+	}
+
+	file->sample_rate = input_sample_rate(in);
+	file->channel_count = input_channels(in);
+
+	bool iq = input_is_iq(in);
+	size_t sample_size = ctx->fixed_point ? sizeof(int16_t) : sizeof(float);
+	if (iq) {
+		sample_size = 2 * sizeof(float);
+	}
+	size_t input_count = ceil(ctx->buffer_millis * file->sample_rate / 1000.0);
+	size_t sample_count = input_count;
+
+	int channel_rate = file->sample_rate;
+	float * wideband = NULL;
+	if (channelizer) {
+		file->channel_count = file->sample_rate / ctx->channel_spacing;
+		channel_rate = 2 * ctx->channel_spacing;
+		sample_count = channelizer_max_output(channelizer, input_count);
+		wideband = malloc(2 * input_count * sizeof(float));
+	}
+
+	file->channels = calloc(file->channel_count, sizeof(struct channel));
+	void ** buffers = malloc(file->channel_count * sizeof(void *));
+	char * samples = malloc(file->channel_count * sample_count * sample_size);
+	bool ok = file->channels != NULL && buffers != NULL && samples != NULL && (wideband != NULL || channelizer == NULL);
+	if (!ok) {
+		fprintf(stderr, "Error: could not allocate buffers for \"%s\"\n", file->path);
+	}
+
+	for (int i = 0; ok && i < file->channel_count; i++) {
+		struct channel * ch = &file->channels[i];
+		ch->index = i;
+		ch->capture_time = -1;
+		buffers[i] = samples + i * sample_count * sample_size;
+		ok = init_channel(ctx, ch, channel_rate, sample_count, iq);
+		ch->input_decimation = channelizer ? file->channel_count / 2 : 1;
+	}
+
+	while (ok) {
+		ssize_t read_count;
+		if (channelizer) {
+			read_count = input_read_iq(in, wideband, input_count);
+		} else if (iq) {
+			read_count = input_read_iq(in, buffers[0], sample_count);
+		} else if (ctx->fixed_point) {
+			read_count = input_read_s16(in, (int16_t **) buffers, sample_count);
+		} else {
+			read_count = input_read(in, (float **) buffers, sample_count);
+		}
+		if (read_count <= 0) {
+			ok = read_count == 0;
+			break;
+		}
+
+		size_t channel_samples = read_count;
+		if (channelizer) {
+			channel_samples = channelizer_process(channelizer, wideband, read_count, (float **) buffers);
+		}
+
+		for (int i = 0; i < file->channel_count; i++) {
+			struct channel * ch = &file->channels[i];
+			ch->samples = buffers[i];
+			ch->sample_count = channel_samples;
+			ch->event_count = 0;
+			decode_samples(ctx, ch);
+
+			for (size_t j = 0; ok && j < ch->event_count; j++) {
+				ok = push_file_event(file, i, &ch->events[j]);
+			}
+		}
+		file->sample_count += read_count;
+		file->decoded_count += channel_samples * file->channel_count;
+	}
+
+	// Only the channel numbers and rates are needed to print the events
+	if (file->channels) {
+		for (int i = 0; i < file->channel_count; i++) {
+			free_channel(&file->channels[i]);
+		}
+	}
+	free(samples);
+	free(buffers);
+	free(wideband);
+	channelizer_free(channelizer);
+	input_free(in);
+
+	return ok;
+}
+
+void print_file(struct context * ctx, struct batch_file * file) {
+	ctx->current_file = file->path;
+	ctx->tag_channels = file->channel_count > 1;
+
+	if (ctx->output_format == OUTPUT_TEXT) {
+		writer_printf(ctx->out, "File: %s%s\n", file->path, file->failed ? " (failed)" : "");
+	}
+
+	for (size_t i = 0; i < file->event_count; i++) {
+		struct file_event * e = &file->events[i];
+		output_event(ctx, &file->channels[e->channel], &e->event);
+	}
+}
+
+/**
+ * Formats the output of a decoded file into its own memory writer. Output
+ * functions only read the options from the context, so each thread gives
+ * them a copy of it writing to that file. The copy is taken under the lock,
+ * which guards the only fields that change during a batch.
+ */
+bool format_file(struct context * ctx, struct batch_file * file) {
+	file->output = writer_init_memory(OUTPUT_BUFFER_SIZE);
+	if (file->output == NULL) {
+		fprintf(stderr, "Error: could not allocate output for \"%s\"\n", file->path);
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->print_lock);
+	struct context file_ctx = *ctx;
+	pthread_mutex_unlock(&ctx->print_lock);
+
+	file_ctx.out = file->output;
+	print_file(&file_ctx, file);
+	return true;
+}
+
+/**
+ * Pool job decoding a file of the batch. Its output is formatted right away,
+ * and files are written out in order as soon as all the ones before them are
+ * done, by whichever thread completes the last of them. Only copying the
+ * formatted output is done under the lock.
+ */
+void decode_batch_file(void * arg, size_t index) {
+	struct context * ctx = arg;
+	struct batch_file * file = &ctx->files[index];
+
+	file->failed = !decode_file(ctx, file);
+	if (!format_file(ctx, file)) {
+		file->failed = true;
+	}
+	free_file(file);
+
+	pthread_mutex_lock(&ctx->print_lock);
+	file->done = true;
+	while (ctx->next_file < ctx->file_count && ctx->files[ctx->next_file].done) {
+		struct batch_file * next = &ctx->files[ctx->next_file++];
+		if (next->output) {
+			writer_append(ctx->out, next->output);
+			writer_free(next->output);
+			next->output = NULL;
+		}
+		writer_poll(ctx->out);
+	}
+	pthread_mutex_unlock(&ctx->print_lock);
+}
+
+bool run_batch(struct context * ctx) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pool_run(ctx->pool, decode_batch_file, ctx, ctx->file_count);
+	writer_flush(ctx->out);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	size_t failed = 0;
+	double audio_seconds = 0;
+	double samples = 0;
+	for (size_t i = 0; i < ctx->file_count; i++) {
+		struct batch_file * file = &ctx->files[i];
+		if (file->failed) {
+			failed++;
+		}
+		if (file->sample_rate > 0) {
+			audio_seconds += (double) file->sample_count / file->sample_rate;
+		}
+		samples += file->decoded_count;
+	}
+
+	fprintf(stderr,
+			"Decoded %zu files (%zu failed): %.1fs of audio in %.2fs on %d threads, "
+			"%.0fx real time, %.2f Msamples/s\n",
+			ctx->file_count, failed, audio_seconds, elapsed, pool_threads(ctx->pool),
+			audio_seconds / elapsed, samples / elapsed / 1e6
+	);
+
+	return failed == 0;
+}
+
+void request_stats(int signum) {
+	stats_requested = 1;
+}
+
+int main(int argc, char ** argv) {
+	struct context ctx = { 0 };
+
+	if (!parse_config(&ctx, argc, argv)) {
+		return 1;
+	}
+
+	if (STATS_ENABLED) {
+		struct sigaction action = {
+			.sa_handler = request_stats,
+			.sa_flags = SA_RESTART
+		};
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGUSR1, &action, NULL);
+	}
+
+	if (ctx.batch) {
+		if (!init_batch(&ctx, argc - optind, argv + optind)) {
+			return 2;
+		}
+
+		bool ok = run_batch(&ctx);
+		destroy_ctx(&ctx);
+		return ok ? 0 : 3;
 	}
 
 	if (!init_ctx(&ctx)) {
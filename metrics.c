@@ -0,0 +1,346 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// Longest request read from a client, the rest is ignored
+#define MAX_REQUEST 4096
+
+// Clients not sending or accepting data for this long are dropped
+#define CLIENT_TIMEOUT_SECS 1
+
+// Wait before accepting again after an error that would not go away at once,
+// such as running out of file descriptors
+#define ACCEPT_BACKOFF_MILLIS 100
+
+struct metrics {
+	char * path;
+	int fd;
+	int channel_count;
+
+	pthread_t thread;
+	bool thread_started;
+	atomic_bool stopping;
+
+	/**
+	 * Sequence lock over the published snapshot: odd while it is being
+	 * written, and incremented again once done
+	 */
+	atomic_uint sequence;
+	struct metrics_snapshot published;
+
+	/**
+	 * Copy taken by the server for each client
+	 */
+	struct metrics_snapshot copy;
+};
+
+// Upper bounds of the decoding time histogram, in seconds, the last one being infinite
+static const double loop_bounds[METRICS_BUCKETS - 1] = {
+	0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25
+};
+
+struct channel_counter {
+	const char * name;
+	const char * help;
+	size_t offset;
+};
+
+static const struct channel_counter channel_counters[] = {
+	{ "uicdemod_samples_total", "Samples analyzed.", offsetof(struct uicdemod_stats, samples) },
+	{ "uicdemod_idle_samples_total", "Samples skipped by the BFSK demodulator for lack of a telegram.", offsetof(struct uicdemod_stats, idle) },
+	{ "uicdemod_bits_total", "Valid bits demodulated.", offsetof(struct uicdemod_stats, bits) },
+	{ "uicdemod_invalid_symbols_total", "Invalid symbols resetting the telegram parser.", offsetof(struct uicdemod_stats, invalid) },
+	{ "uicdemod_unsynced_bits_total", "Bits after which no sync word was found.", offsetof(struct uicdemod_stats, no_sync) },
+	{ "uicdemod_tone_events_total", "Tone events issued, including silences.", offsetof(struct uicdemod_stats, tone_events) }
+};
+
+static const char * tone_names[] = {
+	[UICDEMOD_NONE] = "none",
+	[UICDEMOD_WARNING] = "warning",
+	[UICDEMOD_LISTENING] = "listening",
+	[UICDEMOD_CHFREE] = "channel_free",
+	[UICDEMOD_PILOT] = "pilot",
+	[UICDEMOD_SILENCE] = "silence"
+};
+
+static void * metrics_thread(void * arg);
+
+metrics_t * metrics_init(const char * path, int channel_count) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: metrics socket path is too long\n");
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	metrics_t * m = calloc(1, sizeof(struct metrics));
+	if (m == NULL) {
+		return NULL;
+	}
+
+	m->fd = -1;
+	m->channel_count = channel_count;
+	m->path = strdup(path);
+	m->published.channels = calloc(channel_count, sizeof(struct uicdemod_stats));
+	m->copy.channels = calloc(channel_count, sizeof(struct uicdemod_stats));
+	if (m->path == NULL || m->published.channels == NULL || m->copy.channels == NULL) {
+		metrics_free(m);
+		return NULL;
+	}
+
+	// Replace the socket of a previous run, but never anything else
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	m->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m->fd < 0 || bind(m->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(m->fd, 8) < 0) {
+		fprintf(stderr, "Error: could not listen on metrics socket \"%s\"\n", path);
+		free(m->path);
+		m->path = NULL;
+		metrics_free(m);
+		return NULL;
+	}
+
+	if (pthread_create(&m->thread, NULL, metrics_thread, m) != 0) {
+		fprintf(stderr, "Error: could not start metrics thread\n");
+		metrics_free(m);
+		return NULL;
+	}
+	m->thread_started = true;
+
+	return m;
+}
+
+void metrics_observe_loop(struct metrics_snapshot * s, double seconds) {
+	int bucket = 0;
+	while (bucket < METRICS_BUCKETS - 1 && seconds > loop_bounds[bucket]) {
+		bucket++;
+	}
+
+	s->loop_buckets[bucket]++;
+	s->loop_count++;
+	s->loop_seconds += seconds;
+}
+
+/**
+ * Copies a snapshot, including the counters of the channels.
+ */
+static void copy_snapshot(metrics_t * m, struct metrics_snapshot * dst, const struct metrics_snapshot * src) {
+	struct uicdemod_stats * channels = dst->channels;
+	*dst = *src;
+	dst->channels = channels;
+	memcpy(dst->channels, src->channels, m->channel_count * sizeof(struct uicdemod_stats));
+}
+
+void metrics_publish(metrics_t * m, const struct metrics_snapshot * s) {
+	unsigned int sequence = atomic_load_explicit(&m->sequence, memory_order_relaxed);
+
+	atomic_store_explicit(&m->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	copy_snapshot(m, &m->published, s);
+
+	atomic_store_explicit(&m->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Copies the published snapshot, retrying until it was not being written
+ * meanwhile.
+ */
+static void read_snapshot(metrics_t * m) {
+	while (1) {
+		unsigned int sequence = atomic_load_explicit(&m->sequence, memory_order_acquire);
+		if (sequence & 1) {
+			sched_yield();
+			continue;
+		}
+
+		copy_snapshot(m, &m->copy, &m->published);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&m->sequence, memory_order_relaxed) == sequence) {
+			return;
+		}
+	}
+}
+
+/**
+ * Writes the copied snapshot in the Prometheus text format.
+ */
+static void format_snapshot(metrics_t * m, FILE * f) {
+	const struct metrics_snapshot * s = &m->copy;
+
+	for (size_t i = 0; i < sizeof(channel_counters) / sizeof(channel_counters[0]); i++) {
+		const struct channel_counter * counter = &channel_counters[i];
+		fprintf(f, "# HELP %s %s\n", counter->name, counter->help);
+		fprintf(f, "# TYPE %s counter\n", counter->name);
+		for (int ch = 0; ch < m->channel_count; ch++) {
+			const uint64_t * value = (const uint64_t *) ((const char *) &s->channels[ch] + counter->offset);
+			fprintf(f, "%s{channel=\"%d\"} %llu\n", counter->name, ch, (unsigned long long) *value);
+		}
+	}
+
+	fprintf(f, "# HELP uicdemod_telegrams_total Telegrams received, by integrity check result.\n");
+	fprintf(f, "# TYPE uicdemod_telegrams_total counter\n");
+	for (int ch = 0; ch < m->channel_count; ch++) {
+		const struct uicdemod_stats * stats = &s->channels[ch];
+		fprintf(f, "uicdemod_telegrams_total{channel=\"%d\",result=\"ok\"} %llu\n", ch, (unsigned long long) stats->telegram_ok);
+		fprintf(f, "uicdemod_telegrams_total{channel=\"%d\",result=\"corrected\"} %llu\n", ch, (unsigned long long) stats->telegram_corrected);
+		fprintf(f, "uicdemod_telegrams_total{channel=\"%d\",result=\"crc_fail\"} %llu\n", ch, (unsigned long long) stats->telegram_integrity);
+	}
+
+	fprintf(f, "# HELP uicdemod_tone Last tone detected on the channel.\n");
+	fprintf(f, "# TYPE uicdemod_tone gauge\n");
+	for (int ch = 0; ch < m->channel_count; ch++) {
+		for (size_t tone = 0; tone < sizeof(tone_names) / sizeof(tone_names[0]); tone++) {
+			fprintf(f, "uicdemod_tone{channel=\"%d\",tone=\"%s\"} %d\n", ch, tone_names[tone], s->channels[ch].tone == tone);
+		}
+	}
+
+	fprintf(f, "# HELP uicdemod_buffers_total Capture buffers decoded.\n");
+	fprintf(f, "# TYPE uicdemod_buffers_total counter\n");
+	fprintf(f, "uicdemod_buffers_total %lu\n", s->buffers);
+
+	fprintf(f, "# HELP uicdemod_capture_overruns_total Capture buffers dropped because decoding fell behind.\n");
+	fprintf(f, "# TYPE uicdemod_capture_overruns_total counter\n");
+	fprintf(f, "uicdemod_capture_overruns_total %lu\n", s->overruns);
+
+	fprintf(f, "# HELP uicdemod_read_loop_seconds Time taken to decode and print each capture buffer.\n");
+	fprintf(f, "# TYPE uicdemod_read_loop_seconds histogram\n");
+	uint64_t cumulative = 0;
+	for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+		cumulative += s->loop_buckets[bucket];
+		if (bucket < METRICS_BUCKETS - 1) {
+			fprintf(f, "uicdemod_read_loop_seconds_bucket{le=\"%g\"} %llu\n", loop_bounds[bucket], (unsigned long long) cumulative);
+		} else {
+			fprintf(f, "uicdemod_read_loop_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long) cumulative);
+		}
+	}
+	fprintf(f, "uicdemod_read_loop_seconds_sum %.9f\n", s->loop_seconds);
+	fprintf(f, "uicdemod_read_loop_seconds_count %llu\n", (unsigned long long) s->loop_count);
+}
+
+/**
+ * Writes a whole buffer to a client, giving up on errors.
+ */
+static bool send_all(int fd, const char * data, size_t size) {
+	while (size > 0) {
+		ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+		if (sent <= 0) {
+			return false;
+		}
+		data += sent;
+		size -= sent;
+	}
+
+	return true;
+}
+
+/**
+ * Reads the request of a client up to the end of its headers, and replies
+ * with the metrics whatever was asked.
+ */
+static void serve_client(metrics_t * m, int fd) {
+	struct timeval timeout = { .tv_sec = CLIENT_TIMEOUT_SECS };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	char request[MAX_REQUEST + 1];
+	size_t request_size = 0;
+	while (request_size < MAX_REQUEST) {
+		ssize_t received = recv(fd, request + request_size, MAX_REQUEST - request_size, 0);
+		if (received <= 0) {
+			break;
+		}
+		request_size += received;
+		request[request_size] = '\0';
+
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+			break;
+		}
+	}
+
+	read_snapshot(m);
+
+	char * body = NULL;
+	size_t body_size = 0;
+	FILE * f = open_memstream(&body, &body_size);
+	if (f == NULL) {
+		return;
+	}
+	format_snapshot(m, f);
+	fclose(f);
+
+	char header[128];
+	int header_size = snprintf(header, sizeof(header),
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"\r\n",
+			body_size
+	);
+
+	if (send_all(fd, header, header_size)) {
+		send_all(fd, body, body_size);
+	}
+	free(body);
+}
+
+static void * metrics_thread(void * arg) {
+	metrics_t * m = arg;
+
+	while (!atomic_load(&m->stopping)) {
+		int client = accept(m->fd, NULL, NULL);
+		if (client < 0) {
+			// Shutting down fails it too, which needs no waiting
+			if (errno != EINTR && errno != ECONNABORTED && !atomic_load(&m->stopping)) {
+				struct timespec backoff = { 0, ACCEPT_BACKOFF_MILLIS * 1000000L };
+				nanosleep(&backoff, NULL);
+			}
+			continue;
+		}
+
+		serve_client(m, client);
+		close(client);
+	}
+
+	return NULL;
+}
+
+void metrics_free(metrics_t * m) {
+	if (m == NULL) {
+		return;
+	}
+
+	// Shutting the socket down wakes up the thread if waiting for clients
+	if (m->thread_started) {
+		atomic_store(&m->stopping, true);
+		shutdown(m->fd, SHUT_RDWR);
+		pthread_join(m->thread, NULL);
+	}
+
+	if (m->fd >= 0) {
+		close(m->fd);
+	}
+	if (m->path) {
+		unlink(m->path);
+		free(m->path);
+	}
+	free(m->copy.channels);
+	free(m->published.channels);
+	free(m);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include "uicdemod.h"
+
+typedef struct metrics metrics_t;
+
+// Number of buckets of the decoding time histogram, including the last one
+#define METRICS_BUCKETS 12
+
+/**
+ * Metrics of the decoder, built by the decoding thread
+ */
+struct metrics_snapshot {
+	/**
+	 * Capture buffers decoded and dropped
+	 */
+	unsigned long buffers;
+	unsigned long overruns;
+
+	/**
+	 * Histogram of the time taken to decode each buffer, see
+	 * metrics_observe_loop
+	 */
+	uint64_t loop_buckets[METRICS_BUCKETS];
+	uint64_t loop_count;
+	double loop_seconds;
+
+	/**
+	 * Counters of each channel, as many as given to metrics_init
+	 */
+	struct uicdemod_stats * channels;
+};
+
+/**
+ * Starts serving metrics in the Prometheus text format over a Unix domain
+ * socket, from a thread of its own. Each connection gets an HTTP response
+ * with the last published snapshot and is closed.
+ *
+ * A stale socket left at the path is replaced.
+ *
+ * @param path Socket path
+ * @param channel_count Number of channels in each snapshot
+ * @returns New metrics server, or NULL on error
+ */
+metrics_t * metrics_init(const char * path, int channel_count);
+
+/**
+ * Adds the time taken to decode a buffer to the histogram of a snapshot.
+ *
+ * @param s Snapshot
+ * @param seconds Time taken
+ */
+void metrics_observe_loop(struct metrics_snapshot * s, double seconds);
+
+/**
+ * Publishes a new snapshot. Never blocks: it is copied without locks, and the
+ * server retries reading it if it changed meanwhile. Must always be called
+ * from the same thread.
+ *
+ * @param m Metrics server
+ * @param s Snapshot
+ */
+void metrics_publish(metrics_t * m, const struct metrics_snapshot * s);
+
+/**
+ * Stops serving metrics, removes the socket and destroys the server. Accepts
+ * NULL.
+ *
+ * @param m Metrics server
+ */
+void metrics_free(metrics_t * m);
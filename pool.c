@@ -0,0 +1,154 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+struct pool {
+	pthread_t * workers;
+	int worker_count;
+
+	pthread_mutex_t lock;
+
+	/**
+	 * Signalled when a new batch is posted or the pool is stopping
+	 */
+	pthread_cond_t start;
+
+	/**
+	 * Signalled when the last job of a batch finishes
+	 */
+	pthread_cond_t done;
+
+	/**
+	 * Current batch. Jobs are handed out in order by bumping next_job.
+	 */
+	pool_job_t job;
+	void * arg;
+	size_t job_count;
+	size_t next_job;
+	size_t pending_jobs;
+
+	/**
+	 * Incremented for each batch so sleeping workers notice new ones
+	 */
+	unsigned long generation;
+
+	bool stopping;
+};
+
+/**
+ * Runs jobs from the current batch until none are left. Must be called with
+ * the lock held, and returns with it held.
+ */
+static void pool_drain(pool_t * p) {
+	while (p->next_job < p->job_count) {
+		size_t index = p->next_job++;
+
+		pthread_mutex_unlock(&p->lock);
+		p->job(p->arg, index);
+		pthread_mutex_lock(&p->lock);
+
+		p->pending_jobs--;
+		if (p->pending_jobs == 0) {
+			pthread_cond_signal(&p->done);
+		}
+	}
+}
+
+static void * pool_worker(void * arg) {
+	pool_t * p = arg;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&p->lock);
+	while (1) {
+		while (!p->stopping && p->generation == seen) {
+			pthread_cond_wait(&p->start, &p->lock);
+		}
+
+		if (p->stopping) {
+			break;
+		}
+
+		seen = p->generation;
+		pool_drain(p);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+pool_t * pool_init(int threads) {
+	pool_t * p = calloc(1, sizeof(struct pool));
+	if (p == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+
+	if (threads > 1) {
+		p->workers = malloc(sizeof(pthread_t) * (threads - 1));
+		if (p->workers == NULL) {
+			pool_free(p);
+			return NULL;
+		}
+
+		for (int i = 0; i < threads - 1; i++) {
+			if (pthread_create(&p->workers[i], NULL, pool_worker, p) != 0) {
+				pool_free(p);
+				return NULL;
+			}
+			p->worker_count++;
+		}
+	}
+
+	return p;
+}
+
+void pool_run(pool_t * p, pool_job_t job, void * arg, size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->job = job;
+	p->arg = arg;
+	p->job_count = count;
+	p->next_job = 0;
+	p->pending_jobs = count;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+
+	// Help with the batch instead of sleeping
+	pool_drain(p);
+
+	while (p->pending_jobs > 0) {
+		pthread_cond_wait(&p->done, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+int pool_threads(pool_t * p) {
+	return p->worker_count + 1;
+}
+
+void pool_free(pool_t * p) {
+	if (p == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->stopping = true;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+
+	for (int i = 0; i < p->worker_count; i++) {
+		pthread_join(p->workers[i], NULL);
+	}
+
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->start);
+	pthread_mutex_destroy(&p->lock);
+	free(p->workers);
+	free(p);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdlib.h>
+
+typedef struct pool pool_t;
+
+/**
+ * Job function, called once for each index in the batch.
+ *
+ * @param arg Opaque job argument
+ * @param index Job index, from zero to batch size minus one
+ */
+typedef void (*pool_job_t)(void * arg, size_t index);
+
+/**
+ * Initializes a fixed pool of worker threads.
+ *
+ * Jobs of a batch wait in a single shared queue, and each thread takes the
+ * next one in order as soon as it is free, under the pool lock. There are no
+ * per-thread queues and no work stealing: jobs are meant to be coarse, such
+ * as a channel's buffer or a whole file, so taking the lock once per job
+ * costs little next to running it.
+ *
+ * The calling thread also works on batches, so a pool with a single thread
+ * does not spawn any workers at all.
+ *
+ * @param threads Total number of threads, including the caller
+ * @returns New pool, or NULL on error
+ */
+pool_t * pool_init(int threads);
+
+/**
+ * Runs a batch of jobs, blocking until all of them are done.
+ *
+ * @param p Thread pool
+ * @param job Job function
+ * @param arg Opaque argument passed to job function
+ * @param count Number of jobs in batch
+ */
+void pool_run(pool_t * p, pool_job_t job, void * arg, size_t count);
+
+/**
+ * Returns the total number of threads in the pool, including the caller.
+ *
+ * @param p Thread pool
+ * @returns Thread count
+ */
+int pool_threads(pool_t * p);
+
+/**
+ * Stops the workers and destroys the pool. Accepts NULL.
+ *
+ * @param p Thread pool
+ */
+void pool_free(pool_t * p);
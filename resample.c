@@ -0,0 +1,162 @@
+#include "resample.h"
+#include <string.h>
+#include <math.h>
+
+struct resample {
+	/**
+	 * Interpolation and decimation factors
+	 */
+	size_t up;
+	size_t down;
+
+	/**
+	 * Filter taps for each phase, in the same order as the history window
+	 * (oldest sample first), so each output is a straight dot product.
+	 */
+	float * phases;
+	size_t taps;
+
+	/**
+	 * Last input samples, stored twice back to back so the window starting
+	 * at history_idx is always contiguous
+	 */
+	float * history;
+	size_t history_idx;
+
+	/**
+	 * Index of the next output sample, relative to the newest input sample,
+	 * in units of 1/up input samples
+	 */
+	size_t phase;
+};
+
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+// Normalized transition width of a Blackman window, times filter length
+#define BLACKMAN_WIDTH 5.5
+
+// Partial sums per output sample. Filter phases are made a multiple of it.
+#define ACCUMULATORS 8
+
+static size_t gcd(size_t a, size_t b) {
+	while (b != 0) {
+		size_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+resample_t * resample_init(int input_rate, int output_rate, float passband) {
+	if (input_rate <= 0 || output_rate <= 0) {
+		return NULL;
+	}
+
+	/*
+	 * Everything above half the lower rate is cut off. Frequencies between
+	 * the passband and the cutoff may alias, but only onto the band between
+	 * the passband and the new Nyquist frequency, so the transition band can
+	 * be twice as wide as in a regular lowpass filter.
+	 */
+	float cutoff = (input_rate < output_rate ? input_rate : output_rate) / 2.0;
+	float transition = 2 * (cutoff - passband);
+	if (transition <= 0) {
+		return NULL;
+	}
+
+	resample_t * r = calloc(1, sizeof(struct resample));
+	if (r == NULL) {
+		return NULL;
+	}
+
+	size_t divisor = gcd(input_rate, output_rate);
+	r->up = output_rate / divisor;
+	r->down = input_rate / divisor;
+	r->taps = ceil(BLACKMAN_WIDTH * input_rate / transition / ACCUMULATORS) * ACCUMULATORS;
+
+	r->phases = malloc(sizeof(float) * r->up * r->taps);
+	r->history = calloc(2 * r->taps, sizeof(float));
+	if (r->phases == NULL || r->history == NULL) {
+		resample_free(r);
+		return NULL;
+	}
+
+	/******************************************
+	 * windowed sinc at input rate times "up" *
+	 ******************************************/
+	size_t length = r->up * r->taps;
+	float rate = (float) input_rate * r->up;
+	float center = (length - 1) / 2.0;
+
+	for (size_t phase = 0; phase < r->up; phase++) {
+		for (size_t tap = 0; tap < r->taps; tap++) {
+			// Tap "tap" of a phase multiplies the sample that many steps back
+			size_t n = phase + tap * r->up;
+			float t = (n - center) / rate;
+			float sinc = t == 0 ? 2 * cutoff / rate : sin(2 * PI * cutoff * t) / (PI * t * rate);
+			float window = 0.42 - 0.5 * cos(2 * PI * n / (length - 1)) + 0.08 * cos(4 * PI * n / (length - 1));
+
+			// Zero stuffing loses a factor of "up" in gain - restore it
+			r->phases[phase * r->taps + (r->taps - 1 - tap)] = sinc * window * r->up;
+		}
+	}
+
+	return r;
+}
+
+size_t resample_max_output(resample_t * r, size_t input_count) {
+	return (input_count * r->up + r->down - 1) / r->down + 1;
+}
+
+size_t resample_process(resample_t * r, const float * input, size_t input_count, float * output) {
+	size_t output_count = 0;
+
+	for (size_t i = 0; i < input_count; i++) {
+		r->history[r->history_idx] = input[i];
+		r->history[r->history_idx + r->taps] = input[i];
+		if (++r->history_idx == r->taps) {
+			r->history_idx = 0;
+		}
+
+		// Emit every output falling between this input sample and the next
+		const float * window = r->history + r->history_idx;
+		while (r->phase < r->up) {
+			const float * taps = r->phases + r->phase * r->taps;
+			// Independent partial sums, so the compiler can vectorize it
+			float sum[ACCUMULATORS] = { 0 };
+			for (size_t tap = 0; tap < r->taps; tap += ACCUMULATORS) {
+				for (int i = 0; i < ACCUMULATORS; i++) {
+					sum[i] += taps[tap + i] * window[tap + i];
+				}
+			}
+
+			float total = 0;
+			for (int i = 0; i < ACCUMULATORS; i++) {
+				total += sum[i];
+			}
+			output[output_count++] = total;
+			r->phase += r->down;
+		}
+		r->phase -= r->up;
+	}
+
+	return output_count;
+}
+
+void resample_reset(resample_t * r) {
+	memset(r->history, 0, 2 * r->taps * sizeof(float));
+	r->history_idx = 0;
+	r->phase = 0;
+}
+
+void resample_free(resample_t * r) {
+	if (r == NULL) {
+		return;
+	}
+
+	free(r->history);
+	free(r->phases);
+	free(r);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stdlib.h>
+
+typedef struct resample resample_t;
+
+/**
+ * Initializes a polyphase FIR sample rate converter, for feeding the
+ * demodulators at a lower rate than the capture one.
+ *
+ * The conversion ratio is reduced to output_rate / input_rate in lowest
+ * terms, and one filter phase is kept for each step of the numerator, so
+ * rates sharing a large common divisor (such as 48000 and 12000, or 44100
+ * and 11025) are much cheaper to set up.
+ *
+ * @param input_rate Input sample rate
+ * @param output_rate Output sample rate
+ * @param passband Highest frequency that must be kept undistorted. Must be
+ *                 below half of both rates.
+ * @returns New resampler, or NULL on error
+ */
+resample_t * resample_init(int input_rate, int output_rate, float passband);
+
+/**
+ * Returns the maximum number of samples that resample_process can output for
+ * a given number of input samples.
+ *
+ * @param r Resampler
+ * @param input_count Number of input samples
+ * @returns Maximum number of output samples
+ */
+size_t resample_max_output(resample_t * r, size_t input_count);
+
+/**
+ * Resamples a buffer. Filter state is kept between calls, so a stream can be
+ * processed using buffers of any size.
+ *
+ * @param r Resampler
+ * @param input Input samples
+ * @param input_count Number of input samples
+ * @param output Output buffer, with room for resample_max_output samples
+ * @returns Number of output samples
+ */
+size_t resample_process(resample_t * r, const float * input, size_t input_count, float * output);
+
+/**
+ * Forgets the samples seen so far, as if the stream started anew with the
+ * next sample.
+ *
+ * @param r Resampler
+ */
+void resample_reset(resample_t * r);
+
+/**
+ * Destroys the resampler. Accepts NULL.
+ *
+ * @param r Resampler
+ */
+void resample_free(resample_t * r);
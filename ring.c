@@ -0,0 +1,157 @@
+#include "ring.h"
+#include <string.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+// Keeps blocks, and the producer and consumer positions, on separate cache lines
+#define CACHE_LINE 64
+
+struct ring {
+	char * blocks;
+	size_t block_size;
+	size_t block_count;
+	bool drop_when_full;
+
+	/**
+	 * Number of blocks ever committed and released. Each one is only written
+	 * by one side, so the difference is the current occupancy.
+	 */
+	_Alignas(CACHE_LINE) atomic_size_t write_pos;
+	atomic_size_t max_occupancy;
+	atomic_ulong dropped;
+
+	// Set by ring_acquire when the ring was full and the spare block was given
+	bool acquired_spare;
+
+	_Alignas(CACHE_LINE) atomic_size_t read_pos;
+
+	/**
+	 * Wake up the consumer for each committed block, and the producer for
+	 * each released one. System calls are only made to sleep and wake up,
+	 * never to hand over blocks.
+	 */
+	sem_t filled;
+	sem_t freed;
+
+	atomic_bool closed;
+};
+
+ring_t * ring_init(size_t block_size, size_t block_count, bool drop_when_full) {
+	if (block_count == 0) {
+		return NULL;
+	}
+
+	ring_t * r = aligned_alloc(CACHE_LINE, sizeof(struct ring));
+	if (r == NULL) {
+		return NULL;
+	}
+	memset(r, 0, sizeof(struct ring));
+
+	r->block_size = (block_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	r->block_count = block_count;
+	r->drop_when_full = drop_when_full;
+
+	// One extra block to write into while the ring is full
+	r->blocks = aligned_alloc(CACHE_LINE, r->block_size * (block_count + 1));
+	if (r->blocks == NULL) {
+		free(r);
+		return NULL;
+	}
+
+	atomic_init(&r->write_pos, 0);
+	atomic_init(&r->read_pos, 0);
+	atomic_init(&r->max_occupancy, 0);
+	atomic_init(&r->dropped, 0);
+	atomic_init(&r->closed, false);
+	sem_init(&r->filled, 0, 0);
+	sem_init(&r->freed, 0, 0);
+
+	return r;
+}
+
+void * ring_acquire(ring_t * r) {
+	size_t write_pos = atomic_load_explicit(&r->write_pos, memory_order_relaxed);
+
+	while (write_pos - atomic_load_explicit(&r->read_pos, memory_order_acquire) == r->block_count) {
+		if (r->drop_when_full) {
+			r->acquired_spare = true;
+			return r->blocks + r->block_size * r->block_count;
+		}
+
+		sem_wait(&r->freed);
+	}
+
+	r->acquired_spare = false;
+	return r->blocks + r->block_size * (write_pos % r->block_count);
+}
+
+bool ring_commit(ring_t * r) {
+	if (r->acquired_spare) {
+		atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+		return false;
+	}
+
+	size_t write_pos = atomic_load_explicit(&r->write_pos, memory_order_relaxed) + 1;
+	atomic_store_explicit(&r->write_pos, write_pos, memory_order_release);
+
+	size_t occupancy = write_pos - atomic_load_explicit(&r->read_pos, memory_order_relaxed);
+	if (occupancy > atomic_load_explicit(&r->max_occupancy, memory_order_relaxed)) {
+		atomic_store_explicit(&r->max_occupancy, occupancy, memory_order_relaxed);
+	}
+
+	sem_post(&r->filled);
+	return true;
+}
+
+void ring_close(ring_t * r) {
+	atomic_store_explicit(&r->closed, true, memory_order_release);
+	sem_post(&r->filled);
+}
+
+void * ring_peek(ring_t * r) {
+	size_t read_pos = atomic_load_explicit(&r->read_pos, memory_order_relaxed);
+
+	while (atomic_load_explicit(&r->write_pos, memory_order_acquire) == read_pos) {
+		if (atomic_load_explicit(&r->closed, memory_order_acquire)) {
+			// Blocks committed right before closing must not be lost
+			if (atomic_load_explicit(&r->write_pos, memory_order_acquire) != read_pos) {
+				break;
+			}
+			return NULL;
+		}
+
+		sem_wait(&r->filled);
+	}
+
+	return r->blocks + r->block_size * (read_pos % r->block_count);
+}
+
+void ring_release(ring_t * r) {
+	size_t read_pos = atomic_load_explicit(&r->read_pos, memory_order_relaxed);
+	atomic_store_explicit(&r->read_pos, read_pos + 1, memory_order_release);
+
+	if (!r->drop_when_full) {
+		sem_post(&r->freed);
+	}
+}
+
+void ring_get_stats(ring_t * r, struct ring_stats * stats) {
+	size_t read_pos = atomic_load_explicit(&r->read_pos, memory_order_acquire);
+	size_t write_pos = atomic_load_explicit(&r->write_pos, memory_order_acquire);
+
+	stats->occupancy = write_pos - read_pos;
+	stats->max_occupancy = atomic_load_explicit(&r->max_occupancy, memory_order_relaxed);
+	stats->committed = write_pos;
+	stats->dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+}
+
+void ring_free(ring_t * r) {
+	if (r == NULL) {
+		return;
+	}
+
+	sem_destroy(&r->freed);
+	sem_destroy(&r->filled);
+	free(r->blocks);
+	free(r);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef struct ring ring_t;
+
+/**
+ * Ring statistics
+ */
+struct ring_stats {
+	/**
+	 * Blocks waiting to be read right now
+	 */
+	size_t occupancy;
+
+	/**
+	 * Highest occupancy seen so far
+	 */
+	size_t max_occupancy;
+
+	/**
+	 * Blocks committed so far, not counting dropped ones
+	 */
+	unsigned long committed;
+
+	/**
+	 * Blocks discarded because the ring was full
+	 */
+	unsigned long dropped;
+};
+
+/**
+ * Initializes a single producer, single consumer ring of fixed size blocks.
+ *
+ * Blocks are handed over without locks. The producer and consumer only sleep
+ * when there is nothing for them to do: the consumer when the ring is empty,
+ * and the producer when it is full, unless told to drop blocks instead.
+ *
+ * @param block_size Size of each block, in bytes
+ * @param block_count Number of blocks in the ring
+ * @param drop_when_full If true, the producer never waits for the consumer.
+ *                       Blocks written while the ring is full are discarded.
+ * @returns New ring, or NULL on error
+ */
+ring_t * ring_init(size_t block_size, size_t block_count, bool drop_when_full);
+
+/**
+ * Gets the next block to be written. Only to be called by the producer.
+ *
+ * @param r Ring
+ * @returns Block to be filled
+ */
+void * ring_acquire(ring_t * r);
+
+/**
+ * Makes the block returned by ring_acquire available to the consumer. Only to
+ * be called by the producer.
+ *
+ * @param r Ring
+ * @returns true if handed over, or false if discarded because the ring was
+ *          full
+ */
+bool ring_commit(ring_t * r);
+
+/**
+ * Signals the consumer that no more blocks will be written. Only to be called
+ * by the producer.
+ *
+ * @param r Ring
+ */
+void ring_close(ring_t * r);
+
+/**
+ * Gets the oldest written block, waiting for one if the ring is empty. Only
+ * to be called by the consumer.
+ *
+ * @param r Ring
+ * @returns Oldest block, or NULL if the ring has been closed and is empty
+ */
+void * ring_peek(ring_t * r);
+
+/**
+ * Frees the block returned by ring_peek for writing. Only to be called by the
+ * consumer.
+ *
+ * @param r Ring
+ */
+void ring_release(ring_t * r);
+
+/**
+ * Gets ring statistics. May be called from any thread.
+ *
+ * @param r Ring
+ * @param stats Output statistics
+ */
+void ring_get_stats(ring_t * r, struct ring_stats * stats);
+
+/**
+ * Destroys the ring. Accepts NULL.
+ *
+ * @param r Ring
+ */
+void ring_free(ring_t * r);
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Time spent in a stage of the hot path
+ */
+struct stats_timer {
+	/**
+	 * Number of times the stage has run
+	 */
+	uint64_t calls;
+
+	/**
+	 * Time spent in it, in STATS_TIME_UNIT
+	 */
+	uint64_t time;
+};
+
+/*
+ * Counters and timers are cheap, but not free: building with -DNO_STATS
+ * compiles all of them out, leaving them at zero.
+ */
+#ifdef NO_STATS
+
+#	define STATS_ENABLED 0
+#	define STATS_TIME_UNIT "cycles"
+#	define STATS_ADD(counter, value) ((void) 0)
+#	define STATS_START(start) ((start) = 0)
+#	define STATS_STOP(timer, start) ((void) (start))
+
+#else
+
+#	define STATS_ENABLED 1
+
+#	if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#		include <x86intrin.h>
+#		define STATS_TIME_UNIT "cycles"
+
+/**
+ * Returns the CPU time stamp counter, which is far cheaper to read than any
+ * clock and counts cycles at a fixed rate on current CPUs.
+ */
+static inline uint64_t stats_now(void) {
+	return __rdtsc();
+}
+
+#	else
+#		include <time.h>
+#		define STATS_TIME_UNIT "ns"
+
+static inline uint64_t stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#	endif
+
+#	define STATS_ADD(counter, value) ((counter) += (value))
+#	define STATS_START(start) ((start) = stats_now())
+#	define STATS_STOP(timer, start) ((timer).calls++, (timer).time += stats_now() - (start))
+
+#endif
@@ -1,6 +1,7 @@
 
 #include "telegram.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 struct telegram {
 	telegram_status_t status;
@@ -8,6 +9,21 @@ struct telegram {
 	int bit_count;
 	uint_least64_t bits;
 	uint8_t correct_crc;
+
+	/**
+	 * Maximum number of bit errors to correct
+	 */
+	int correction;
+
+	/**
+	 * Bits flipped by error correction
+	 */
+	uint64_t error_mask;
+
+	/**
+	 * Set if allocated by telegram_init, rather than in a caller's buffer
+	 */
+	bool allocated;
 };
 
 telegram_t * telegram_init() {
@@ -16,8 +32,23 @@ telegram_t * telegram_init() {
 		return NULL;
 	}
 
+	telegram_init_in(t);
+	t->allocated = true;
+	return t;
+}
+
+size_t telegram_sizeof() {
+	return sizeof(struct telegram);
+}
+
+telegram_t * telegram_init_in(void * buffer) {
+	telegram_t * t = buffer;
+
+	t->allocated = false;
 	t->status = TELEGRAM_MORE;
 	t->bit_count = 0;
+	t->correction = 0;
+	t->error_mask = 0;
 
 	return t;
 }
@@ -27,7 +58,7 @@ telegram_status_t telegram_status(telegram_t * t) {
 }
 
 bool telegram_is_done(telegram_t * t) {
-	return t->status == TELEGRAM_OK || t->status == TELEGRAM_INTEGRITY;
+	return t->status == TELEGRAM_OK || t->status == TELEGRAM_CORRECTED || t->status == TELEGRAM_INTEGRITY;
 }
 
 int telegram_train_number(telegram_t * t) {
@@ -65,6 +96,18 @@ int telegram_correct_crc(telegram_t * t) {
 	return t->correct_crc;
 }
 
+int64_t telegram_error_mask(telegram_t * t) {
+	if (!telegram_is_done(t)) {
+		return -1;
+	}
+
+	return t->error_mask;
+}
+
+void telegram_set_correction(telegram_t * t, int max_bits) {
+	t->correction = max_bits;
+}
+
 int64_t telegram_raw(telegram_t * t) {
 	if (!telegram_is_done(t)) {
 		return -1;
@@ -73,15 +116,164 @@ int64_t telegram_raw(telegram_t * t) {
 	return t->bits & 0x7FFFFFFFFFLL;
 }
 
-#define CRC_POLY 0xE1
-uint_least64_t crc_calculate(uint_least64_t bits) {
-	for (int bpos = 38; bpos >= 7; bpos--) {
-		if (bits & (1ULL << bpos)) {
-			bits ^= (uint64_t) CRC_POLY << (bpos - 7);
+void telegram_snapshot(telegram_t * t, struct telegram_snapshot * s) {
+	s->status = telegram_status(t);
+	s->train_number = telegram_train_number(t);
+	s->code_number = telegram_code_number(t);
+	s->received_crc = telegram_received_crc(t);
+	s->correct_crc = telegram_correct_crc(t);
+	s->raw = telegram_raw(t);
+	s->error_mask = telegram_error_mask(t);
+}
+
+/**
+ * CRC of each byte followed by seven zero bits, for polynomial 0xE1.
+ */
+static const uint8_t crc_table[256] = {
+	0x00, 0x61, 0x23, 0x42, 0x46, 0x27, 0x65, 0x04,
+	0x6D, 0x0C, 0x4E, 0x2F, 0x2B, 0x4A, 0x08, 0x69,
+	0x3B, 0x5A, 0x18, 0x79, 0x7D, 0x1C, 0x5E, 0x3F,
+	0x56, 0x37, 0x75, 0x14, 0x10, 0x71, 0x33, 0x52,
+	0x76, 0x17, 0x55, 0x34, 0x30, 0x51, 0x13, 0x72,
+	0x1B, 0x7A, 0x38, 0x59, 0x5D, 0x3C, 0x7E, 0x1F,
+	0x4D, 0x2C, 0x6E, 0x0F, 0x0B, 0x6A, 0x28, 0x49,
+	0x20, 0x41, 0x03, 0x62, 0x66, 0x07, 0x45, 0x24,
+	0x0D, 0x6C, 0x2E, 0x4F, 0x4B, 0x2A, 0x68, 0x09,
+	0x60, 0x01, 0x43, 0x22, 0x26, 0x47, 0x05, 0x64,
+	0x36, 0x57, 0x15, 0x74, 0x70, 0x11, 0x53, 0x32,
+	0x5B, 0x3A, 0x78, 0x19, 0x1D, 0x7C, 0x3E, 0x5F,
+	0x7B, 0x1A, 0x58, 0x39, 0x3D, 0x5C, 0x1E, 0x7F,
+	0x16, 0x77, 0x35, 0x54, 0x50, 0x31, 0x73, 0x12,
+	0x40, 0x21, 0x63, 0x02, 0x06, 0x67, 0x25, 0x44,
+	0x2D, 0x4C, 0x0E, 0x6F, 0x6B, 0x0A, 0x48, 0x29,
+	0x1A, 0x7B, 0x39, 0x58, 0x5C, 0x3D, 0x7F, 0x1E,
+	0x77, 0x16, 0x54, 0x35, 0x31, 0x50, 0x12, 0x73,
+	0x21, 0x40, 0x02, 0x63, 0x67, 0x06, 0x44, 0x25,
+	0x4C, 0x2D, 0x6F, 0x0E, 0x0A, 0x6B, 0x29, 0x48,
+	0x6C, 0x0D, 0x4F, 0x2E, 0x2A, 0x4B, 0x09, 0x68,
+	0x01, 0x60, 0x22, 0x43, 0x47, 0x26, 0x64, 0x05,
+	0x57, 0x36, 0x74, 0x15, 0x11, 0x70, 0x32, 0x53,
+	0x3A, 0x5B, 0x19, 0x78, 0x7C, 0x1D, 0x5F, 0x3E,
+	0x17, 0x76, 0x34, 0x55, 0x51, 0x30, 0x72, 0x13,
+	0x7A, 0x1B, 0x59, 0x38, 0x3C, 0x5D, 0x1F, 0x7E,
+	0x2C, 0x4D, 0x0F, 0x6E, 0x6A, 0x0B, 0x49, 0x28,
+	0x41, 0x20, 0x62, 0x03, 0x07, 0x66, 0x24, 0x45,
+	0x61, 0x00, 0x42, 0x23, 0x27, 0x46, 0x04, 0x65,
+	0x0C, 0x6D, 0x2F, 0x4E, 0x4A, 0x2B, 0x69, 0x08,
+	0x5A, 0x3B, 0x79, 0x18, 0x1C, 0x7D, 0x3F, 0x5E,
+	0x37, 0x56, 0x14, 0x75, 0x71, 0x10, 0x52, 0x33
+};
+
+/**
+ * Syndrome caused by flipping each one of the 39 telegram bits, counting from
+ * the least significant CRC bit.
+ */
+static const uint8_t bit_syndromes[39] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x61,
+	0x23, 0x46, 0x6D, 0x3B, 0x76, 0x0D, 0x1A, 0x34,
+	0x68, 0x31, 0x62, 0x25, 0x4A, 0x75, 0x0B, 0x16,
+	0x2C, 0x58, 0x51, 0x43, 0x67, 0x2F, 0x5E, 0x5D,
+	0x5B, 0x57, 0x4F, 0x7F, 0x1F, 0x3E, 0x7C
+};
+
+/**
+ * Inverse of bit_syndromes: bit that needs to be flipped to fix a syndrome,
+ * or -1 if it cannot be caused by a single bit error. Single bit errors
+ * always give odd syndromes since the polynomial is a multiple of x + 1.
+ */
+static const int8_t syndrome_bits[128] = {
+	 -1,   0,   1,  -1,   2,  -1,  -1,  -1,   3,  -1,  -1,  22,  -1,  13,  -1,  -1,
+	  4,  -1,  -1,  -1,  -1,  -1,  23,  -1,  -1,  -1,  14,  -1,  -1,  -1,  -1,  36,
+	  5,  -1,  -1,   8,  -1,  19,  -1,  -1,  -1,  -1,  -1,  -1,  24,  -1,  -1,  29,
+	 -1,  17,  -1,  -1,  15,  -1,  -1,  -1,  -1,  -1,  -1,  11,  -1,  -1,  37,  -1,
+	  6,  -1,  -1,  27,  -1,  -1,   9,  -1,  -1,  -1,  20,  -1,  -1,  -1,  -1,  34,
+	 -1,  26,  -1,  -1,  -1,  -1,  -1,  33,  25,  -1,  -1,  32,  -1,  31,  30,  -1,
+	 -1,   7,  18,  -1,  -1,  -1,  -1,  28,  16,  -1,  -1,  -1,  -1,  10,  -1,  -1,
+	 -1,  -1,  -1,  -1,  -1,  21,  12,  -1,  -1,  -1,  -1,  -1,  38,  -1,  -1,  35
+};
+
+/**
+ * Calculates the CRC of bits 38 to 7, a byte at a time.
+ */
+static uint8_t crc_calculate(uint64_t bits) {
+	uint8_t crc = 0;
+
+	for (int shift = 31; shift >= 7; shift -= 8) {
+		crc = crc_table[((crc << 1) ^ (bits >> shift)) & 0xFF];
+	}
+
+	return crc;
+}
+
+/**
+ * Checks that the six train number digits are valid BCD.
+ */
+static bool train_is_bcd(uint64_t bits) {
+	uint32_t train = (bits >> 15) & 0xFFFFFF;
+
+	// Digits are bit reversed, so a valid digit has its lowest bit clear or
+	// its two middle bits clear
+	for (int digit = 0; digit < 6; digit++, train >>= 4) {
+		if ((train & 0x1) && (train & 0x6)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Tries to fix the telegram bits using the CRC syndrome.
+ *
+ * @returns mask of flipped bits, or zero if not correctable
+ */
+static uint64_t crc_correct(const telegram_t * t, uint8_t syndrome) {
+	if (syndrome_bits[syndrome] >= 0) {
+		uint64_t mask = 1ULL << syndrome_bits[syndrome];
+		return train_is_bcd(t->bits ^ mask) ? mask : 0;
+	}
+
+	if (t->correction < 2) {
+		return 0;
+	}
+
+	/*
+	 * A 7-bit CRC cannot tell double bit errors apart: each even syndrome
+	 * matches around a dozen pairs. Only accept it if a single one of them
+	 * leaves a valid train number.
+	 */
+	uint64_t found = 0;
+	for (int i = 0; i < 39; i++) {
+		for (int j = i + 1; j < 39; j++) {
+			if ((bit_syndromes[i] ^ bit_syndromes[j]) != syndrome) {
+				continue;
+			}
+
+			uint64_t mask = 1ULL << i | 1ULL << j;
+			if (train_is_bcd(t->bits ^ mask)) {
+				if (found) {
+					return 0;
+				}
+				found = mask;
+			}
 		}
 	}
 
-	return bits;
+	return found;
+}
+
+uint64_t telegram_encode(int train_number, int code_number) {
+	uint32_t train = train_number & 0xFFFFFF;
+
+	// Reverse the bits of each BCD digit, as done on air
+	train = (train & 0xAAAAAA) >> 1 | (train & 0x555555) << 1;
+	train = (train & 0xCCCCCC) >> 2 | (train & 0x333333) << 2;
+
+	uint64_t bits = (uint64_t) train << 15 | (uint64_t) (code_number & 0xFF) << 7;
+	uint8_t crc = crc_calculate(bits);
+
+	// CRC is sent inverted
+	return (uint64_t) 0xFF2 << 39 | bits | (crc ^ 0x7F);
 }
 
 void telegram_feed(telegram_t * t, int bit) {
@@ -106,13 +298,25 @@ void telegram_feed(telegram_t * t, int bit) {
 	}
 
 	uint8_t received_crc = (t->bits & 0x7F) ^ 0x7F;
-	t->correct_crc = crc_calculate(t->bits & ~0x7F) & 0x7F;
+	t->correct_crc = crc_calculate(t->bits);
+	t->error_mask = 0;
 
 	if (received_crc == t->correct_crc) {
 		t->status = TELEGRAM_OK;
-	} else {
-		t->status = TELEGRAM_INTEGRITY;
+		return;
 	}
+
+	if (t->correction > 0) {
+		t->error_mask = crc_correct(t, received_crc ^ t->correct_crc);
+		if (t->error_mask) {
+			t->bits ^= t->error_mask;
+			t->correct_crc = crc_calculate(t->bits);
+			t->status = TELEGRAM_CORRECTED;
+			return;
+		}
+	}
+
+	t->status = TELEGRAM_INTEGRITY;
 }
 
 void telegram_reset(telegram_t * t) {
@@ -121,5 +325,7 @@ void telegram_reset(telegram_t * t) {
 }
 
 void telegram_free(telegram_t * t) {
-	free(t);
+	if (t != NULL && t->allocated) {
+		free(t);
+	}
 }
@@ -2,6 +2,7 @@
 #pragma once
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct telegram telegram_t;
 
@@ -25,8 +26,27 @@ typedef enum {
 	 * The telegram has a failed the integrity test
 	 */
 	TELEGRAM_INTEGRITY,
+
+	/**
+	 * The telegram failed the integrity test, but has been repaired by flipping
+	 * the bits returned by telegram_error_mask.
+	 */
+	TELEGRAM_CORRECTED,
 } telegram_status_t;
 
+/**
+ * Copy of the decoded values of a done telegram
+ */
+struct telegram_snapshot {
+	telegram_status_t status;
+	int train_number;
+	int code_number;
+	int received_crc;
+	int correct_crc;
+	int64_t raw;
+	int64_t error_mask;
+};
+
 /**
  * Creates a new telegram parser
  *
@@ -34,6 +54,22 @@ typedef enum {
  */
 telegram_t * telegram_init();
 
+/**
+ * Returns the size of the buffer needed by {@code telegram_init_in}.
+ *
+ * @returns size in bytes
+ */
+size_t telegram_sizeof();
+
+/**
+ * Creates a telegram parser in a buffer provided by the caller, which must be
+ * freed by the caller after {@code telegram_free}.
+ *
+ * @param buffer Buffer, at least {@code telegram_sizeof} bytes long
+ * @returns Telegram object, at the start of the buffer
+ */
+telegram_t * telegram_init_in(void * buffer);
+
 /**
  * Returns current telegram status
  *
@@ -86,6 +122,26 @@ int telegram_received_crc(telegram_t * t);
  */
 int telegram_correct_crc(telegram_t * t);
 
+/**
+ * Returns the bits flipped by error correction, with the same layout as
+ * telegram_raw. Return value is only valid if current telegram is done.
+ *
+ * @param t Telegram object
+ * @returns Corrected bits, or zero if none
+ */
+int64_t telegram_error_mask(telegram_t * t);
+
+/**
+ * Sets the maximum number of bit errors to correct. With 1, any single bit
+ * error is corrected. With 2, a double bit error is only corrected if exactly
+ * one of the candidate pairs leaves a valid BCD train number, as the 7-bit
+ * CRC cannot tell them apart. Defaults to 0, which disables correction.
+ *
+ * @param t Telegram object
+ * @param max_bits Number of bits, from 0 to 2
+ */
+void telegram_set_correction(telegram_t * t, int max_bits);
+
 /**
  * Returns the raw telegram bits. Return value is only valid if current
  * telegram is done.
@@ -95,6 +151,25 @@ int telegram_correct_crc(telegram_t * t);
  */
 int64_t telegram_raw(telegram_t * t);
 
+/**
+ * Copies the decoded values of the telegram. Values are only valid if current
+ * telegram is done.
+ *
+ * @param t Telegram object
+ * @param s Output snapshot
+ */
+void telegram_snapshot(telegram_t * t, struct telegram_snapshot * s);
+
+/**
+ * Builds the 51 bits of a telegram, including synchronization header and CRC,
+ * in transmission order starting from the most significant bit.
+ *
+ * @param train_number Train number, as six BCD digits
+ * @param code_number Telegram code
+ * @returns Telegram bits
+ */
+uint64_t telegram_encode(int train_number, int code_number);
+
 /**
  * Feeds a new bit to the telegram object
  *
@@ -111,7 +186,8 @@ void telegram_feed(telegram_t * t, int bit);
 void telegram_reset(telegram_t * t);
 
 /**
- * Destroys the telegram object. Accepts NULL.
+ * Destroys the telegram object. Accepts NULL, and objects in a caller's
+ * buffer, which is not freed.
  *
  * @param t Telegram object
  */
@@ -0,0 +1,252 @@
+#include "tonedet.h"
+#include "goertzel.h"
+#include "arena.h"
+#include <string.h>
+#include <math.h>
+
+struct tonedet {
+	goertzel_t * goertzel;
+	size_t freq_count;
+
+	size_t hop_size;
+	size_t window_hops;
+
+	/**
+	 * Samples fed so far into the current hop
+	 */
+	size_t hop_fill;
+
+	/**
+	 * Sum of absolute values of the current hop
+	 */
+	double hop_power;
+
+	/**
+	 * Ring with the last hops. For each one, the DFT of each frequency is
+	 * stored after rotating it to a common time reference, along with the
+	 * power of the hop.
+	 */
+	float * hop_real;
+	float * hop_imag;
+	float * hop_powers;
+	size_t hop_idx;
+
+	/**
+	 * Phase of the current hop for each frequency, and how much it advances
+	 * from one hop to the next, in radians
+	 */
+	double * phase;
+	double * phase_step;
+
+	struct stats_timer goertzel_timer;
+	struct stats_timer power_timer;
+
+	/**
+	 * Set if allocated by tonedet_init, rather than in a caller's buffer
+	 */
+	bool allocated;
+};
+
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+#define abs(x) ((x) < 0 ? -(x) : (x))
+
+size_t tonedet_sizeof(size_t freq_count, size_t window_hops) {
+	struct arena a = { NULL, 0 };
+	arena_alloc(&a, sizeof(struct tonedet));
+	arena_alloc(&a, goertzel_sizeof(freq_count));
+	arena_alloc(&a, window_hops * freq_count * sizeof(float));
+	arena_alloc(&a, window_hops * freq_count * sizeof(float));
+	arena_alloc(&a, window_hops * sizeof(float));
+	arena_alloc(&a, freq_count * sizeof(double));
+	arena_alloc(&a, freq_count * sizeof(double));
+	return a.used;
+}
+
+tonedet_t * tonedet_init(const float * frequencies, size_t freq_count, float sample_rate, size_t hop_size, size_t window_hops) {
+	if (hop_size == 0 || window_hops == 0) {
+		return NULL;
+	}
+
+	void * buffer = arena_malloc(tonedet_sizeof(freq_count, window_hops));
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	tonedet_t * t = tonedet_init_in(buffer, frequencies, freq_count, sample_rate, hop_size, window_hops);
+	t->allocated = true;
+	return t;
+}
+
+tonedet_t * tonedet_init_in(void * buffer, const float * frequencies, size_t freq_count, float sample_rate, size_t hop_size, size_t window_hops) {
+	if (hop_size == 0 || window_hops == 0) {
+		return NULL;
+	}
+
+	memset(buffer, 0, tonedet_sizeof(freq_count, window_hops));
+
+	struct arena a = { buffer, 0 };
+	tonedet_t * t = arena_alloc(&a, sizeof(struct tonedet));
+	t->freq_count = freq_count;
+	t->hop_size = hop_size;
+	t->window_hops = window_hops;
+
+	t->goertzel = goertzel_init_in(arena_alloc(&a, goertzel_sizeof(freq_count)), frequencies, freq_count, sample_rate);
+	t->hop_real = arena_alloc(&a, window_hops * freq_count * sizeof(float));
+	t->hop_imag = arena_alloc(&a, window_hops * freq_count * sizeof(float));
+	t->hop_powers = arena_alloc(&a, window_hops * sizeof(float));
+	t->phase = arena_alloc(&a, freq_count * sizeof(double));
+	t->phase_step = arena_alloc(&a, freq_count * sizeof(double));
+
+	for (size_t i = 0; i < freq_count; i++) {
+		t->phase_step[i] = fmod(2 * PI * frequencies[i] / sample_rate * hop_size, 2 * PI);
+	}
+
+	goertzel_reset(t->goertzel);
+	return t;
+}
+
+void tonedet_reset(tonedet_t * t) {
+	goertzel_reset(t->goertzel);
+	t->hop_fill = 0;
+	t->hop_power = 0;
+
+	memset(t->hop_real, 0, t->window_hops * t->freq_count * sizeof(float));
+	memset(t->hop_imag, 0, t->window_hops * t->freq_count * sizeof(float));
+	memset(t->hop_powers, 0, t->window_hops * sizeof(float));
+	memset(t->phase, 0, t->freq_count * sizeof(double));
+	t->hop_idx = 0;
+}
+
+size_t tonedet_remaining(tonedet_t * t) {
+	return t->hop_size - t->hop_fill;
+}
+
+/**
+ * Stores the finished hop in the ring, adds up the window and starts the next
+ * hop. The window is added up in floating point, once per hop, whichever the
+ * samples were.
+ */
+static void finish_hop(tonedet_t * t, bool s16, float * magnitude, float * power) {
+	float * real = t->hop_real + t->hop_idx * t->freq_count;
+	float * imag = t->hop_imag + t->hop_idx * t->freq_count;
+	if (s16) {
+		goertzel_dft_s16(t->goertzel, real, imag);
+	} else {
+		goertzel_dft(t->goertzel, real, imag);
+	}
+	goertzel_reset(t->goertzel);
+
+	// Rotate back by the time elapsed since the first hop
+	for (size_t i = 0; i < t->freq_count; i++) {
+		float c = cos(t->phase[i]), s = sin(t->phase[i]);
+		float re = real[i], im = imag[i];
+		real[i] = re * c + im * s;
+		imag[i] = im * c - re * s;
+
+		t->phase[i] = fmod(t->phase[i] + t->phase_step[i], 2 * PI);
+	}
+
+	t->hop_powers[t->hop_idx] = t->hop_power;
+	t->hop_power = 0;
+	t->hop_fill = 0;
+
+	t->hop_idx = (t->hop_idx + 1) % t->window_hops;
+
+	// Unused slots are still zero at start, so the whole ring can be added up
+	*power = 0;
+	for (size_t hop = 0; hop < t->window_hops; hop++) {
+		*power += t->hop_powers[hop];
+	}
+
+	for (size_t i = 0; i < t->freq_count; i++) {
+		float re = 0, im = 0;
+		for (size_t hop = 0; hop < t->window_hops; hop++) {
+			re += t->hop_real[hop * t->freq_count + i];
+			im += t->hop_imag[hop * t->freq_count + i];
+		}
+		magnitude[i] = sqrt(re * re + im * im);
+	}
+}
+
+/**
+ * Counts samples fed into the current hop, finishing it if complete.
+ */
+static bool advance_hop(tonedet_t * t, bool s16, size_t sample_count, float * magnitude, float * power) {
+	t->hop_fill += sample_count;
+	if (t->hop_fill < t->hop_size) {
+		return false;
+	}
+
+	finish_hop(t, s16, magnitude, power);
+	return true;
+}
+
+bool tonedet_feed(tonedet_t * t, const float * samples, size_t sample_count, float * magnitude, float * power) {
+	uint64_t start;
+	STATS_START(start);
+	goertzel_feed(t->goertzel, samples, sample_count);
+	STATS_STOP(t->goertzel_timer, start);
+
+	STATS_START(start);
+	float hop_power = 0;
+	for (size_t i = 0; i < sample_count; i++) {
+		hop_power += abs(samples[i]);
+	}
+	t->hop_power += hop_power;
+	STATS_STOP(t->power_timer, start);
+
+	return advance_hop(t, false, sample_count, magnitude, power);
+}
+
+bool tonedet_feed_s16(tonedet_t * t, const int16_t * samples, size_t sample_count, float * magnitude, float * power) {
+	uint64_t start;
+	STATS_START(start);
+	goertzel_feed_s16(t->goertzel, samples, sample_count);
+	STATS_STOP(t->goertzel_timer, start);
+
+	STATS_START(start);
+	int64_t hop_power = 0;
+	for (size_t i = 0; i < sample_count; i++) {
+		hop_power += abs(samples[i]);
+	}
+	t->hop_power += hop_power / 32768.0;
+	STATS_STOP(t->power_timer, start);
+
+	return advance_hop(t, true, sample_count, magnitude, power);
+}
+
+bool tonedet_scan(tonedet_t * t, const float * samples, size_t sample_count, uint64_t * signs, float * magnitude, float * power) {
+	uint64_t start;
+	STATS_START(start);
+	t->hop_power += goertzel_scan(t->goertzel, samples, sample_count, signs);
+	STATS_STOP(t->goertzel_timer, start);
+
+	return advance_hop(t, false, sample_count, magnitude, power);
+}
+
+bool tonedet_scan_s16(tonedet_t * t, const int16_t * samples, size_t sample_count, uint64_t * signs, float * magnitude, float * power) {
+	uint64_t start;
+	STATS_START(start);
+	t->hop_power += goertzel_scan_s16(t->goertzel, samples, sample_count, signs) / 32768.0;
+	STATS_STOP(t->goertzel_timer, start);
+
+	return advance_hop(t, true, sample_count, magnitude, power);
+}
+
+void tonedet_get_timers(tonedet_t * t, struct stats_timer * goertzel, struct stats_timer * power) {
+	*goertzel = t->goertzel_timer;
+	*power = t->power_timer;
+}
+
+void tonedet_free(tonedet_t * t) {
+	if (t == NULL) {
+		return;
+	}
+
+	goertzel_free(t->goertzel);
+	if (t->allocated) {
+		free(t);
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "stats.h"
+
+typedef struct tonedet tonedet_t;
+
+/**
+ * Initializes a new streaming tone detector.
+ *
+ * The detector measures each tone over a window made of a whole number of
+ * hops, sliding it one hop at a time. Each hop only runs a Goertzel filter over
+ * its own samples, and its complex result is kept so overlapping windows are
+ * built without going over the samples again. Samples may be fed in pieces of
+ * any size, independently of the hops.
+ *
+ * @param frequencies Frequency array
+ * @param freq_count Number of frequencies in array
+ * @param sample_rate Input sample rate
+ * @param hop_size Length of each hop, in samples
+ * @param window_hops Length of the window, in hops
+ * @returns New tone detector, or NULL on error
+ */
+tonedet_t * tonedet_init(const float * frequencies, size_t freq_count, float sample_rate, size_t hop_size, size_t window_hops);
+
+/**
+ * Returns the size of the buffer needed by {@code tonedet_init_in}. It does
+ * not depend on the hop size.
+ *
+ * @param freq_count Number of frequencies
+ * @param window_hops Length of the window, in hops
+ * @returns size in bytes
+ */
+size_t tonedet_sizeof(size_t freq_count, size_t window_hops);
+
+/**
+ * Initializes a tone detector like {@code tonedet_init}, laying it out in a
+ * buffer provided by the caller instead of allocating it. The buffer must be
+ * aligned to 64 bytes, and freed by the caller after {@code tonedet_free}.
+ *
+ * @param buffer Buffer, at least {@code tonedet_sizeof} bytes long
+ * @param frequencies Frequency array
+ * @param freq_count Number of frequencies in array
+ * @param sample_rate Input sample rate
+ * @param hop_size Length of each hop, in samples
+ * @param window_hops Length of the window, in hops
+ * @returns Tone detector at the start of the buffer, or NULL on error
+ */
+tonedet_t * tonedet_init_in(void * buffer, const float * frequencies, size_t freq_count, float sample_rate, size_t hop_size, size_t window_hops);
+
+/**
+ * Forgets the current hop and the window, as if the signal started anew with
+ * the next sample.
+ *
+ * @param t Tone detector
+ */
+void tonedet_reset(tonedet_t * t);
+
+/**
+ * Returns the number of samples left to complete the current hop.
+ *
+ * @param t Tone detector
+ * @returns number of samples, never zero
+ */
+size_t tonedet_remaining(tonedet_t * t);
+
+/**
+ * Feeds samples to the detector, which must not go past the end of the
+ * current hop. When it is completed, the magnitude of each frequency and the
+ * signal power over the last window are calculated, both scaled like those of
+ * {@code goertzel_magnitude} over a single block of the window length.
+ *
+ * At start, the window only covers the hops seen so far.
+ *
+ * @param t Tone detector
+ * @param samples Input samples
+ * @param sample_count Number of samples, up to {@code tonedet_remaining}
+ * @param magnitude Calculated magnitudes, only if a hop is completed
+ * @param power Sum of absolute values of samples, only if a hop is completed
+ * @returns true if a hop was completed
+ */
+bool tonedet_feed(tonedet_t * t, const float * samples, size_t sample_count, float * magnitude, float * power);
+
+/**
+ * Same as {@code tonedet_feed}, for signed 16-bit samples, scaled as if divided
+ * by 32768. Filtering runs in fixed point, so hops should stay below ten
+ * thousand samples.
+ *
+ * @param t Tone detector
+ * @param samples Input samples
+ * @param sample_count Number of samples, up to {@code tonedet_remaining}
+ * @param magnitude Calculated magnitudes, only if a hop is completed
+ * @param power Sum of absolute values of samples, only if a hop is completed
+ * @returns true if a hop was completed
+ */
+bool tonedet_feed_s16(tonedet_t * t, const int16_t * samples, size_t sample_count, float * magnitude, float * power);
+
+/**
+ * Same as {@code tonedet_feed}, also packing the signs of the samples for the
+ * BFSK demodulator, all in a single pass over them. See goertzel_scan.
+ *
+ * @param t Tone detector
+ * @param samples Input samples
+ * @param sample_count Number of samples, up to {@code tonedet_remaining}
+ * @param signs Sign of each sample, set if negative, from bit 0 of the first
+ *   word on
+ * @param magnitude Calculated magnitudes, only if a hop is completed
+ * @param power Sum of absolute values of samples, only if a hop is completed
+ * @returns true if a hop was completed
+ */
+bool tonedet_scan(tonedet_t * t, const float * samples, size_t sample_count, uint64_t * signs, float * magnitude, float * power);
+
+/**
+ * Same as {@code tonedet_scan}, for signed 16-bit samples, see
+ * {@code tonedet_feed_s16}.
+ *
+ * @param t Tone detector
+ * @param samples Input samples
+ * @param sample_count Number of samples, up to {@code tonedet_remaining}
+ * @param signs Sign of each sample, as in {@code tonedet_scan}
+ * @param magnitude Calculated magnitudes, only if a hop is completed
+ * @param power Sum of absolute values of samples, only if a hop is completed
+ * @returns true if a hop was completed
+ */
+bool tonedet_scan_s16(tonedet_t * t, const int16_t * samples, size_t sample_count, uint64_t * signs, float * magnitude, float * power);
+
+/**
+ * Returns the time spent so far running the Goertzel filters and adding up the
+ * power of the signal. Both stay at zero if built with NO_STATS. The single
+ * pass of {@code tonedet_scan} is all counted as filtering.
+ *
+ * @param t Tone detector
+ * @param goertzel Time spent filtering
+ * @param power Time spent calculating power
+ */
+void tonedet_get_timers(tonedet_t * t, struct stats_timer * goertzel, struct stats_timer * power);
+
+/**
+ * Destroys a tone detector. Accepts NULL, and detectors in a caller's buffer,
+ * which is not freed.
+ *
+ * @param t Tone detector
+ */
+void tonedet_free(tonedet_t * t);
@@ -1,15 +1,137 @@
 
 #include "uicdemod.h"
-#include "goertzel.h"
+#include "tonedet.h"
 #include "bfsk.h"
 #include "signal.h"
+#include "arena.h"
+#include <string.h>
+#include <math.h>
+
+// Number of demodulated symbols fetched at once from the BFSK demodulator
+#define SYMBOL_BATCH 64
+
+// Longest run of samples scanned at once for tones and signs, a multiple of 64
+#define SCAN_CHUNK 1024
+
+// Default tone detection hop and window lengths
+#define DEFAULT_HOP_MILLIS 10
+#define DEFAULT_WINDOW_MILLIS 40
+
+// Tones detected, followed by the mark and space of the telegrams, whose
+// strength tells whether the BFSK demodulator needs to run
+#define TONE_COUNT 4
+#define FREQ_COUNT 6
+
+// Strength of mark and space relative to the signal power in the tone window
+// above which a telegram is on air. A steady tone gives about 0.8, and the
+// run of ones opening the sync word about 0.25 right after a tone as loud,
+// while noise stays around 0.1.
+#define CARRIER_THRESHOLD 0.2
+
+// Mean absolute sample value below which the channel is taken as silent
+#define CARRIER_MIN_LEVEL 1e-4
+
+// Longest tone window over which the sync word still stands out, the BFSK
+// demodulator running all the time with longer ones
+#define GATE_MAX_WINDOW_MILLIS 60
+
+// Time the BFSK demodulator keeps running after mark and space were last
+// seen, longer than a whole telegram as its data may not stand out as well
+// as its sync word
+#define GATE_HOLD_MILLIS 120
+
+// Hops of skipped samples kept to be replayed when the BFSK demodulator
+// starts again. A sync word may start at the beginning of a hop and only be
+// found two hops later, after a tone as loud, plus a hop to prime the
+// correlator.
+#define LOOKBACK_HOPS 4
+
+// Symbols of the first bit sampler after a telegram is completed during
+// which other samplers completing one are taken to have received the same.
+// They all sample within a bit of each other, and telegrams are 51 bits long.
+#define SAMPLER_WINDOW_SYMBOLS 8
 
 struct uicdemod {
-	goertzel_t * goertzel;
+	float sample_rate;
+
+	tonedet_t * tones;
 	bfsk_t * demod;
-	telegram_t * telegram;
 
-	bool ran_goertzel;
+	/**
+	 * Telegram parser of each bit sampler of the BFSK demodulator, and the
+	 * last one reported
+	 */
+	telegram_t * telegrams[BFSK_MAX_SAMPLERS];
+	telegram_t * telegram;
+	int sampler_count;
+
+	/**
+	 * With several bit samplers: symbols of the first one since any of them
+	 * last completed a telegram, and whether that telegram has been reported
+	 * already, or how many samplers have failed its integrity check. The
+	 * first of those failures is kept, to be reported if none passes.
+	 */
+	int window_symbols;
+	bool window_reported;
+	int window_failed;
+	telegram_t * window_failure;
+
+	/**
+	 * Space for the tone detector in the block of the demodulator. Detectors
+	 * with longer windows than the default do not fit, and are allocated on
+	 * their own.
+	 */
+	void * tones_buffer;
+	size_t tones_buffer_size;
+
+	/**
+	 * Whether the BFSK demodulator is only run while there seems to be a
+	 * telegram on air, whether the tone window is short enough for that,
+	 * whether it is running now, and the hops left before
+	 * stopping it if mark and space are not seen again
+	 */
+	bool gating;
+	bool gate_usable;
+	bool active;
+	int active_hops;
+	int hold_hops;
+
+	/**
+	 * Whether the BFSK demodulator runs the packed engine, which can take the
+	 * signs packed while scanning for tones instead of the samples
+	 */
+	bool packed;
+
+	/**
+	 * Samples in the tone window, for the silence level
+	 */
+	size_t window_size;
+
+	/**
+	 * Ring with the last samples analyzed, as float or 16-bit samples, and
+	 * how many of them are left to be replayed through the BFSK demodulator
+	 * once started. Filled while running too, as it may stop for just a hop
+	 * between telegrams. Space for the default tone window
+	 * is in the block, and rings for longer hops are allocated on their own.
+	 */
+	char * lookback;
+	size_t lookback_size;
+	size_t lookback_idx;
+	size_t lookback_fill;
+	size_t replay_count;
+	bool lookback_s16;
+	void * lookback_buffer;
+	size_t lookback_buffer_size;
+
+	struct bfsk_symbol symbols[SYMBOL_BATCH];
+	size_t symbol_count;
+	size_t symbol_idx;
+
+	/**
+	 * Tone event detected at the end of the last hop, to be returned by
+	 * uicdemod_analyze once the symbols before it are done
+	 */
+	uicdemod_status_t pending_tone;
 	bool has_telegram;
 
 	int last_signal;
@@ -17,6 +139,18 @@ struct uicdemod {
 	int current_signal_ticks;
 	int required_ticks;
 	float tone_certainty;
+
+	/**
+	 * Samples analyzed before the current buffer
+	 */
+	uint64_t position;
+
+	struct uicdemod_stats stats;
+
+	/**
+	 * Set if allocated by uicdemod_init, rather than in a caller's buffer
+	 */
+	bool allocated;
 };
 
 static const struct bfsk_params fskparams = {
@@ -29,35 +163,111 @@ static const float freqs[] = {
 	1520, // Warning
 	1960, // Listening
 	2280, // Channel free
-	2800  // Pilot
+	2800, // Pilot
+	1300, // Mark
+	1700  // Space
 };
 
-#define abs(x) ((x) < 0 ? -(x) : (x))
+/**
+ * Returns the tone detection hop and window lengths in samples, or false if
+ * invalid.
+ */
+static bool tone_window(float sample_rate, int hop_millis, int window_millis, size_t * hop_size, size_t * window_hops) {
+	if (hop_millis <= 0) {
+		return false;
+	}
+
+	*hop_size = lround(hop_millis * sample_rate / 1000);
+	*window_hops = lround((float) window_millis / hop_millis);
+	return *hop_size != 0 && *window_hops != 0;
+}
+
+/**
+ * Sizes the gate of the BFSK demodulator for a tone window, stopping the
+ * demodulator and emptying the lookback ring.
+ */
+static void set_gate_window(uicdemod_t * d, void * lookback, size_t hop_size, size_t window_hops) {
+	d->lookback = lookback;
+	d->lookback_size = LOOKBACK_HOPS * hop_size;
+	d->lookback_idx = 0;
+	d->lookback_fill = 0;
+	d->replay_count = 0;
+
+	d->window_size = hop_size * window_hops;
+	d->gate_usable = d->window_size <= GATE_MAX_WINDOW_MILLIS * d->sample_rate / 1000;
+	d->hold_hops = ceil(GATE_HOLD_MILLIS * d->sample_rate / 1000 / hop_size);
+	d->active = !d->gating || !d->gate_usable;
+	d->active_hops = 0;
+}
+
+size_t uicdemod_sizeof(float sample_rate) {
+	size_t hop_size, window_hops;
+	tone_window(sample_rate, DEFAULT_HOP_MILLIS, DEFAULT_WINDOW_MILLIS, &hop_size, &window_hops);
+
+	struct arena a = { NULL, 0 };
+	arena_alloc(&a, sizeof(struct uicdemod));
+	arena_alloc(&a, tonedet_sizeof(FREQ_COUNT, window_hops));
+	arena_alloc(&a, bfsk_sizeof(&fskparams, sample_rate));
+	for (int i = 0; i < BFSK_MAX_SAMPLERS; i++) {
+		arena_alloc(&a, telegram_sizeof());
+	}
+	arena_alloc(&a, telegram_sizeof());
+	arena_alloc(&a, LOOKBACK_HOPS * hop_size * sizeof(float));
+	return a.used;
+}
 
 uicdemod_t * uicdemod_init(float sample_rate) {
-	uicdemod_t * d = malloc(sizeof(struct uicdemod));
-	if (d == NULL) {
+	void * buffer = arena_malloc(uicdemod_sizeof(sample_rate));
+	if (buffer == NULL) {
 		return NULL;
 	}
 
-	d->goertzel = goertzel_init(freqs, 4, sample_rate);
-	if (d->goertzel == NULL) {
-		uicdemod_free(d);
+	uicdemod_t * d = uicdemod_init_in(buffer, sample_rate);
+	if (d == NULL) {
+		free(buffer);
 		return NULL;
 	}
 
-	// TODO: configurable deviation
-	d->demod = bfsk_init(&fskparams, sample_rate);
-	if (d->demod == NULL) {
-		uicdemod_free(d);
+	d->allocated = true;
+	return d;
+}
+
+uicdemod_t * uicdemod_init_in(void * buffer, float sample_rate) {
+	size_t hop_size, window_hops;
+	if (!tone_window(sample_rate, DEFAULT_HOP_MILLIS, DEFAULT_WINDOW_MILLIS, &hop_size, &window_hops)) {
 		return NULL;
 	}
 
-	d->telegram = telegram_init();
-	if (d->telegram == NULL) {
-		uicdemod_free(d);
-		return NULL;
+	memset(buffer, 0, sizeof(struct uicdemod));
+
+	struct arena a = { buffer, 0 };
+	uicdemod_t * d = arena_alloc(&a, sizeof(struct uicdemod));
+	d->sample_rate = sample_rate;
+
+	d->tones_buffer_size = tonedet_sizeof(FREQ_COUNT, window_hops);
+	d->tones_buffer = arena_alloc(&a, d->tones_buffer_size);
+	d->tones = tonedet_init_in(d->tones_buffer, freqs, FREQ_COUNT, sample_rate, hop_size, window_hops);
+
+	// TODO: configurable deviation
+	d->demod = bfsk_init_in(arena_alloc(&a, bfsk_sizeof(&fskparams, sample_rate)), &fskparams, sample_rate);
+	for (int i = 0; i < BFSK_MAX_SAMPLERS; i++) {
+		d->telegrams[i] = telegram_init_in(arena_alloc(&a, telegram_sizeof()));
 	}
+	d->window_failure = telegram_init_in(arena_alloc(&a, telegram_sizeof()));
+	d->telegram = d->telegrams[0];
+	d->sampler_count = 1;
+	d->window_symbols = SAMPLER_WINDOW_SYMBOLS;
+
+	d->lookback_buffer_size = LOOKBACK_HOPS * hop_size * sizeof(float);
+	d->lookback_buffer = arena_alloc(&a, d->lookback_buffer_size);
+	d->gating = true;
+	d->packed = true;
+	set_gate_window(d, d->lookback_buffer, hop_size, window_hops);
+
+	d->symbol_count = 0;
+	d->symbol_idx = 0;
+	d->pending_tone = UICDEMOD_NONE;
+	d->has_telegram = false;
 
 	d->last_signal = -1;
 	d->current_signal = -1;
@@ -67,11 +277,390 @@ uicdemod_t * uicdemod_init(float sample_rate) {
 	return d;
 }
 
+bool uicdemod_set_tone_window(uicdemod_t * d, int hop_millis, int window_millis) {
+	size_t hop_size, window_hops;
+	if (!tone_window(d->sample_rate, hop_millis, window_millis, &hop_size, &window_hops)) {
+		return false;
+	}
+
+	// Lay the detector and lookback ring out in the block if they fit, as
+	// the default ones do
+	void * lookback = d->lookback_buffer;
+	if (LOOKBACK_HOPS * hop_size * sizeof(float) > d->lookback_buffer_size) {
+		lookback = malloc(LOOKBACK_HOPS * hop_size * sizeof(float));
+		if (lookback == NULL) {
+			return false;
+		}
+	}
+
+	tonedet_t * tones;
+	if (tonedet_sizeof(FREQ_COUNT, window_hops) <= d->tones_buffer_size) {
+		tonedet_free(d->tones);
+		tones = tonedet_init_in(d->tones_buffer, freqs, FREQ_COUNT, d->sample_rate, hop_size, window_hops);
+	} else {
+		tones = tonedet_init(freqs, FREQ_COUNT, d->sample_rate, hop_size, window_hops);
+		if (tones == NULL) {
+			if (lookback != d->lookback_buffer) {
+				free(lookback);
+			}
+			return false;
+		}
+		tonedet_free(d->tones);
+	}
+
+	if (d->lookback != d->lookback_buffer) {
+		free(d->lookback);
+	}
+
+	d->tones = tones;
+	set_gate_window(d, lookback, hop_size, window_hops);
+	return true;
+}
+
 void uicdemod_analyze_begin(uicdemod_t * d) {
-	d->ran_goertzel = false;
 	d->has_telegram = false;
 }
 
+/**
+ * Decides which tone is present given the magnitude of each frequency and
+ * the signal power over the tone detection window.
+ *
+ * @returns detected tone event, or UICDEMOD_NONE if none
+ */
+static uicdemod_status_t decide_tone(uicdemod_t * d, const float * fmag, float signal_power) {
+	uicdemod_status_t status = UICDEMOD_NONE;
+
+	// Get frequency exceeding a certainty level
+	int new_signal = 4;
+	float new_signal_power = 0;
+	for (int i = 0; i < TONE_COUNT; i++) {
+		float fmag_norm = fmag[i] / signal_power;
+		if (fmag_norm > d->tone_certainty && fmag_norm > new_signal_power) {
+			new_signal = i;
+			new_signal_power = fmag_norm;
+		}
+	}
+
+	if (new_signal == d->current_signal) {
+		d->current_signal_ticks++;
+	} else {
+		d->current_signal = new_signal;
+		d->current_signal_ticks = 1;
+	}
+
+	if (d->last_signal != d->current_signal && d->current_signal_ticks == d->required_ticks) {
+		switch (d->current_signal) {
+			case 0:
+				status = UICDEMOD_WARNING;
+				break;
+			case 1:
+				status = UICDEMOD_LISTENING;
+				break;
+			case 2:
+				status = UICDEMOD_CHFREE;
+				break;
+			case 3:
+				status = UICDEMOD_PILOT;
+				break;
+			case 4:
+				status = UICDEMOD_SILENCE;
+		}
+
+		d->last_signal = d->current_signal;
+		STATS_ADD(d->stats.tone_events, 1);
+	}
+
+	return status;
+}
+
+/**
+ * Stores analyzed samples in the lookback ring, keeping only the last ones
+ * that fit.
+ */
+static void store_lookback(uicdemod_t * d, const void * samples, bool s16, size_t sample_count) {
+	if (s16 != d->lookback_s16) {
+		d->lookback_s16 = s16;
+		d->lookback_fill = 0;
+	}
+
+	size_t sample_size = s16 ? sizeof(int16_t) : sizeof(float);
+	const char * data = samples;
+	if (sample_count > d->lookback_size) {
+		data += (sample_count - d->lookback_size) * sample_size;
+		sample_count = d->lookback_size;
+	}
+
+	while (sample_count > 0) {
+		size_t count = d->lookback_size - d->lookback_idx;
+		if (count > sample_count) {
+			count = sample_count;
+		}
+
+		memcpy(d->lookback + d->lookback_idx * sample_size, data, count * sample_size);
+		data += count * sample_size;
+		sample_count -= count;
+
+		d->lookback_idx = (d->lookback_idx + count) % d->lookback_size;
+		d->lookback_fill += count;
+	}
+
+	if (d->lookback_fill > d->lookback_size) {
+		d->lookback_fill = d->lookback_size;
+	}
+}
+
+/**
+ * Resets the telegram parsers of all bit samplers.
+ */
+static void reset_telegrams(uicdemod_t * d) {
+	for (int i = 0; i < d->sampler_count; i++) {
+		telegram_reset(d->telegrams[i]);
+	}
+	d->window_symbols = SAMPLER_WINDOW_SYMBOLS;
+}
+
+/**
+ * Starts or stops the BFSK demodulator at the end of a hop, depending on how
+ * strong mark and space are in the tone window. When started, it is reset
+ * and the lookback ring is queued to be replayed through it.
+ */
+static void update_gate(uicdemod_t * d, const float * fmag, float signal_power) {
+	if (!d->gating || !d->gate_usable) {
+		return;
+	}
+
+	float carrier = fmag[TONE_COUNT] + fmag[TONE_COUNT + 1];
+	if (signal_power > CARRIER_MIN_LEVEL * d->window_size && carrier > CARRIER_THRESHOLD * signal_power) {
+		if (!d->active) {
+			bfsk_reset(d->demod);
+			reset_telegrams(d);
+			d->replay_count = d->lookback_fill;
+			d->active = true;
+		}
+		d->active_hops = d->hold_hops;
+	} else if (d->active && --d->active_hops <= 0) {
+		d->active = false;
+	}
+}
+
+/**
+ * Feeds the next chunk of the lookback ring to the BFSK demodulator, as many
+ * samples as it takes before its symbol batch fills up.
+ */
+static void replay_lookback(uicdemod_t * d) {
+	size_t idx = (d->lookback_idx + d->lookback_size - d->replay_count) % d->lookback_size;
+	size_t count = d->lookback_size - idx;
+	if (count > d->replay_count) {
+		count = d->replay_count;
+	}
+
+	uint64_t start;
+	size_t remaining_samples = count;
+	STATS_START(start);
+	if (d->lookback_s16) {
+		const int16_t * sample_ptr = (const int16_t *) d->lookback + idx;
+		d->symbol_count = bfsk_analyze_block_s16(d->demod, &sample_ptr, &remaining_samples, d->symbols, SYMBOL_BATCH);
+	} else {
+		const float * sample_ptr = (const float *) d->lookback + idx;
+		d->symbol_count = bfsk_analyze_block(d->demod, &sample_ptr, &remaining_samples, d->symbols, SYMBOL_BATCH);
+	}
+	STATS_STOP(d->stats.bfsk, start);
+	d->symbol_idx = 0;
+
+	d->replay_count -= count - remaining_samples;
+}
+
+/**
+ * Updates the gate of the BFSK demodulator and decides the tone at the end of
+ * a hop.
+ *
+ * @returns detected tone event, or UICDEMOD_NONE
+ */
+static uicdemod_status_t finish_hop(uicdemod_t * d, const float * fmag, float signal_power) {
+	update_gate(d, fmag, signal_power);
+	return decide_tone(d, fmag, signal_power);
+}
+
+/**
+ * Feeds float or 16-bit samples to the tone detector, up to the end of the
+ * current hop, and updates the gate of the BFSK demodulator when completed.
+ *
+ * @returns detected tone event if the hop was completed, or UICDEMOD_NONE
+ */
+static uicdemod_status_t analyze_tones(uicdemod_t * d, const void * samples, bool s16, size_t sample_count) {
+	float fmag[FREQ_COUNT];
+	float signal_power;
+	bool completed;
+
+	if (s16) {
+		completed = tonedet_feed_s16(d->tones, samples, sample_count, fmag, &signal_power);
+	} else {
+		completed = tonedet_feed(d->tones, samples, sample_count, fmag, &signal_power);
+	}
+
+	return completed ? finish_hop(d, fmag, signal_power) : UICDEMOD_NONE;
+}
+
+/**
+ * Counts a bit fed to the telegram parser of the first bit sampler, and
+ * whether it found no sync word. The others would only count the same bits
+ * again.
+ */
+static void count_bit(uicdemod_t * d, telegram_t * t) {
+#ifndef NO_STATS
+	d->stats.bits++;
+	if (telegram_status(t) == TELEGRAM_NO_SYNC) {
+		d->stats.no_sync++;
+	}
+#endif
+}
+
+/**
+ * Counts a reported telegram by its outcome.
+ */
+static void count_telegram(uicdemod_t * d) {
+#ifndef NO_STATS
+	switch (telegram_status(d->telegram)) {
+		case TELEGRAM_OK:
+			d->stats.telegram_ok++;
+			break;
+
+		case TELEGRAM_CORRECTED:
+			d->stats.telegram_corrected++;
+			break;
+
+		case TELEGRAM_INTEGRITY:
+			d->stats.telegram_integrity++;
+			break;
+
+		default:
+			break;
+	}
+#endif
+}
+
+/**
+ * Decides whether a telegram completed by a bit sampler is reported, and
+ * makes it the last reported one if so. With several samplers, the first
+ * telegram passing the integrity check is reported, and the others completed
+ * along with it are dropped. A damaged one is reported once every sampler
+ * has failed on it, or else when the window closes without any passing, see
+ * close_window.
+ *
+ * @returns true if the telegram is to be reported
+ */
+static bool arbitrate_telegram(uicdemod_t * d, int sampler) {
+	telegram_t * t = d->telegrams[sampler];
+
+	if (d->sampler_count > 1) {
+		if (d->window_symbols >= SAMPLER_WINDOW_SYMBOLS) {
+			d->window_reported = false;
+			d->window_failed = 0;
+		}
+		d->window_symbols = 0;
+
+		if (d->window_reported) {
+			return false;
+		}
+		if (telegram_status(t) == TELEGRAM_INTEGRITY) {
+			// Its parser goes on with the next bits, so keep a copy
+			if (d->window_failed++ == 0) {
+				memcpy(d->window_failure, t, telegram_sizeof());
+			}
+			if (d->window_failed < d->sampler_count) {
+				return false;
+			}
+		}
+		d->window_reported = true;
+	}
+
+	d->telegram = t;
+	return true;
+}
+
+/**
+ * Counts a symbol of the first bit sampler towards the window. Samplers that
+ * lost the telegram may never complete it, so once the window is over
+ * without any passing, the first failure in it is reported.
+ *
+ * @returns true if a failed telegram is to be reported
+ */
+static bool close_window(uicdemod_t * d) {
+	if (d->window_symbols >= SAMPLER_WINDOW_SYMBOLS || ++d->window_symbols < SAMPLER_WINDOW_SYMBOLS) {
+		return false;
+	}
+
+	if (d->window_reported || d->window_failed == 0) {
+		return false;
+	}
+
+	d->window_reported = true;
+	d->telegram = d->window_failure;
+	return true;
+}
+
+/**
+ * Feeds a demodulated symbol to the telegram parser of its bit sampler.
+ *
+ * @returns true if a telegram has been completed and is to be reported
+ */
+static bool feed_symbol(uicdemod_t * d, const struct bfsk_symbol * symbol) {
+	uint64_t start;
+	bool done = false;
+	bool first = symbol->sampler == 0;
+	telegram_t * t = d->telegrams[symbol->sampler];
+
+	STATS_START(start);
+	if (first && close_window(d)) {
+		count_telegram(d);
+		done = true;
+	}
+
+	switch (symbol->result) {
+		case BFSK_ZERO:
+		case BFSK_ONE:
+			telegram_feed(t, symbol->result == BFSK_ONE ? 1 : 0);
+			if (first) {
+				count_bit(d, t);
+			}
+			if (telegram_is_done(t) && arbitrate_telegram(d, symbol->sampler)) {
+				count_telegram(d);
+				done = true;
+			}
+			break;
+
+		case BFSK_INVALID:
+			telegram_reset(t);
+			if (first) {
+				STATS_ADD(d->stats.invalid, 1);
+			}
+			break;
+
+		default:
+			break;
+	}
+	STATS_STOP(d->stats.telegram, start);
+
+	return done;
+}
+
+/**
+ * Marks the channel as silent so that a silence is always issued before a
+ * packet.
+ *
+ * @returns true if a silence event needs to be issued
+ */
+static bool force_silence(uicdemod_t * d) {
+	if (d->last_signal == 4) {
+		return false;
+	}
+
+	d->last_signal = 4;
+	d->current_signal = 4;
+	d->current_signal_ticks = 1;
+	return true;
+}
+
 uicdemod_status_t uicdemod_analyze(uicdemod_t * d, const float ** samples, size_t * sample_count) {
 	uicdemod_status_t status = UICDEMOD_NONE;
 
@@ -80,97 +669,269 @@ uicdemod_status_t uicdemod_analyze(uicdemod_t * d, const float ** samples, size_
 		return UICDEMOD_PACKET;
 	}
 
-	if (!d->ran_goertzel) {
-		d->ran_goertzel = true;
+	while (status == UICDEMOD_NONE) {
+		if (d->symbol_idx < d->symbol_count) {
+			if (feed_symbol(d, &d->symbols[d->symbol_idx++])) {
+				if (force_silence(d)) {
+					status = UICDEMOD_SILENCE;
+					d->has_telegram = true;
+				} else {
+					status = UICDEMOD_PACKET;
+				}
+			}
+			continue;
+		}
 
-		// Calculate magnitude for all four frequencies
-		float fmag[4];
-		goertzel_magnitude(d->goertzel, *samples, *sample_count, fmag);
+		// Tones are reported after the symbols of the hop they end
+		if (d->pending_tone != UICDEMOD_NONE) {
+			status = d->pending_tone;
+			d->pending_tone = UICDEMOD_NONE;
+			break;
+		}
 
-		// Calculate the signal power
-		float signal_power = 0;
-		for (size_t i = 0; i < *sample_count; i++) {
-			signal_power += abs((*samples)[i]);
+		if (d->replay_count > 0) {
+			replay_lookback(d);
+			continue;
 		}
 
-		// Get frequency exceeding a certainty level
-		int new_signal = 4;
-		float new_signal_power = 0;
-		for (int i = 0; i < 4; i++) {
-			float fmag_norm = fmag[i] / signal_power;
-			if (fmag_norm > d->tone_certainty && fmag_norm > new_signal_power) {
-				new_signal = i;
-				new_signal_power = fmag_norm;
-			}
+		if (*sample_count == 0) {
+			break;
+		}
+
+		// Demodulate up to the end of the hop, and detect tones over the same samples
+		const float * hop_start = *samples;
+		size_t hop_count = tonedet_remaining(d->tones);
+		if (hop_count > *sample_count) {
+			hop_count = *sample_count;
 		}
 
-		if (new_signal == d->current_signal) {
-			d->current_signal_ticks++;
+		size_t remaining_samples = 0;
+		if (d->active) {
+			uint64_t start;
+			remaining_samples = hop_count;
+			STATS_START(start);
+			d->symbol_count = bfsk_analyze_block(d->demod, samples, &remaining_samples, d->symbols, SYMBOL_BATCH);
+			STATS_STOP(d->stats.bfsk, start);
+			d->symbol_idx = 0;
 		} else {
-			d->current_signal = new_signal;
-			d->current_signal_ticks = 1;
-		}
-
-		if (d->last_signal != d->current_signal && d->current_signal_ticks == d->required_ticks) {
-			switch (d->current_signal) {
-				case 0:
-					status = UICDEMOD_WARNING;
-					break;
-				case 1:
-					status = UICDEMOD_LISTENING;
-					break;
-				case 2:
-					status = UICDEMOD_CHFREE;
-					break;
-				case 3:
-					status = UICDEMOD_PILOT;
-					break;
-				case 4:
-					status = UICDEMOD_SILENCE;
+			*samples += hop_count;
+			STATS_ADD(d->stats.idle, hop_count);
+		}
+
+		hop_count -= remaining_samples;
+		if (d->gating && d->gate_usable) {
+			store_lookback(d, hop_start, false, hop_count);
+		}
+		*sample_count -= hop_count;
+		d->position += hop_count;
+		STATS_ADD(d->stats.samples, hop_count);
+		d->pending_tone = analyze_tones(d, hop_start, false, hop_count);
+	}
+
+	return status;
+}
+
+/**
+ * Emits an event detected at a given sample, counting from initialization.
+ * Samples before the current buffer are reported at its start.
+ */
+static void emit_event(uicdemod_t * d, uicdemod_status_t status, uint64_t sample, uicdemod_callback_t callback, void * arg) {
+	struct uicdemod_event event = {
+		.status = status,
+		.offset = sample > d->position ? sample - d->position : 0,
+		.sample = sample
+	};
+
+	if (status == UICDEMOD_PACKET) {
+		telegram_snapshot(d->telegram, &event.telegram);
+		event.clock_error = bfsk_clock_error(d->demod);
+	}
+
+	callback(arg, &event);
+}
+
+/**
+ * Feeds the pending demodulated symbols to the telegram parser and emits the
+ * received packets. Offsets of symbols are relative to sample {@code base},
+ * counting from initialization, unless {@code leftover} is set, in which case
+ * they are all reported at it.
+ */
+static void emit_symbols(uicdemod_t * d, uint64_t base, bool leftover, uicdemod_callback_t callback, void * arg) {
+	for (; d->symbol_idx < d->symbol_count; d->symbol_idx++) {
+		const struct bfsk_symbol * symbol = &d->symbols[d->symbol_idx];
+		if (feed_symbol(d, symbol)) {
+			uint64_t sample = leftover ? base : base + symbol->offset;
+			if (force_silence(d)) {
+				emit_event(d, UICDEMOD_SILENCE, sample, callback, arg);
 			}
+			emit_event(d, UICDEMOD_PACKET, sample, callback, arg);
+		}
+	}
+}
 
-			d->last_signal = d->current_signal;
+/**
+ * Demodulates a range of a buffer of float or 16-bit samples and emits the
+ * received packets.
+ */
+static void analyze_symbols(uicdemod_t * d, const void * samples, bool s16, size_t offset, size_t sample_count, uicdemod_callback_t callback, void * arg) {
+	size_t consumed = 0;
+
+	while (consumed < sample_count) {
+		uint64_t start;
+		size_t remaining_samples = sample_count - consumed;
+		STATS_START(start);
+		if (s16) {
+			const int16_t * sample_ptr = (const int16_t *) samples + offset + consumed;
+			d->symbol_count = bfsk_analyze_block_s16(d->demod, &sample_ptr, &remaining_samples, d->symbols, SYMBOL_BATCH);
+		} else {
+			const float * sample_ptr = (const float *) samples + offset + consumed;
+			d->symbol_count = bfsk_analyze_block(d->demod, &sample_ptr, &remaining_samples, d->symbols, SYMBOL_BATCH);
 		}
+		STATS_STOP(d->stats.bfsk, start);
+		d->symbol_idx = 0;
+
+		emit_symbols(d, d->position + offset + consumed, false, callback, arg);
+		consumed = sample_count - remaining_samples;
+	}
+}
+
+/**
+ * Demodulates a range of a buffer from the signs of its samples, packed while
+ * scanning it for tones, and emits the received packets.
+ */
+static void analyze_signs(uicdemod_t * d, const uint64_t * signs, bool s16, size_t offset, size_t sample_count, uicdemod_callback_t callback, void * arg) {
+	size_t consumed = 0;
+
+	while (consumed < sample_count) {
+		uint64_t start;
+		size_t first = consumed;
+		STATS_START(start);
+		if (s16) {
+			d->symbol_count = bfsk_analyze_signs_s16(d->demod, signs, &consumed, sample_count, d->symbols, SYMBOL_BATCH);
+		} else {
+			d->symbol_count = bfsk_analyze_signs(d->demod, signs, &consumed, sample_count, d->symbols, SYMBOL_BATCH);
+		}
+		STATS_STOP(d->stats.bfsk, start);
+		d->symbol_idx = 0;
+
+		emit_symbols(d, d->position + offset + first, false, callback, arg);
+	}
+}
+
+/**
+ * Analyzes a buffer of float or 16-bit samples hop by hop, so tone events are
+ * emitted in order with packets.
+ */
+static void analyze_buffer(uicdemod_t * d, const void * samples, bool s16, size_t sample_count, uicdemod_callback_t callback, void * arg) {
+	// Symbols and tones left over from uicdemod_analyze belong before this buffer
+	emit_symbols(d, d->position, true, callback, arg);
+	if (d->pending_tone != UICDEMOD_NONE) {
+		emit_event(d, d->pending_tone, d->position, callback, arg);
+		d->pending_tone = UICDEMOD_NONE;
 	}
 
-	// Signal 4, aka no signal
-	if (1 || d->current_signal == 4) {
-		while (status == UICDEMOD_NONE && *sample_count > 0) {
-			bfsk_result_t bfskres = bfsk_analyze(d->demod, samples, sample_count);
-			int bit;
+	STATS_ADD(d->stats.samples, sample_count);
 
-			switch (bfskres) {
-				case BFSK_ZERO:
-				case BFSK_ONE:
-					bit = (bfskres == BFSK_ONE ? 1 : 0);
+	size_t offset = 0;
+	while (offset < sample_count) {
+		size_t hop_count = tonedet_remaining(d->tones);
+		if (hop_count > sample_count - offset) {
+			hop_count = sample_count - offset;
+		}
+		if (hop_count > SCAN_CHUNK) {
+			hop_count = SCAN_CHUNK;
+		}
 
-					telegram_feed(d->telegram, bit);
-					if (telegram_is_done(d->telegram)) {
-						// Ensure we always issue a silence before a packet
-						if (d->last_signal != 4) {
-							status = UICDEMOD_SILENCE;
-							d->last_signal = 4;
-							d->current_signal = 4;
-							d->current_signal_ticks = 1;
-							d->has_telegram = true;
-						} else {
-							status = UICDEMOD_PACKET;
-						}
-					}
+		const void * hop_start = s16 ? (const void *) ((const int16_t *) samples + offset) : (const void *) ((const float *) samples + offset);
+		bool active = d->active;
 
-					break;
+		// Scanning for tones packs the signs, so samples are read just once
+		uint64_t signs[SCAN_CHUNK / 64];
+		float fmag[FREQ_COUNT];
+		float signal_power;
+		bool completed;
+		if (s16) {
+			completed = tonedet_scan_s16(d->tones, hop_start, hop_count, signs, fmag, &signal_power);
+		} else {
+			completed = tonedet_scan(d->tones, hop_start, hop_count, signs, fmag, &signal_power);
+		}
 
-				case BFSK_INVALID:
-					telegram_reset(d->telegram);
-					break;
+		if (!active) {
+			STATS_ADD(d->stats.idle, hop_count);
+		} else if (s16 || d->packed) {
+			analyze_signs(d, signs, s16, offset, hop_count, callback, arg);
+		} else {
+			analyze_symbols(d, samples, s16, offset, hop_count, callback, arg);
+		}
+		if (d->gating && d->gate_usable) {
+			store_lookback(d, hop_start, s16, hop_count);
+		}
 
-				default:
-					break;
-			}
+		uicdemod_status_t status = completed ? finish_hop(d, fmag, signal_power) : UICDEMOD_NONE;
+		offset += hop_count;
+
+		// Tones are decided at the last sample of a hop
+		if (status != UICDEMOD_NONE) {
+			emit_event(d, status, d->position + offset - 1, callback, arg);
+		}
+
+		// The lookback ring ends with this hop, so replayed symbols are
+		// reported at the samples they came from
+		while (d->replay_count > 0) {
+			uint64_t replay_start = d->position + offset - d->replay_count;
+			replay_lookback(d);
+			emit_symbols(d, replay_start, false, callback, arg);
 		}
 	}
 
-	return status;
+	d->position += sample_count;
+}
+
+void uicdemod_analyze_callback(uicdemod_t * d, const float * samples, size_t sample_count, uicdemod_callback_t callback, void * arg) {
+	analyze_buffer(d, samples, false, sample_count, callback, arg);
+}
+
+void uicdemod_analyze_s16_callback(uicdemod_t * d, const int16_t * samples, size_t sample_count, uicdemod_callback_t callback, void * arg) {
+	analyze_buffer(d, samples, true, sample_count, callback, arg);
+}
+
+struct event_array {
+	struct uicdemod_event * events;
+	size_t max_events;
+	size_t event_count;
+};
+
+static void store_event(void * arg, const struct uicdemod_event * event) {
+	struct event_array * array = arg;
+
+	if (array->event_count < array->max_events) {
+		array->events[array->event_count] = *event;
+	}
+	array->event_count++;
+}
+
+size_t uicdemod_analyze_block(uicdemod_t * d, const float * samples, size_t sample_count, struct uicdemod_event * events, size_t max_events) {
+	struct event_array array = {
+		.events = events,
+		.max_events = max_events,
+		.event_count = 0
+	};
+
+	uicdemod_analyze_callback(d, samples, sample_count, store_event, &array);
+	return array.event_count;
+}
+
+void uicdemod_skip(uicdemod_t * d, size_t sample_count) {
+	d->position += sample_count;
+
+	// Neither symbols, tone hops nor the lookback ring from before the gap can continue
+	bfsk_reset(d->demod);
+	tonedet_reset(d->tones);
+	reset_telegrams(d);
+	d->symbol_count = 0;
+	d->symbol_idx = 0;
+	d->lookback_fill = 0;
+	d->replay_count = 0;
 }
 
 telegram_t * uicdemod_get_telegram(uicdemod_t * d) {
@@ -181,17 +942,76 @@ void uicdemod_set_required_ticks(uicdemod_t * d, int ticks) {
 	d->required_ticks = ticks;
 }
 
+bool uicdemod_set_bfsk_engine(uicdemod_t * d, bfsk_engine_t engine) {
+	// Only the packed engine runs several bit samplers
+	if (engine != BFSK_ENGINE_PACKED && d->sampler_count > 1) {
+		return false;
+	}
+
+	if (!bfsk_set_engine(d->demod, engine)) {
+		return false;
+	}
+
+	d->packed = engine == BFSK_ENGINE_PACKED;
+	return true;
+}
+
+void uicdemod_set_symbol_timing(uicdemod_t * d, bfsk_timing_t timing) {
+	bfsk_set_timing(d->demod, timing);
+}
+
+bool uicdemod_set_bit_samplers(uicdemod_t * d, int count) {
+	if ((count > 1 && !d->packed) || !bfsk_set_samplers(d->demod, count)) {
+		return false;
+	}
+
+	d->sampler_count = count;
+	d->telegram = d->telegrams[0];
+	reset_telegrams(d);
+	return true;
+}
+
+void uicdemod_set_error_correction(uicdemod_t * d, int max_bits) {
+	for (int i = 0; i < BFSK_MAX_SAMPLERS; i++) {
+		telegram_set_correction(d->telegrams[i], max_bits);
+	}
+}
+
 void uicdemod_set_tone_certainty(uicdemod_t * d, float threshold) {
 	d->tone_certainty = threshold;
 }
 
+void uicdemod_set_gating(uicdemod_t * d, bool enabled) {
+	d->gating = enabled;
+	d->active = !enabled || !d->gate_usable;
+	d->active_hops = 0;
+	d->lookback_fill = 0;
+	d->replay_count = 0;
+}
+
+void uicdemod_get_stats(uicdemod_t * d, struct uicdemod_stats * stats) {
+	*stats = d->stats;
+	tonedet_get_timers(d->tones, &stats->goertzel, &stats->power);
+
+	// Tone events follow the order of the signals
+	stats->tone = d->last_signal < 0 ? UICDEMOD_NONE : UICDEMOD_WARNING + d->last_signal;
+}
+
 void uicdemod_free(uicdemod_t * d) {
 	if (d == NULL) {
 		return;
 	}
 
-	telegram_free(d->telegram);
+	for (int i = 0; i < BFSK_MAX_SAMPLERS; i++) {
+		telegram_free(d->telegrams[i]);
+	}
+	telegram_free(d->window_failure);
 	bfsk_free(d->demod);
-	goertzel_free(d->goertzel);
-	free(d);
+	tonedet_free(d->tones);
+	if (d->lookback != d->lookback_buffer) {
+		free(d->lookback);
+	}
+	if (d->allocated) {
+		free(d);
+	}
 }
@@ -2,6 +2,8 @@
 #pragma once
 #include <stdlib.h>
 #include "telegram.h"
+#include "bfsk.h"
+#include "stats.h"
 
 typedef struct uicdemod uicdemod_t;
 
@@ -15,6 +17,102 @@ typedef enum {
 	UICDEMOD_PACKET
 } uicdemod_status_t;
 
+/**
+ * Event detected by the block API
+ */
+struct uicdemod_event {
+	/**
+	 * Event type. Never UICDEMOD_NONE.
+	 */
+	uicdemod_status_t status;
+
+	/**
+	 * Position in the buffer of the sample where the event was detected.
+	 * Tones are reported at the last sample of the hop they were decided
+	 * on, and events left over from {@code uicdemod_analyze} at the start
+	 * of the buffer. Packets replayed from before the gate opened that
+	 * ended in an earlier buffer are also reported at its start, with
+	 * their real position in {@code sample}.
+	 */
+	size_t offset;
+
+	/**
+	 * Same position, counting every sample analyzed by the demodulator
+	 * since it was initialized
+	 */
+	uint64_t sample;
+
+	/**
+	 * Copy of the received telegram. Only valid for UICDEMOD_PACKET.
+	 */
+	struct telegram_snapshot telegram;
+
+	/**
+	 * Clock error of the transmitter estimated when the telegram was
+	 * completed, see bfsk_clock_error. Only valid for UICDEMOD_PACKET.
+	 */
+	float clock_error;
+};
+
+/**
+ * Counters of a demodulator, see uicdemod_get_stats
+ */
+struct uicdemod_stats {
+	/**
+	 * Samples analyzed, and those of them skipped by the BFSK demodulator
+	 * for lack of a telegram, see uicdemod_set_gating
+	 */
+	uint64_t samples;
+	uint64_t idle;
+
+	/**
+	 * Valid bits demodulated, and invalid symbols that reset the telegram
+	 * parser
+	 */
+	uint64_t bits;
+	uint64_t invalid;
+
+	/**
+	 * Bits after which the telegram parser found no sync word
+	 */
+	uint64_t no_sync;
+
+	/**
+	 * Telegrams completed, by outcome
+	 */
+	uint64_t telegram_ok;
+	uint64_t telegram_corrected;
+	uint64_t telegram_integrity;
+
+	/**
+	 * Tone events issued, including silences
+	 */
+	uint64_t tone_events;
+
+	/**
+	 * Last tone event issued, or UICDEMOD_NONE if none yet. Kept even if
+	 * built with NO_STATS.
+	 */
+	uicdemod_status_t tone;
+
+	/**
+	 * Time spent on each stage: Goertzel filters, signal power, BFSK
+	 * demodulation (per block) and telegram parsing (per bit)
+	 */
+	struct stats_timer goertzel;
+	struct stats_timer power;
+	struct stats_timer bfsk;
+	struct stats_timer telegram;
+};
+
+/**
+ * Callback for events detected by the block API.
+ *
+ * @param arg Opaque argument given to {@code uicdemod_analyze_callback}
+ * @param event Detected event, valid only during the call
+ */
+typedef void (*uicdemod_callback_t)(void * arg, const struct uicdemod_event * event);
+
 /**
  * Initializes a new UIC-751-3 demodulator.
  *
@@ -23,6 +121,28 @@ typedef enum {
  */
 uicdemod_t * uicdemod_init(float sample_rate);
 
+/**
+ * Returns the size of the buffer needed by {@code uicdemod_init_in}.
+ *
+ * @param sample_rate Input sample rate
+ * @returns size in bytes
+ */
+size_t uicdemod_sizeof(float sample_rate);
+
+/**
+ * Initializes a demodulator like {@code uicdemod_init}, laying it out with all
+ * of its parts in a single buffer provided by the caller. The buffer must be
+ * aligned to 64 bytes, and freed by the caller after {@code uicdemod_free}.
+ *
+ * Only tone windows longer than the default, set with
+ * {@code uicdemod_set_tone_window}, are allocated outside of the buffer.
+ *
+ * @param buffer Buffer, at least {@code uicdemod_sizeof} bytes long
+ * @param sample_rate Input sample rate
+ * @returns Demodulator at the start of the buffer, or NULL on error
+ */
+uicdemod_t * uicdemod_init_in(void * buffer, float sample_rate);
+
 /**
  * Begins a new sample chunk analysis.
  *
@@ -41,6 +161,58 @@ void uicdemod_analyze_begin(uicdemod_t * d);
  */
 uicdemod_status_t uicdemod_analyze(uicdemod_t * d, const float ** samples, size_t * sample_count);
 
+/**
+ * Analizes a whole buffer in one call, passing each detected event to a
+ * callback in order. Must not be mixed with {@code uicdemod_analyze} in the
+ * middle of a buffer.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param samples Input samples
+ * @param sample_count Number of samples
+ * @param callback Event callback
+ * @param arg Opaque argument for callback
+ */
+void uicdemod_analyze_callback(uicdemod_t * d, const float * samples, size_t sample_count, uicdemod_callback_t callback, void * arg);
+
+/**
+ * Same as {@code uicdemod_analyze_callback}, for signed 16-bit samples. Tone
+ * detection and demodulation run in fixed point, so this is the path to use
+ * on CPUs without an FPU. Must not be mixed with float calls on the same
+ * demodulator.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param samples Input samples
+ * @param sample_count Number of samples
+ * @param callback Event callback
+ * @param arg Opaque argument for callback
+ */
+void uicdemod_analyze_s16_callback(uicdemod_t * d, const int16_t * samples, size_t sample_count, uicdemod_callback_t callback, void * arg);
+
+/**
+ * Analizes a whole buffer in one call, storing detected events in order.
+ *
+ * If there are more events than fit in the array the rest are discarded, but
+ * still counted in the return value.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param samples Input samples
+ * @param sample_count Number of samples
+ * @param events Output events
+ * @param max_events Size of event array
+ * @returns number of detected events
+ */
+size_t uicdemod_analyze_block(uicdemod_t * d, const float * samples, size_t sample_count, struct uicdemod_event * events, size_t max_events);
+
+/**
+ * Accounts for samples lost between two buffers, such as audio dropped by a
+ * capture that fell behind. Sample positions of later events skip over them,
+ * and bits are not joined across the gap.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param sample_count Number of samples lost
+ */
+void uicdemod_skip(uicdemod_t * d, size_t sample_count);
+
 /**
  * Retrieves latest read telegram. Should be accessed right after
  * {@code uicdemod_analyze} returns {@code UICDEMOD_PACKET}.
@@ -57,8 +229,37 @@ telegram_t * uicdemod_get_telegram(uicdemod_t * d);
 void uicdemod_set_tone_certainty(uicdemod_t * d, float threshold);
 
 /**
- * Sets the required number of consecutive buffers matching a certain signal
- * for a tone signal to be valid.
+ * Sets whether the BFSK demodulator only runs while mark and space stand out
+ * in the tone detection window, which is the default. Idle channels then
+ * cost little more than tone detection. Has no effect with tone windows over
+ * 60ms, where telegrams don't stand out enough. The last few hops before it starts
+ * are replayed through it, so the beginning of the telegram is not lost.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param enabled true to skip idle stretches, false to demodulate every sample
+ */
+void uicdemod_set_gating(uicdemod_t * d, bool enabled);
+
+/**
+ * Sets the length of the tone detection window, and how often it is
+ * evaluated. Tones are measured over a window sliding one hop at a time,
+ * independently of the size of the analyzed buffers, and the window length is
+ * rounded to a whole number of hops.
+ *
+ * Short hops detect tone changes earlier, while long windows are less
+ * affected by noise. Defaults to a 10ms hop and a 40ms window. Resets tone
+ * detection on success.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param hop_millis hop length, in milliseconds
+ * @param window_millis window length, in milliseconds
+ * @returns true on success, false if invalid or out of memory
+ */
+bool uicdemod_set_tone_window(uicdemod_t * d, int hop_millis, int window_millis);
+
+/**
+ * Sets the required number of consecutive hops matching a certain signal for
+ * a tone signal to be valid.
  *
  * @param d UIC-751-3 demodulator
  * @param ticks number of ticks
@@ -66,7 +267,61 @@ void uicdemod_set_tone_certainty(uicdemod_t * d, float threshold);
 void uicdemod_set_required_ticks(uicdemod_t * d, int ticks);
 
 /**
- * Destroys a demodulator object. Accepts NULL.
+ * Selects the BFSK demodulator engine. See bfsk_set_engine. Only affects
+ * float input, 16-bit input is always demodulated with the packed
+ * correlator.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param engine BFSK engine
+ * @returns true on success, false if not supported, or if running several
+ *   bit samplers and not the packed correlator
+ */
+bool uicdemod_set_bfsk_engine(uicdemod_t * d, bfsk_engine_t engine);
+
+/**
+ * Selects how the bit clock is recovered. See bfsk_set_timing.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param timing Timing recovery mode
+ */
+void uicdemod_set_symbol_timing(uicdemod_t * d, bfsk_timing_t timing);
+
+/**
+ * Sets how many bit samplers the BFSK demodulator runs, each sampling bits at
+ * a different point and feeding its own telegram parser. See
+ * bfsk_set_samplers. Of the telegrams they complete together, the first one
+ * passing the integrity check is reported, and the rest are dropped. Damaged
+ * telegrams are only reported if every sampler fails on them. Needs the
+ * packed correlator, which is the default engine.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param count number of samplers, from 1 (default) to BFSK_MAX_SAMPLERS
+ * @returns true on success, false if out of range or not supported by the
+ *   engine
+ */
+bool uicdemod_set_bit_samplers(uicdemod_t * d, int count);
+
+/**
+ * Sets the maximum number of bit errors to correct in received telegrams.
+ * See telegram_set_correction.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param max_bits number of bits, from 0 (default) to 2
+ */
+void uicdemod_set_error_correction(uicdemod_t * d, int max_bits);
+
+/**
+ * Copies the counters of the demodulator. They all stay at zero if built with
+ * NO_STATS. Must not be called while samples are being analyzed.
+ *
+ * @param d UIC-751-3 demodulator
+ * @param stats Where to store them
+ */
+void uicdemod_get_stats(uicdemod_t * d, struct uicdemod_stats * stats);
+
+/**
+ * Destroys a demodulator object. Accepts NULL, and demodulators in a caller's
+ * buffer, which is not freed.
  *
  * @param d UIC-751-3 demodulator
  */
@@ -0,0 +1,146 @@
+#include "uicmod.h"
+#include "telegram.h"
+#include <math.h>
+
+struct uicmod {
+	float sample_rate;
+	float amplitude;
+
+	/**
+	 * Oscillator phase, in radians
+	 */
+	double phase;
+
+	/**
+	 * Fractional samples carried over from the previous bit, so bit lengths
+	 * average exactly to the bit rate
+	 */
+	double bit_fraction;
+
+	float noise_level;
+	uint32_t noise_state;
+};
+
+// M_PI isn't really standard - define here our own version
+#define PI 3.14159265358979323846264338327950288419716939937510582
+
+#define BPS 600
+#define MARK_HZ 1300
+#define SPACE_HZ 1700
+
+uicmod_t * uicmod_init(float sample_rate) {
+	uicmod_t * m = malloc(sizeof(struct uicmod));
+	if (m == NULL) {
+		return NULL;
+	}
+
+	m->sample_rate = sample_rate;
+	m->amplitude = 0.5;
+	m->phase = 0;
+	m->bit_fraction = 0;
+	m->noise_level = 0;
+	m->noise_state = 1;
+
+	return m;
+}
+
+void uicmod_set_amplitude(uicmod_t * m, float amplitude) {
+	m->amplitude = amplitude;
+}
+
+void uicmod_set_noise(uicmod_t * m, float level, uint32_t seed) {
+	m->noise_level = level;
+
+	// Xorshift gets stuck on zero
+	m->noise_state = seed ? seed : 1;
+}
+
+size_t uicmod_max_samples(uicmod_t * m, float seconds) {
+	return ceil(seconds * m->sample_rate) + 1;
+}
+
+/**
+ * Returns a uniformly distributed number in (0, 1]
+ */
+static double noise_uniform(uicmod_t * m) {
+	uint32_t x = m->noise_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	m->noise_state = x;
+
+	return (x + 1.0) / 4294967296.0;
+}
+
+/**
+ * Generates a sine at the given frequency, or silence if zero.
+ */
+static size_t oscillate(uicmod_t * m, float frequency, size_t count, float * samples) {
+	double step = 2 * PI * frequency / m->sample_rate;
+
+	for (size_t i = 0; i < count; i++) {
+		float sample = 0;
+		if (frequency > 0) {
+			m->phase += step;
+			if (m->phase > 2 * PI) {
+				m->phase -= 2 * PI;
+			}
+			sample = m->amplitude * sin(m->phase);
+		}
+
+		if (m->noise_level > 0) {
+			// Box-Muller, throwing away the second value for simplicity
+			double r = sqrt(-2 * log(noise_uniform(m)));
+			sample += m->noise_level * r * cos(2 * PI * noise_uniform(m));
+		}
+
+		samples[i] = sample;
+	}
+
+	return count;
+}
+
+size_t uicmod_tone(uicmod_t * m, uicdemod_status_t tone, float seconds, float * samples) {
+	float frequency;
+	switch (tone) {
+		case UICDEMOD_WARNING:
+			frequency = 1520;
+			break;
+		case UICDEMOD_LISTENING:
+			frequency = 1960;
+			break;
+		case UICDEMOD_CHFREE:
+			frequency = 2280;
+			break;
+		case UICDEMOD_PILOT:
+			frequency = 2800;
+			break;
+		default:
+			frequency = 0;
+			break;
+	}
+
+	return oscillate(m, frequency, (size_t) (seconds * m->sample_rate), samples);
+}
+
+size_t uicmod_bits(uicmod_t * m, uint64_t bits, int bit_count, float * samples) {
+	size_t count = 0;
+
+	for (int i = bit_count - 1; i >= 0; i--) {
+		m->bit_fraction += m->sample_rate / BPS;
+		size_t length = (size_t) m->bit_fraction;
+		m->bit_fraction -= length;
+
+		count += oscillate(m, (bits >> i) & 1 ? MARK_HZ : SPACE_HZ, length, samples + count);
+	}
+
+	return count;
+}
+
+size_t uicmod_telegram(uicmod_t * m, int train_number, int code_number, float * samples) {
+	return uicmod_bits(m, telegram_encode(train_number, code_number), 51, samples);
+}
+
+void uicmod_free(uicmod_t * m) {
+	free(m);
+}
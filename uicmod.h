@@ -0,0 +1,84 @@
+#pragma once
+#include <stdlib.h>
+#include <stdint.h>
+#include "uicdemod.h"
+
+typedef struct uicmod uicmod_t;
+
+/**
+ * Initializes a new UIC-751-3 modulator, which synthesizes the signals the
+ * demodulator listens for. Output is phase continuous across calls.
+ *
+ * @param sample_rate Output sample rate
+ * @returns New modulator, or NULL on error
+ */
+uicmod_t * uicmod_init(float sample_rate);
+
+/**
+ * Sets the peak amplitude of generated signals. Defaults to 0.5.
+ *
+ * @param m UIC-751-3 modulator
+ * @param amplitude Signal amplitude
+ */
+void uicmod_set_amplitude(uicmod_t * m, float amplitude);
+
+/**
+ * Sets the level of white gaussian noise added to the output. Defaults to no
+ * noise.
+ *
+ * @param m UIC-751-3 modulator
+ * @param level Noise standard deviation
+ * @param seed Seed for the noise generator, so runs can be repeated
+ */
+void uicmod_set_noise(uicmod_t * m, float level, uint32_t seed);
+
+/**
+ * Returns the maximum number of samples that will be generated for the given
+ * duration.
+ *
+ * @param m UIC-751-3 modulator
+ * @param seconds Duration
+ * @returns Sample count
+ */
+size_t uicmod_max_samples(uicmod_t * m, float seconds);
+
+/**
+ * Generates one of the tone signals.
+ *
+ * @param m UIC-751-3 modulator
+ * @param tone UICDEMOD_WARNING, UICDEMOD_LISTENING, UICDEMOD_CHFREE or
+ * UICDEMOD_PILOT. Any other value generates silence.
+ * @param seconds Duration
+ * @param samples Output samples
+ * @returns number of samples generated
+ */
+size_t uicmod_tone(uicmod_t * m, uicdemod_status_t tone, float seconds, float * samples);
+
+/**
+ * Generates BFSK modulated bits.
+ *
+ * @param m UIC-751-3 modulator
+ * @param bits Bits to send, most significant first
+ * @param bit_count Number of bits, up to 64
+ * @param samples Output samples
+ * @returns number of samples generated
+ */
+size_t uicmod_bits(uicmod_t * m, uint64_t bits, int bit_count, float * samples);
+
+/**
+ * Generates a BFSK modulated telegram, with synchronization header and CRC.
+ *
+ * @param m UIC-751-3 modulator
+ * @param train_number Train number, as six BCD digits
+ * @param code_number Telegram code
+ * @param samples Output samples
+ * @returns number of samples generated
+ */
+size_t uicmod_telegram(uicmod_t * m, int train_number, int code_number, float * samples);
+
+/**
+ * Destroys a modulator object. Accepts NULL.
+ *
+ * @param m UIC-751-3 modulator
+ */
+void uicmod_free(uicmod_t * m);
@@ -0,0 +1,198 @@
+#include "writer.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+struct writer {
+	/**
+	 * Output file descriptor, or -1 to keep everything in memory
+	 */
+	int fd;
+	int flush_millis;
+
+	char * buffer;
+	size_t buffer_size;
+	size_t used;
+
+	/**
+	 * When the oldest data in the buffer was added, in milliseconds
+	 */
+	int64_t pending_since;
+};
+
+static int64_t now_millis(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+writer_t * writer_init(int fd, size_t buffer_size, int flush_millis) {
+	if (buffer_size == 0 || flush_millis < 0) {
+		return NULL;
+	}
+
+	writer_t * w = calloc(1, sizeof(struct writer));
+	if (w == NULL) {
+		return NULL;
+	}
+
+	w->fd = fd;
+	w->flush_millis = flush_millis;
+	w->buffer_size = buffer_size;
+	w->buffer = malloc(buffer_size);
+	if (w->buffer == NULL) {
+		writer_free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+writer_t * writer_init_memory(size_t buffer_size) {
+	return writer_init(-1, buffer_size, 0);
+}
+
+/**
+ * Writes out a range of data, retrying on partial writes.
+ */
+static bool write_all(int fd, const char * data, size_t size) {
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+
+		data += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+bool writer_flush(writer_t * w) {
+	if (w->fd < 0) {
+		return true;
+	}
+
+	size_t used = w->used;
+	w->used = 0;
+
+	return write_all(w->fd, w->buffer, used);
+}
+
+/**
+ * Notes when data was first added to an empty buffer.
+ */
+static void mark_pending(writer_t * w) {
+	if (w->used == 0) {
+		w->pending_since = now_millis();
+	}
+}
+
+/**
+ * Grows the buffer of a memory writer to hold at least the given size.
+ */
+static bool grow_buffer(writer_t * w, size_t size) {
+	size_t new_size = w->buffer_size;
+	while (new_size < size) {
+		new_size *= 2;
+	}
+
+	char * buffer = realloc(w->buffer, new_size);
+	if (buffer == NULL) {
+		return false;
+	}
+
+	w->buffer = buffer;
+	w->buffer_size = new_size;
+	return true;
+}
+
+bool writer_write(writer_t * w, const void * data, size_t size) {
+	if (w->fd < 0 && w->used + size > w->buffer_size && !grow_buffer(w, w->used + size)) {
+		return false;
+	}
+
+	if (w->used + size > w->buffer_size) {
+		if (!writer_flush(w)) {
+			return false;
+		}
+
+		// Too big to be buffered at all
+		if (size > w->buffer_size) {
+			return write_all(w->fd, data, size);
+		}
+	}
+
+	mark_pending(w);
+	memcpy(w->buffer + w->used, data, size);
+	w->used += size;
+	return true;
+}
+
+bool writer_printf(writer_t * w, const char * format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	int size = vsnprintf(w->buffer + w->used, w->buffer_size - w->used, format, args);
+	va_end(args);
+
+	if (size < 0) {
+		return false;
+	}
+
+	if (w->used + size < w->buffer_size) {
+		mark_pending(w);
+		w->used += size;
+		return true;
+	}
+
+	// Did not fit, format it again on its own
+	char * text = malloc(size + 1);
+	if (text == NULL) {
+		return false;
+	}
+
+	va_start(args, format);
+	vsnprintf(text, size + 1, format, args);
+	va_end(args);
+
+	bool ok = writer_write(w, text, size);
+	free(text);
+	return ok;
+}
+
+bool writer_append(writer_t * w, const writer_t * src) {
+	return writer_write(w, src->buffer, src->used);
+}
+
+bool writer_poll(writer_t * w) {
+	if (w->used == 0) {
+		return true;
+	}
+
+	if (w->flush_millis > 0 && now_millis() - w->pending_since < w->flush_millis) {
+		return true;
+	}
+
+	return writer_flush(w);
+}
+
+void writer_free(writer_t * w) {
+	if (w == NULL) {
+		return;
+	}
+
+	if (w->buffer) {
+		writer_flush(w);
+	}
+	free(w->buffer);
+	free(w);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef struct writer writer_t;
+
+/**
+ * Initializes a batched writer over a file descriptor.
+ *
+ * Data is kept in a buffer and only written out when it fills up, or when
+ * polled once the oldest data in it has waited for the flush interval, so
+ * many small records cost a single system call.
+ *
+ * @param fd File descriptor, not closed by the writer
+ * @param buffer_size Size of the buffer, in bytes
+ * @param flush_millis Longest time data may wait in the buffer, or 0 to
+ *   write it out on every poll
+ * @returns New writer, or NULL on error
+ */
+writer_t * writer_init(int fd, size_t buffer_size, int flush_millis);
+
+/**
+ * Initializes a writer that keeps all data in memory, growing its buffer as
+ * needed, until added to another writer with {@code writer_append}. Flushing
+ * and polling it does nothing.
+ *
+ * @param buffer_size Initial size of the buffer, in bytes
+ * @returns New writer, or NULL on error
+ */
+writer_t * writer_init_memory(size_t buffer_size);
+
+/**
+ * Adds data to the buffer, writing it out first if it does not fit.
+ *
+ * @param w Writer
+ * @param data Data to write
+ * @param size Size of data, in bytes
+ * @returns true on success, false if writing failed
+ */
+bool writer_write(writer_t * w, const void * data, size_t size);
+
+/**
+ * Adds formatted text to the buffer, like printf.
+ *
+ * @param w Writer
+ * @param format Format string
+ * @returns true on success, false if writing failed
+ */
+bool writer_printf(writer_t * w, const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Adds all the data kept by a memory writer to another writer.
+ *
+ * @param w Writer
+ * @param src Memory writer, left unchanged
+ * @returns true on success, false if writing failed
+ */
+bool writer_append(writer_t * w, const writer_t * src);
+
+/**
+ * Writes out the buffer if the flush interval has elapsed since the oldest
+ * data in it was added.
+ *
+ * @param w Writer
+ * @returns true on success, false if writing failed
+ */
+bool writer_poll(writer_t * w);
+
+/**
+ * Writes out the buffer right away.
+ *
+ * @param w Writer
+ * @returns true on success, false if writing failed
+ */
+bool writer_flush(writer_t * w);
+
+/**
+ * Writes out the buffer and destroys the writer. Accepts NULL.
+ *
+ * @param w Writer
+ */
+void writer_free(writer_t * w);